@@ -46,6 +46,26 @@ namespace BTUT
             Assert::IsTrue(btItems.size() > 0);
         }
 
+        TEST_METHOD(testBluetoothInquireAsync)
+        {
+            boost::asio::io_service io;
+            std::size_t seen = 0;
+            std::size_t completed = 0;
+
+            BluetoothInquiry inquiry(io, BluetoothInquiryOptions("", 1, false),
+                [&seen](BluetoothInqItem const&) {
+                    ++seen;
+                    return true;
+                },
+                [&completed](std::size_t found) {
+                    completed = found;
+                });
+            io.run();
+
+            Assert::IsTrue(seen <= 1);
+            Assert::AreEqual(seen, completed);
+        }
+
         TEST_METHOD(testBluetoothConnect)
         {
             try {
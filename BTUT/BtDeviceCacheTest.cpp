@@ -0,0 +1,67 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+#define TEST_CACHE_PATH "btut-devices.cache"
+
+namespace BTUT {
+    TEST_CLASS(BtDeviceCacheTest) {
+
+    public:
+        BtDeviceCacheTest() {
+            remove(TEST_CACHE_PATH);
+        }
+        ~BtDeviceCacheTest() {
+            remove(TEST_CACHE_PATH);
+        }
+
+        TEST_METHOD(testSaveAndLoadKeepsChannel) {
+            BtDeviceCache cache(TEST_CACHE_PATH);
+            cache.remember(BluetoothInqItem("Sphero-RGB", 0x000666123456ULL, 1));
+            cache.remember(BluetoothInqItem("Sphero-YBW", 0x000666ABCDEFULL, 0));
+            Assert::IsTrue(cache.save());
+
+            BtDeviceCache reloaded(TEST_CACHE_PATH);
+            Assert::IsTrue(reloaded.load());
+
+            BtDeviceCache::Entry entry;
+            Assert::IsTrue(reloaded.lookup(0x000666123456ULL, entry));
+            Assert::AreEqual(std::string("Sphero-RGB"), entry.name);
+            Assert::AreEqual((unsigned long) 1, (unsigned long) entry.channel);
+
+            Assert::IsTrue(reloaded.lookup(0x000666ABCDEFULL, entry));
+            Assert::AreEqual((unsigned long) 0, (unsigned long) entry.channel);
+        }
+
+        TEST_METHOD(testKnownChannelSkipsServiceLookup) {
+            BtDeviceCache cache(TEST_CACHE_PATH);
+            cache.remember(BluetoothInqItem("Sphero-RGB", 0x000666123456ULL, 6));
+
+            auto devices = cache.devices("Sphero");
+            Assert::AreEqual((std::size_t) 1, devices.size());
+            Assert::AreEqual((unsigned long) 6, (unsigned long) devices[0].address.port);
+
+            // An inquiry result (port 0) must not erase the known channel
+            cache.remember(BluetoothInqItem("Sphero-RGB", 0x000666123456ULL, 0));
+            Assert::AreEqual((unsigned long) 6,
+                (unsigned long) cache.devices("Sphero")[0].address.port);
+
+            cache.invalidateChannel(0x000666123456ULL);
+            Assert::AreEqual((unsigned long) 0,
+                (unsigned long) cache.devices("Sphero")[0].address.port);
+        }
+
+        TEST_METHOD(testPrefixFilterAndForget) {
+            BtDeviceCache cache(TEST_CACHE_PATH);
+            cache.remember(BluetoothInqItem("Sphero-RGB", 0x1ULL, 1));
+            cache.remember(BluetoothInqItem("Headset", 0x2ULL, 1));
+
+            Assert::AreEqual((std::size_t) 1, cache.devices("Sphero").size());
+            Assert::AreEqual((std::size_t) 2, cache.devices().size());
+
+            cache.forget(0x1ULL);
+            Assert::AreEqual((std::size_t) 0, cache.devices("Sphero").size());
+        }
+    };
+}
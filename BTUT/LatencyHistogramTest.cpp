@@ -0,0 +1,106 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(LatencyHistogramTest) {
+
+    public:
+        LatencyHistogramTest() {
+        }
+
+        TEST_METHOD(testSmallValuesAreExact) {
+            LatencyHistogram histogram;
+            for (uint64_t i = 1; i <= 10; ++i)
+                histogram.record(i);
+
+            auto snap = histogram.snapshot();
+            Assert::AreEqual((uint64_t) 10, snap.count());
+            Assert::AreEqual((uint64_t) 1, snap.min());
+            Assert::AreEqual((uint64_t) 10, snap.max());
+            Assert::AreEqual((uint64_t) 5, snap.percentile(50.0));
+            Assert::AreEqual((uint64_t) 10, snap.percentile(100.0));
+        }
+
+        TEST_METHOD(testLargeValuesWithinRelativeError) {
+            uint64_t values[] = { 40000, 123456, 999999, 12345678 };
+
+            for (auto value : values) {
+                LatencyHistogram single;
+                single.record(value);
+                uint64_t reported = single.snapshot().percentile(50.0);
+
+                Assert::IsTrue(reported <= value);
+                Assert::IsTrue(value - reported <= value / LatencyHistogram::SUB_BUCKETS);
+            }
+        }
+
+        TEST_METHOD(testPercentiles) {
+            LatencyHistogram histogram;
+            for (int i = 0; i < 990; ++i)
+                histogram.record(1000);
+            for (int i = 0; i < 10; ++i)
+                histogram.record(50000);
+
+            auto snap = histogram.snapshot();
+            uint64_t tolerance = 1000 / LatencyHistogram::SUB_BUCKETS;
+            Assert::IsTrue(snap.percentile(50.0) <= 1000 + tolerance);
+            Assert::IsTrue(snap.percentile(99.0) <= 1000 + tolerance);
+            Assert::IsTrue(snap.percentile(99.9) > 40000);
+        }
+
+        TEST_METHOD(testSnapshotAndResetMerge) {
+            LatencyHistogram first;
+            LatencyHistogram second;
+            first.record(100);
+            second.record(200);
+            second.record(300);
+
+            auto merged = first.snapshotAndReset();
+            merged.merge(second.snapshot());
+
+            Assert::AreEqual((uint64_t) 0, first.snapshot().count());
+            Assert::AreEqual((uint64_t) 3, merged.count());
+            Assert::AreEqual((uint64_t) 100, merged.min());
+            Assert::AreEqual((uint64_t) 300, merged.max());
+        }
+
+        TEST_METHOD(testRecorderClosesSequence) {
+            SpheroLatencyRecorder recorder;
+            recorder.commandSent(RollCommand::slot(), 0x42);
+
+            Assert::IsTrue(recorder.responseReceived(0x42));
+            Assert::IsFalse(recorder.responseReceived(0x42)); // duplicate
+            Assert::IsFalse(recorder.responseReceived(0x43)); // never sent
+
+            auto report = recorder.report();
+            Assert::AreEqual((uint64_t) 1, report.get<RollCommand>().count());
+            Assert::AreEqual((uint64_t) 0, report.get<PingCommand>().count());
+            Assert::AreEqual((uint64_t) 1,
+                report.get(DID_SPHERO, CMD_ROLL).count());
+        }
+
+        TEST_METHOD(testFrameDecoderSplitsStream) {
+            SpheroFrameDecoder decoder;
+            std::vector<unsigned char> seqs;
+
+            // Two ping responses (SEQ 1 & 2) delivered across three reads
+            unsigned char stream[] = {
+                0xFF, 0xFF, 0x00, 0x01, 0x01, 0xFD,
+                0xFF, 0xFF, 0x00, 0x02, 0x01, 0xFC
+            };
+            auto handler = [&seqs](unsigned char const* frame, std::size_t) {
+                seqs.push_back(frame[3]);
+            };
+            decoder.feed(stream, 4, handler);
+            decoder.feed(stream + 4, 5, handler);
+            decoder.feed(stream + 9, 3, handler);
+
+            Assert::AreEqual((std::size_t) 2, seqs.size());
+            Assert::AreEqual((unsigned char) 0x01, seqs[0]);
+            Assert::AreEqual((unsigned char) 0x02, seqs[1]);
+            Assert::AreEqual((uint64_t) 0, decoder.badChecksums());
+        }
+    };
+}
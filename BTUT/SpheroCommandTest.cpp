@@ -33,12 +33,20 @@ namespace BTUT
 
         SOCKADDR_BTH* getSpheroBtAddr() {
             for (int i = 0; i < INQ_MAX_RETRIES; ++i) {
-                BluetoothProto::bluetoothInquire(btItems);
-                for (auto & item : btItems) {
-                    if (item.name.find("Sphero") != std::string::npos) {
-                        BtLogger::log() << std::endl << "Found Sphero Bluetooth Address..." << std::endl;
-                        return &(item.address);
-                    }
+                boost::asio::io_service io;
+                btItems.clear();
+
+                // Stop at the first Sphero, whether remembered or freshly inquired
+                BluetoothInquiry inquiry(io, BluetoothInquiryOptions("Sphero", 1),
+                    [this](BluetoothInqItem const& item) {
+                        btItems.push_back(item);
+                        return false;
+                    }, nullptr);
+                io.run();
+
+                if (!btItems.empty()) {
+                    BtLogger::log() << std::endl << "Found Sphero Bluetooth Address..." << std::endl;
+                    return &(btItems.front().address);
                 }
 
                 BtLogger::log() << "Sphero not found. Sleeping an trying again...." << std::endl;
@@ -215,5 +223,83 @@ namespace BTUT
             BtLogger::log() << "    Y-Velocity: " << yVel << std::endl;
             BtLogger::log() << "  Ground Speed: " << speedOverGround << std::endl;
         }
+
+        TEST_METHOD(int_testUploadOrbBasic) {
+            // Long enough to take several fragments
+            std::ostringstream program;
+            for (int line = 1; line <= 40; ++line)
+                program << line * 10 << " RGB " << (line * 6) << ", 0, 0 : delay 50\n";
+
+            SpheroUploader uploader(robot);
+            std::size_t progressCalls = 0;
+            uploader.setProgressHandler([&progressCalls](SpheroUploadProgress const&) {
+                ++progressCalls;
+            });
+
+            SpheroUploadResult result = uploader.uploadOrbBasic(program.str());
+
+            std::shared_ptr<wchar_t> wMsgResp(allocateWideMessageString(result.error));
+            Assert::IsTrue(result.ok, wMsgResp.get());
+            Assert::AreEqual(program.str().size(), result.progress.bytesDone);
+            Assert::AreEqual(result.progress.chunksTotal, progressCalls);
+
+            BtLogger::log() << "  Upload Rate: " << std::dec <<
+                result.progress.bytesPerSecond() << " bytes/s" << std::endl;
+        }
+
+        TEST_METHOD(int_testSendAsync) {
+            std::mutex mutex;
+            std::condition_variable answered;
+            int responses = 0;
+            boost::system::error_code error;
+
+            for (int i = 0; i < 3; ++i) {
+                robot.sendAsync(PingCommand(),
+                    [&](boost::system::error_code const& ec, SpheroResponsePtr response) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        if (ec) error = ec;
+                        else if (response->messageResponse() == ORBOTIX_RSP_CODE_OK) ++responses;
+                        answered.notify_all();
+                    });
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            Assert::IsTrue(answered.wait_for(lock, std::chrono::seconds(3),
+                [&]() { return responses == 3 || error; }));
+            Assert::IsFalse((bool)error);
+        }
+
+        TEST_METHOD(int_testKeepaliveMeasuresRtt) {
+            SpheroKeepaliveOptions options;
+            options.interval = std::chrono::milliseconds(200);
+            options.inactiveTimer = 60;
+            SpheroKeepalive keepalive(robot, options);
+
+            // An idle link is pinged every interval
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+            Assert::IsTrue(keepalive.alive());
+            Assert::IsTrue(keepalive.pings() >= 5);
+            Assert::AreEqual((uint64_t) 0, keepalive.missed());
+            Assert::IsTrue(keepalive.lastRtt().count() > 0);
+        }
+
+        TEST_METHOD(int_testShadowSettingsReplay) {
+            std::vector<SpheroSharedFramePtr> settings;
+            {
+                SpheroShadow shadow(robot);
+                shadow.invalidateAll();
+                int roll = shadow.send(makeRollCommand(0, 90, 0));
+                int rgb = shadow.send(makeSetRGBCommand(0x10, 0x20, 0x30));
+                robot.readResponse((unsigned char)roll, std::chrono::milliseconds(500));
+                robot.readResponse((unsigned char)rgb, std::chrono::milliseconds(500));
+                settings = shadow.settings();
+            }
+
+            // What a promoted spare would be sent, motion last
+            Assert::AreEqual((std::size_t) 2, settings.size());
+            Assert::AreEqual(RollCommand::slot(), settings.back()->slot());
+            Assert::AreEqual((std::size_t) 2,
+                SpheroStandbyPool::apply(robot, settings, std::chrono::milliseconds(500)));
+        }
     };
 }
\ No newline at end of file
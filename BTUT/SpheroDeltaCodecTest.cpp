@@ -0,0 +1,101 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroDeltaCodecTest) {
+
+        static std::vector<short> roundTrip(std::vector<short> const& values,
+                                            std::size_t & bytes) {
+            std::vector<unsigned char> packed(SpheroDeltaCodec::maxEncodedSize(values.size()));
+            bytes = SpheroDeltaCodec::encode(values.data(), values.size(), packed.data());
+            Assert::IsTrue(bytes <= packed.size());
+
+            std::vector<short> decoded(values.size());
+            std::size_t consumed = 0;
+            Assert::IsTrue(SpheroDeltaCodec::decode(packed.data(), bytes,
+                decoded.data(), decoded.size(), consumed));
+            Assert::AreEqual(bytes, consumed);
+            return decoded;
+        }
+
+    public:
+        TEST_METHOD(testRoundTripsAnyLength) {
+            std::size_t lengths[] = { 0, 1, 7, 127, 128, 129, 300 };
+            for (std::size_t n : lengths) {
+                std::vector<short> values(n);
+                for (std::size_t i = 0; i < n; ++i)
+                    values[i] = (short)(i * i * 37 - 500);
+
+                std::size_t bytes = 0;
+                Assert::IsTrue(values == roundTrip(values, bytes));
+            }
+        }
+
+        TEST_METHOD(testWidthFollowsLargestStep) {
+            std::size_t bytes = 0;
+
+            // No change at all packs to the width byte of each block
+            std::vector<short> flat(256, 0);
+            Assert::IsTrue(flat == roundTrip(flat, bytes));
+            Assert::AreEqual((std::size_t) 2, bytes);
+
+            // Steps of +-1 zigzag to at most 2, two bits per value
+            std::vector<short> steps(128);
+            for (std::size_t i = 0; i < steps.size(); ++i)
+                steps[i] = (short)((i % 2) ? -1 : 0);
+            Assert::IsTrue(steps == roundTrip(steps, bytes));
+            Assert::AreEqual((std::size_t) 1 + 16 * 2, bytes);
+
+            // Swinging between the extremes needs all 16 bits
+            std::vector<short> extremes(128);
+            for (std::size_t i = 0; i < extremes.size(); ++i)
+                extremes[i] = (i % 2) ? SHRT_MIN : SHRT_MAX;
+            Assert::IsTrue(extremes == roundTrip(extremes, bytes));
+            Assert::AreEqual((std::size_t) 1 + 16 * 16, bytes);
+        }
+
+        TEST_METHOD(testScalarMatchesSimd) {
+            std::vector<short> values(1000);
+            unsigned noise = 7;
+            for (std::size_t i = 0; i < values.size(); ++i) {
+                noise = noise * 1103515245 + 12345;
+                // A new width every block, up to a full 16 bits
+                int range = 1 << (i / 128 * 2);
+                values[i] = (short)((noise >> 8) % range);
+            }
+
+            std::size_t size = SpheroDeltaCodec::maxEncodedSize(values.size());
+            std::vector<unsigned char> simd(size), scalar(size);
+            std::size_t simdBytes = SpheroDeltaCodec::encode(values.data(), values.size(), simd.data());
+            std::size_t scalarBytes = SpheroDeltaCodec::encodeScalar(values.data(), values.size(), scalar.data());
+            Assert::AreEqual(simdBytes, scalarBytes);
+            Assert::IsTrue(std::equal(simd.begin(), simd.begin() + simdBytes, scalar.begin()));
+
+            std::vector<short> decoded(values.size());
+            std::size_t consumed = 0;
+            Assert::IsTrue(SpheroDeltaCodec::decodeScalar(simd.data(), simdBytes,
+                decoded.data(), decoded.size(), consumed));
+            Assert::IsTrue(values == decoded);
+        }
+
+        TEST_METHOD(testRejectsTruncatedInput) {
+            std::vector<short> values(200, 0);
+            for (std::size_t i = 0; i < values.size(); ++i)
+                values[i] = (short)(i * 3);
+
+            std::vector<unsigned char> packed(SpheroDeltaCodec::maxEncodedSize(values.size()));
+            std::size_t bytes = SpheroDeltaCodec::encode(values.data(), values.size(), packed.data());
+
+            std::vector<short> decoded(values.size());
+            std::size_t consumed = 0;
+            Assert::IsFalse(SpheroDeltaCodec::decode(packed.data(), bytes - 1,
+                decoded.data(), decoded.size(), consumed));
+
+            packed[0] = 17;     // no such width
+            Assert::IsFalse(SpheroDeltaCodec::decode(packed.data(), bytes,
+                decoded.data(), decoded.size(), consumed));
+        }
+    };
+}
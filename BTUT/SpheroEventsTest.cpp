@@ -0,0 +1,58 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroEventsTest) {
+
+    public:
+        TEST_METHOD(testDecodeCollision) {
+            unsigned char frame[] = {
+                0xFF, 0xFE, ASYNC_COLLISION, 0x00, 0x11,
+                0x00, 0x40,     // X
+                0xFF, 0xC0,     // Y
+                0x01, 0x00,     // Z
+                0x03,           // both axes
+                0x01, 0x20,     // xMagnitude
+                0x00, 0x90,     // yMagnitude
+                0x7F,           // speed
+                0x00, 0x01, 0x02, 0x03,
+                0x00            // checksum, not checked here
+            };
+            auto arrival = std::chrono::steady_clock::now();
+
+            SpheroCollisionEvent event;
+            Assert::IsTrue(SpheroEvents::decodeCollision(
+                SpheroResponseView(frame, sizeof(frame), arrival), event));
+            Assert::AreEqual((int) 0x40, (int) event.x);
+            Assert::AreEqual((int) -0x40, (int) event.y);
+            Assert::AreEqual((int) 0x100, (int) event.z);
+            Assert::AreEqual((int) (SpheroCollisionEvent::X_AXIS | SpheroCollisionEvent::Y_AXIS),
+                (int) event.axis);
+            Assert::AreEqual((int) 0x120, (int) event.xMagnitude);
+            Assert::AreEqual((int) 0x90, (int) event.yMagnitude);
+            Assert::AreEqual((int) 0x7F, (int) event.speed);
+            Assert::AreEqual((unsigned long) 0x00010203, (unsigned long) event.timestamp);
+            Assert::IsTrue(event.arrival == arrival);
+
+            // A truncated message is rejected rather than read past its end
+            Assert::IsFalse(SpheroEvents::decodeCollision(
+                SpheroResponseView(frame, sizeof(frame) - 4), event));
+        }
+
+        TEST_METHOD(testDecodePower) {
+            unsigned char frame[] = { 0xFF, 0xFE, ASYNC_POWER_NOTIFY, 0x00, 0x02,
+                POWER_STATE_LOW, 0x00 };
+
+            SpheroPowerEvent event;
+            Assert::IsTrue(SpheroEvents::decodePower(
+                SpheroResponseView(frame, sizeof(frame)), event));
+            Assert::AreEqual((int) POWER_STATE_LOW, (int) event.state);
+
+            unsigned char empty[] = { 0xFF, 0xFE, ASYNC_POWER_NOTIFY, 0x00, 0x01, 0x00 };
+            Assert::IsFalse(SpheroEvents::decodePower(
+                SpheroResponseView(empty, sizeof(empty)), event));
+        }
+    };
+}
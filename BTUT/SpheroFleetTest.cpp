@@ -0,0 +1,133 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroFleetTest) {
+        typedef std::chrono::steady_clock Clock;
+
+        // A port nothing listens on, so connecting to it is refused
+        static BluetoothProto::endpoint deadEndpoint() {
+            boost::asio::io_service io;
+            boost::asio::ip::tcp::acceptor acceptor(io, boost::asio::ip::tcp::endpoint(
+                boost::asio::ip::address_v4::loopback(), 0));
+            BluetoothProto::endpoint endpoint(acceptor.local_endpoint());
+            acceptor.close();
+            return endpoint;
+        }
+
+        static std::chrono::milliseconds since(Clock::time_point start) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+        }
+
+    public:
+        TEST_METHOD(testConnectReportsEveryEndpoint) {
+            bench::LoopbackDevice first((bench::LoopbackDevice::LinkConfig()));
+            bench::LoopbackDevice last((bench::LoopbackDevice::LinkConfig()));
+            first.start();
+            last.start();
+            std::vector<BluetoothProto::endpoint> endpoints = {
+                first.endpoint(), deadEndpoint(), last.endpoint()
+            };
+
+            SpheroFleetConnectOptions options;
+            options.parallelism = 3;
+            options.startInterval = std::chrono::milliseconds(0);
+            options.connect = SpheroConnectOptions(0, std::chrono::milliseconds(10));
+
+            std::vector<std::size_t> reported;
+            std::vector<bool> connected(endpoints.size(), false);
+            boost::atomic<int> inHandler(0);
+            bool overlapped = false;
+            std::vector<SpheroConnectResult> results = SpheroFleet::connect(endpoints, options,
+                [&](SpheroConnectResult const& result) {
+                    if (inHandler.fetch_add(1) != 0) overlapped = true;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                    reported.push_back(result.index);
+                    connected[result.index] = result.connected();
+                    inHandler.fetch_sub(1);
+                });
+
+            // Results come back in address order, the failure in its place
+            Assert::AreEqual(endpoints.size(), results.size());
+            for (std::size_t i = 0; i < results.size(); ++i)
+                Assert::AreEqual(i, results[i].index);
+            Assert::IsTrue(results[0].connected());
+            Assert::IsFalse(results[1].connected());
+            Assert::IsFalse(results[1].error.empty());
+            Assert::IsTrue(results[2].connected());
+
+            // One callback per robot, never two at once
+            Assert::IsFalse(overlapped);
+            Assert::AreEqual(endpoints.size(), reported.size());
+            std::sort(reported.begin(), reported.end());
+            for (std::size_t i = 0; i < reported.size(); ++i)
+                Assert::AreEqual(i, reported[i]);
+            Assert::IsTrue(connected[0]);
+            Assert::IsFalse(connected[1]);
+            Assert::IsTrue(connected[2]);
+
+            SpheroFleet fleet(std::move(results));
+            Assert::AreEqual((std::size_t) 2, fleet.size());
+
+            first.stop();
+            last.stop();
+        }
+
+        TEST_METHOD(testConnectBoundsParallelism) {
+            // Each connect is refused twice, 100 ms apart
+            std::vector<BluetoothProto::endpoint> endpoints;
+            for (int i = 0; i < 6; ++i)
+                endpoints.push_back(deadEndpoint());
+
+            SpheroFleetConnectOptions options;
+            options.parallelism = 2;
+            options.startInterval = std::chrono::milliseconds(0);
+            options.connect = SpheroConnectOptions(1, std::chrono::milliseconds(100));
+
+            boost::atomic<int> failed(0);
+            auto start = Clock::now();
+            std::vector<SpheroConnectResult> results = SpheroFleet::connect(endpoints, options,
+                [&failed](SpheroConnectResult const& result) {
+                    if (!result.connected()) failed.fetch_add(1);
+                });
+            auto elapsed = since(start);
+
+            // Two at a time: three rounds, but not six
+            Assert::AreEqual(6, failed.load());
+            Assert::IsTrue(elapsed >= std::chrono::milliseconds(300));
+            Assert::IsTrue(elapsed < std::chrono::milliseconds(600));
+            for (auto const& result : results)
+                Assert::IsTrue(result.latency >= std::chrono::milliseconds(100));
+        }
+
+        TEST_METHOD(testConnectSpacesStarts) {
+            std::vector<BluetoothProto::endpoint> endpoints;
+            for (int i = 0; i < 4; ++i)
+                endpoints.push_back(deadEndpoint());
+
+            SpheroFleetConnectOptions options;
+            options.parallelism = 4;
+            options.startInterval = std::chrono::milliseconds(50);
+            options.connect = SpheroConnectOptions(0, std::chrono::milliseconds(10));
+
+            std::mutex mutex;
+            std::vector<Clock::time_point> finished;
+            auto start = Clock::now();
+            SpheroFleet::connect(endpoints, options,
+                [&](SpheroConnectResult const&) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished.push_back(Clock::now());
+                });
+
+            // Refusals are immediate, so each one lands an interval
+            // after the last even though all four could run at once
+            Assert::AreEqual((std::size_t) 4, finished.size());
+            Assert::IsTrue(finished.back() - start >= std::chrono::milliseconds(150));
+            for (std::size_t i = 1; i < finished.size(); ++i)
+                Assert::IsTrue(finished[i] - finished[i - 1] >= std::chrono::milliseconds(40));
+        }
+    };
+}
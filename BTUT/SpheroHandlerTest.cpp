@@ -0,0 +1,305 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+#include "TestPeer.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroHandlerTest) {
+        typedef std::vector<unsigned char> Bytes;
+
+        static Bytes join(std::initializer_list<Bytes> frames) {
+            Bytes ret;
+            for (auto const& frame : frames)
+                ret.insert(ret.end(), frame.begin(), frame.end());
+            return ret;
+        }
+
+    public:
+        TEST_METHOD(testResponsesSharingOneRead) {
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            peer.accept();
+
+            peer.write(join({ RawPeer::response(1), RawPeer::powerNotify(), RawPeer::response(2) }));
+
+            // Matched by SEQ even behind other frames of the same read
+            auto second = robot.readResponse(2, std::chrono::milliseconds(500));
+            Assert::IsTrue(second.get() != nullptr);
+            Assert::AreEqual((int) 2, (int) second->sequenceNum());
+            auto first = robot.readResponse(1, std::chrono::milliseconds(500));
+            Assert::IsTrue(first.get() != nullptr);
+            Assert::AreEqual((int) 1, (int) first->sequenceNum());
+
+            // What's left is the asynchronous message, on its own
+            auto async = robot.readResponse();
+            Assert::IsTrue(async.get() != nullptr);
+            Assert::AreEqual((std::size_t) 7, async->size());
+            Assert::AreEqual((std::size_t) 0, robot.getConnection().queued());
+        }
+
+        TEST_METHOD(testResponseSplitAcrossReads) {
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            peer.accept();
+
+            Bytes frame = RawPeer::response(7);
+            peer.write(Bytes(frame.begin(), frame.begin() + 3));
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            peer.write(Bytes(frame.begin() + 3, frame.end()));
+
+            auto response = robot.readResponse(7, std::chrono::milliseconds(500));
+            Assert::IsTrue(response.get() != nullptr);
+            Assert::AreEqual((int) 7, (int) response->sequenceNum());
+        }
+
+        TEST_METHOD(testAwaitedResponseIsNotQueued) {
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            peer.accept();
+
+            boost::atomic<int> answered(0);
+            robot.sendAsync(PingCommand(),
+                [&answered](boost::system::error_code const&, SpheroResponsePtr response) {
+                    if (response) answered.fetch_add(1);
+                });
+            // The first SEQ is 0; its answer shares a read with a notification
+            peer.write(join({ RawPeer::response(0), RawPeer::powerNotify() }));
+
+            Assert::IsTrue(waitFor([&]() { return answered.load() == 1; },
+                std::chrono::milliseconds(500)));
+            Assert::IsTrue(waitFor([&]() { return robot.getConnection().queued() == 1; },
+                std::chrono::milliseconds(500)));
+            Assert::AreEqual((int) 0xFE, (int) (*robot.readResponse())[1]);
+        }
+
+        TEST_METHOD(testCallbackFramesSkipTheQueue) {
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            peer.accept();
+
+            boost::atomic<int> samples(0);
+            robot.onAsync(ASYNC_SENSOR_DATA, [&samples](SpheroResponseView const&) {
+                samples.fetch_add(1);
+            });
+
+            // A read ending mid-frame, then one finishing it next to a response
+            Bytes first = RawPeer::sensorData(1);
+            Bytes second = RawPeer::sensorData(2);
+            peer.write(join({ first, Bytes(second.begin(), second.begin() + 4) }));
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            peer.write(join({ Bytes(second.begin() + 4, second.end()), RawPeer::response(3) }));
+
+            auto response = robot.readResponse(3, std::chrono::milliseconds(500));
+            Assert::IsTrue(response.get() != nullptr);
+            Assert::AreEqual((int) 2, samples.load());
+            Assert::AreEqual((std::size_t) 0, robot.getConnection().queued());
+        }
+
+        TEST_METHOD(testStreamingWithCallbackLeavesQueueEmpty) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.delay = std::chrono::microseconds(50000);     // nothing arrives before the callback
+            link.streamingHz = 200;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+
+            boost::atomic<int> samples(0);
+            robot.onAsync(ASYNC_SENSOR_DATA, [&samples](SpheroResponseView const&) {
+                samples.fetch_add(1);
+            });
+
+            // Commands answered alongside the stream
+            for (int i = 0; i < 20; ++i) {
+                Assert::IsTrue(robot.request(PingCommand()).get() != nullptr);
+                Assert::AreEqual((std::size_t) 0, robot.getConnection().queued());
+            }
+            Assert::IsTrue(samples.load() > 20);
+            Assert::AreEqual((std::size_t) 0, robot.getConnection().queued());
+            Assert::AreEqual((uint64_t) 0, robot.getConnection().readQueueDropped());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testUnreadFramesAreBounded) {
+            SpheroConnectOptions options(0, std::chrono::milliseconds(10));
+            options.readQueueLimit = 8;
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), options);
+            peer.accept();
+
+            Bytes burst;
+            for (int i = 0; i < 20; ++i)
+                burst = join({ burst, RawPeer::powerNotify() });
+            peer.write(burst);
+
+            Assert::IsTrue(waitFor([&]() { return robot.getConnection().readQueueDropped() == 12; },
+                std::chrono::milliseconds(500)));
+            Assert::AreEqual((std::size_t) 8, robot.getConnection().queued());
+        }
+
+        TEST_METHOD(testCoalescedCallsAreAborted) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.bytesPerSecond = 2000.0;
+            link.backpressure = true;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroConnectOptions options(0, std::chrono::milliseconds(10));
+            options.sendBufferSize = 64;
+            SpheroHandler robot(device.endpoint(), options);
+            robot.setCoalescing<SetRGBCommand>();
+            robot.setRetryPolicy<SetRGBCommand>(SpheroRetryPolicy(0, std::chrono::milliseconds(5000)));
+
+            boost::atomic<int> answered(0), aborted(0), failed(0);
+            auto handler = [&](boost::system::error_code const& ec, SpheroResponsePtr response) {
+                if (ec == boost::asio::error::operation_aborted) aborted.fetch_add(1);
+                else if (!ec && response) answered.fetch_add(1);
+                else failed.fetch_add(1);
+            };
+            for (int i = 0; i < 100; ++i)
+                robot.sendAsync(makeSetRGBCommand((unsigned char)i, 0, 0), handler);
+
+            // Replaced calls finish long before their timeout would
+            Assert::IsTrue(waitFor([&]() { return answered.load() + aborted.load() + failed.load() == 100; },
+                std::chrono::milliseconds(3000)));
+            Assert::AreEqual(0, failed.load());
+            Assert::IsTrue(aborted.load() > 0);
+            Assert::AreEqual((uint64_t) aborted.load(), robot.coalescedCommands());
+            Assert::AreEqual((uint64_t) answered.load(), device.commandsReceived());
+            Assert::AreEqual((uint64_t) 0, robot.retriesExhausted());
+            Assert::AreEqual((uint64_t) answered.load(),
+                robot.latency().histogram(SetRGBCommand::slot()).snapshot().count());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testDroppedResponseIsRetried) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.dropEvery = 2;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            robot.setRetryPolicy<PingCommand>(SpheroRetryPolicy(2, std::chrono::milliseconds(100)));
+
+            // Commands 2, 4 and 6 lose their answer; each is sent again
+            for (int i = 0; i < 4; ++i)
+                Assert::IsTrue(robot.request(PingCommand()).get() != nullptr);
+            Assert::AreEqual((uint64_t) 3, robot.retransmits<PingCommand>());
+            Assert::AreEqual((uint64_t) 0, robot.retriesExhausted());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testLateResponseIsSuppressed) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.lateEvery = 2;
+            link.lateBy = std::chrono::microseconds(150000);
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            robot.setRetryPolicy<PingCommand>(SpheroRetryPolicy(2, std::chrono::milliseconds(100)));
+
+            Assert::IsTrue(robot.request(PingCommand()).get() != nullptr);
+            // Held back past the timeout; the retransmit is answered right
+            // behind the original answer, which is then a duplicate
+            Assert::IsTrue(robot.request(PingCommand()).get() != nullptr);
+            Assert::AreEqual((uint64_t) 1, robot.retransmits<PingCommand>());
+            Assert::IsTrue(waitFor([&]() { return robot.duplicatesSuppressed() == 1; },
+                std::chrono::milliseconds(1000)));
+            Assert::AreEqual((std::size_t) 0, robot.getConnection().queued());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testOlderGetterIsStillRetried) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.dropEvery = 2;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            robot.setRetryPolicy<GetPowerStateCommand>(SpheroRetryPolicy(2, std::chrono::milliseconds(100)));
+            Assert::IsTrue(robot.request(PingCommand()).get() != nullptr);
+
+            // The first query loses its answer and its first retransmit
+            // while a newer query of the same type is answered
+            boost::atomic<int> answered(0), failed(0);
+            auto handler = [&](boost::system::error_code const& ec, SpheroResponsePtr response) {
+                if (!ec && response) answered.fetch_add(1);
+                else failed.fetch_add(1);
+            };
+            robot.sendAsync(GetPowerStateCommand(), handler);
+            robot.sendAsync(GetPowerStateCommand(), handler);
+
+            Assert::IsTrue(waitFor([&]() { return answered.load() + failed.load() == 2; },
+                std::chrono::milliseconds(1000)));
+            Assert::AreEqual(2, answered.load());
+            Assert::AreEqual((uint64_t) 2, robot.retransmits<GetPowerStateCommand>());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testOlderSetterIsNotRetried) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.dropEvery = 2;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            robot.setRetryPolicy<SetRGBCommand>(SpheroRetryPolicy(2, std::chrono::milliseconds(100)));
+            Assert::IsTrue(robot.request(PingCommand()).get() != nullptr);
+
+            // Sending the older color again would undo the newer one
+            boost::atomic<int> answered(0), timedOut(0);
+            auto handler = [&](boost::system::error_code const& ec, SpheroResponsePtr response) {
+                if (ec == boost::asio::error::timed_out) timedOut.fetch_add(1);
+                else if (response) answered.fetch_add(1);
+            };
+            robot.sendAsync(makeSetRGBCommand(0xFF, 0, 0), handler);
+            robot.sendAsync(makeSetRGBCommand(0, 0xFF, 0), handler);
+
+            Assert::IsTrue(waitFor([&]() { return answered.load() + timedOut.load() == 2; },
+                std::chrono::milliseconds(1000)));
+            Assert::AreEqual(1, answered.load());
+            Assert::AreEqual(1, timedOut.load());
+            Assert::AreEqual((uint64_t) 0, robot.retransmits<SetRGBCommand>());
+            Assert::AreEqual((uint64_t) 1, robot.retriesExhausted());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testStreamingLayoutFollowsAcknowledgedMasks) {
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            peer.accept();
+            Assert::AreEqual((unsigned) 0, robot.streamingLayout().fields());
+
+            // N, M, MASK (IMU yaw), PCNT, MASK2 (odometer, velocity X and Y)
+            SetDataStreamingCommand stream({ 0, 10, 0, 1, 0x00, 0x01, 0x00, 0x00, 0,
+                                             0x0D, 0x80, 0x00, 0x00 });
+            robot.sendCommand(stream);
+            Bytes sent = peer.readCommand();
+            Assert::AreEqual((unsigned) 0, robot.streamingLayout().fields());
+
+            peer.write(RawPeer::response(sent[4]));
+            Assert::IsTrue(waitFor([&]() { return robot.streamingLayout().fields() != 0; },
+                std::chrono::milliseconds(500)));
+            Assert::AreEqual((uint32_t) 0x00010000, robot.streamingLayout().mask1());
+            Assert::AreEqual((uint32_t) 0x0D800000, robot.streamingLayout().mask2());
+            Assert::AreEqual((unsigned) 5, robot.streamingLayout().fields());
+
+            // A refused change leaves the layout as it was
+            SetDataStreamingCommand off({ 0, 10, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0 });
+            robot.sendCommand(off);
+            sent = peer.readCommand();
+            peer.write(RawPeer::response(sent[4], ORBOTIX_RSP_CODE_EEXEC));
+            Assert::IsTrue(robot.readResponse(sent[4], std::chrono::milliseconds(500)).get() != nullptr);
+            Assert::AreEqual((uint32_t) 0x0D800000, robot.streamingLayout().mask2());
+        }
+    };
+}
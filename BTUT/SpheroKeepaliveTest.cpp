@@ -0,0 +1,41 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+#include "TestPeer.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroKeepaliveTest) {
+    public:
+        TEST_METHOD(testSilentLinkIsDeclaredDead) {
+            bench::LoopbackDevice device((bench::LoopbackDevice::LinkConfig()));
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+
+            SpheroKeepaliveOptions options;
+            options.interval = std::chrono::milliseconds(100);
+            options.timeout = std::chrono::milliseconds(100);
+            options.missedBeats = 2;
+            boost::atomic<int> dead(0);
+            SpheroKeepalive keepalive(robot, options, [&dead]() { dead.fetch_add(1); });
+
+            // An idle, answering link stays alive
+            std::this_thread::sleep_for(std::chrono::milliseconds(350));
+            Assert::IsTrue(keepalive.alive());
+            Assert::IsTrue(keepalive.pings() >= 2);
+            Assert::AreEqual((uint64_t) 0, keepalive.missed());
+
+            device.setSilent(true);
+            auto silentAt = std::chrono::steady_clock::now();
+            Assert::IsTrue(waitFor([&]() { return !keepalive.alive(); },
+                SpheroKeepalive::detectionTime(options) + std::chrono::milliseconds(100)));
+            Assert::IsTrue(std::chrono::steady_clock::now() - silentAt <=
+                SpheroKeepalive::detectionTime(options) + std::chrono::milliseconds(100));
+            Assert::AreEqual(1, dead.load());
+            Assert::AreEqual((uint64_t) 2, keepalive.missed());
+
+            device.stop();
+        }
+    };
+}
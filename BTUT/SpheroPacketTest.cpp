@@ -151,5 +151,75 @@ namespace BTUT {
             Assert::AreEqual((unsigned) expected_5, (unsigned) actual_5);
             Assert::AreEqual((unsigned) expected_6, (unsigned) actual_6);
         }
+
+        TEST_METHOD(testSharedFrameMatchesAssembledCommand) {
+            auto roll = makeRollCommand(0x80, 270);
+            auto frame = SpheroSharedFrame::encode(roll);
+
+            for (unsigned seq = 0; seq < 256; ++seq) {
+                auto expected = roll.generateCommandMessage<SpheroClientCommand>(
+                    (unsigned char) seq);
+                expected->assemble();
+
+                auto view = frame->view((unsigned char) seq);
+                view->assemble();
+
+                Assert::AreEqual(expected->size(), view->size());
+                Assert::IsTrue(std::equal(expected->begin(), expected->end(), view->begin()));
+                Assert::AreEqual(expected->length(), view->length());
+            }
+
+            // Views share the data segment instead of copying it
+            Assert::IsTrue(frame->view(1)->msgData() == frame->view(2)->msgData());
+        }
+
+        TEST_METHOD(testRollBatchMatchesAssembledCommands) {
+            const std::size_t count = 37; // two SIMD blocks plus a tail
+            unsigned char speeds[count], seqs[count], states[count];
+            unsigned short headings[count];
+            for (std::size_t i = 0; i < count; ++i) {
+                speeds[i] = (unsigned char) (i * 7);
+                headings[i] = (unsigned short) ((i * 97) % 360);
+                seqs[i] = (unsigned char) (250 + i);
+                states[i] = (unsigned char) (i % 2);
+            }
+
+            SpheroRollBatch batch;
+            batch.encode(speeds, headings, seqs, count, states);
+            Assert::AreEqual(count, batch.size());
+
+            for (std::size_t i = 0; i < count; ++i) {
+                auto expected = makeRollCommand(speeds[i], headings[i], states[i])
+                    .generateCommandMessage<SpheroClientCommand>(seqs[i]);
+                expected->assemble();
+
+                auto frame = batch.frame(i);
+                Assert::AreEqual((std::size_t) expected->size(), (std::size_t) frame->length());
+                Assert::IsTrue(std::equal(expected->begin(), expected->end(), frame->frameData()));
+            }
+        }
+
+        TEST_METHOD(testResponseViewMatchesParsedResponse) {
+            // Power state: RecVer, state, voltage, charges, time since charge
+            unsigned char frame[] = { 0xFF, 0xFF, 0x00, 0x07, 0x09,
+                                      0x01, 0x02, 0x02, 0xD3, 0x00, 0x05, 0x01, 0x2C, 0x00 };
+            SpheroResponseView view(frame, sizeof(frame));
+            auto response = view.copy();
+
+            Assert::IsFalse(view.isAsync());
+            Assert::AreEqual(response->messageResponse(), view.messageResponse());
+            Assert::AreEqual(response->sequenceNum(), view.sequenceNum());
+            // DLEN counts the checksum, the view doesn't
+            Assert::AreEqual((std::size_t) response->dataLength() - 1, view.dataLength());
+            Assert::AreEqual(response->dataToNumerical<unsigned short>(2), view.word(2));
+            Assert::AreEqual((unsigned short) 0x012C, view.word(6));
+            Assert::AreEqual((unsigned short) 0, view.word(7));
+
+            unsigned char async[] = { 0xFF, 0xFE, ASYNC_POWER_NOTIFY, 0x00, 0x02, 0x03, 0x00 };
+            SpheroResponseView notification(async, sizeof(async));
+            Assert::IsTrue(notification.isAsync());
+            Assert::AreEqual((unsigned char) ASYNC_POWER_NOTIFY, notification.idCode());
+            Assert::AreEqual((std::size_t) 1, notification.dataLength());
+        }
     };
 }
@@ -0,0 +1,117 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroPoseTest) {
+        typedef std::chrono::steady_clock Clock;
+
+        static void put(unsigned char * at, short value) {
+            at[0] = (unsigned char)((unsigned short)value >> 8);
+            at[1] = (unsigned char)value;
+        }
+
+    public:
+        TEST_METHOD(testOdometerIsPosition) {
+            SpheroPose pose;
+            pose.setStreamingMask(SpheroPose::STREAM_IMU_YAW,
+                SpheroStateCache::STREAM_ODOMETER_X | SpheroStateCache::STREAM_ODOMETER_Y |
+                SpheroStateCache::STREAM_VELOCITY_X | SpheroStateCache::STREAM_VELOCITY_Y);
+            Assert::IsFalse(pose.pose().valid());
+
+            // Yaw, odometer X, Y, velocity X, Y
+            unsigned char sample[10];
+            put(sample, -90);
+            put(sample + 2, 120);
+            put(sample + 4, -35);
+            put(sample + 6, 250);
+            put(sample + 8, 0);
+            auto now = Clock::now();
+            pose.feed(sample, sizeof(sample), now);
+
+            SpheroPoseEstimate estimate = pose.pose();
+            Assert::IsTrue(estimate.valid());
+            Assert::AreEqual(120.0, estimate.x);
+            Assert::AreEqual(-35.0, estimate.y);
+            Assert::AreEqual(25.0, estimate.vx);       // from mm/s
+            Assert::AreEqual(270.0, estimate.heading);
+            Assert::IsTrue(estimate.at == now);
+
+            SpheroPoseEstimate later = estimate.extrapolate(now + std::chrono::seconds(2));
+            Assert::AreEqual(170.0, later.x, 1e-9);
+            Assert::AreEqual(-35.0, later.y, 1e-9);
+        }
+
+        TEST_METHOD(testIntegratesVelocityWithoutOdometer) {
+            SpheroPose pose;
+            pose.setStreamingMask(0,
+                SpheroStateCache::STREAM_VELOCITY_X | SpheroStateCache::STREAM_VELOCITY_Y);
+
+            // 50 cm/s along +Y for one second, in packets of two samples
+            unsigned char packet[8];
+            put(packet, 0);
+            put(packet + 2, 500);
+            put(packet + 4, 0);
+            put(packet + 6, 500);
+            auto start = Clock::now();
+            for (int i = 0; i <= 10; ++i)
+                pose.feed(packet, sizeof(packet), start + std::chrono::milliseconds(100 * i));
+
+            SpheroPoseEstimate estimate = pose.pose();
+            Assert::AreEqual((uint64_t) 22, estimate.samples);
+            Assert::AreEqual(0.0, estimate.x, 1e-6);
+            Assert::AreEqual(50.0, estimate.y, 1e-6);
+            Assert::AreEqual(0.0, estimate.heading, 1e-6);   // direction of travel
+        }
+
+        TEST_METHOD(testLocatorResponseResetsPosition) {
+            SpheroPose pose;
+            unsigned char locator[SpheroStateCache::LOCATOR_DATA_SIZE] = {};
+            put(locator, 10);
+            put(locator + 2, 20);
+            put(locator + 4, -3);
+            pose.feedLocator(locator, sizeof(locator), Clock::now());
+
+            SpheroPoseEstimate estimate = pose.pose();
+            Assert::AreEqual(10.0, estimate.x);
+            Assert::AreEqual(20.0, estimate.y);
+            Assert::AreEqual(-3.0, estimate.vx);
+
+            pose.feedLocator(locator, 4, Clock::now());
+            Assert::AreEqual((uint64_t) 1, pose.unparsed());
+            Assert::AreEqual((uint64_t) 1, pose.pose().samples);
+        }
+
+        TEST_METHOD(testReadersNeverSeeTornPose) {
+            SpheroPose pose;
+            pose.setStreamingMask(0, SpheroStateCache::STREAM_ODOMETER_X | SpheroStateCache::STREAM_ODOMETER_Y);
+
+            boost::atomic<bool> done(false);
+            boost::atomic<uint64_t> torn(0);
+            std::vector<std::thread> readers;
+            for (int r = 0; r < 2; ++r) {
+                readers.push_back(std::thread([&]() {
+                    while (!done.load()) {
+                        SpheroPoseEstimate estimate = pose.pose();
+                        if (estimate.x != estimate.y) torn.fetch_add(1);
+                    }
+                }));
+            }
+
+            auto start = Clock::now();
+            unsigned char sample[4];
+            for (int i = 0; i < 200000; ++i) {
+                put(sample, (short)i);
+                put(sample + 2, (short)i);
+                pose.feed(sample, sizeof(sample), start + std::chrono::microseconds(i));
+            }
+            done.store(true);
+            for (auto & reader : readers)
+                reader.join();
+
+            Assert::AreEqual((uint64_t) 0, torn.load());
+            Assert::AreEqual((uint64_t) 200000, pose.pose().samples);
+        }
+    };
+}
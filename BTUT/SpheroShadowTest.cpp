@@ -0,0 +1,77 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroShadowTest) {
+        typedef std::vector<unsigned char> Data;
+
+    public:
+        TEST_METHOD(testColorDeadband) {
+            SpheroShadowOptions options;
+            unsigned slot = SetRGBCommand::slot();
+
+            Assert::IsTrue(SpheroShadow::redundant(slot, Data({ 10, 20, 30, 0 }),
+                Data({ 10, 20, 30, 0 }), options));
+            Assert::IsFalse(SpheroShadow::redundant(slot, Data({ 10, 20, 30, 0 }),
+                Data({ 11, 20, 30, 0 }), options));
+
+            options.colorDeadband = 2;
+            Assert::IsTrue(SpheroShadow::redundant(slot, Data({ 10, 20, 30, 0 }),
+                Data({ 12, 18, 30, 0 }), options));
+            Assert::IsFalse(SpheroShadow::redundant(slot, Data({ 10, 20, 30, 0 }),
+                Data({ 13, 20, 30, 0 }), options));
+
+            // Persisting the color is a change of its own
+            Assert::IsFalse(SpheroShadow::redundant(slot, Data({ 10, 20, 30, 0 }),
+                Data({ 10, 20, 30, 1 }), options));
+        }
+
+        TEST_METHOD(testRollDeadbandWrapsHeading) {
+            SpheroShadowOptions options;
+            options.speedDeadband = 5;
+            options.headingDeadband = 3;
+            unsigned slot = RollCommand::slot();
+
+            auto roll = [](unsigned char speed, unsigned short heading, unsigned char state) {
+                return makeRollCommand(speed, heading, state).data();
+            };
+
+            Assert::IsTrue(SpheroShadow::redundant(slot, roll(100, 359, 1), roll(104, 1, 1), options));
+            Assert::IsFalse(SpheroShadow::redundant(slot, roll(100, 359, 1), roll(100, 3, 1), options));
+            Assert::IsFalse(SpheroShadow::redundant(slot, roll(100, 10, 1), roll(106, 10, 1), options));
+            Assert::IsFalse(SpheroShadow::redundant(slot, roll(100, 10, 1), roll(100, 10, 0), options));
+
+            // Deadbands only apply to colors, speeds and headings
+            Assert::IsFalse(SpheroShadow::redundant(SetStabilizeCommand::slot(),
+                Data({ 1 }), Data({ 0 }), options));
+        }
+
+        TEST_METHOD(testCoalescedSettingIsNotInFlight) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.bytesPerSecond = 2000.0;
+            link.backpressure = true;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroConnectOptions connectOptions(0, std::chrono::milliseconds(10));
+            connectOptions.sendBufferSize = 64;
+            SpheroHandler robot(device.endpoint(), connectOptions);
+            robot.setCoalescing<SetRGBCommand>();
+            SpheroShadow shadow(robot);
+
+            int last = SpheroShadow::ELIDED;
+            for (int i = 0; i < 100; ++i)
+                last = shadow.send(makeSetRGBCommand((unsigned char)i, 0, 0));
+            Assert::IsTrue(robot.readResponse((unsigned char)last, std::chrono::milliseconds(3000)).get() != nullptr);
+            Assert::IsTrue(robot.coalescedCommands() > 0);
+
+            // Nothing replaced is left waiting for an answer
+            Assert::AreEqual((int) SpheroShadow::ELIDED, shadow.send(makeSetRGBCommand(99, 0, 0)));
+
+            robot.getConnection().close();
+            device.stop();
+        }
+    };
+}
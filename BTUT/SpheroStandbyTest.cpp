@@ -0,0 +1,51 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroStandbyTest) {
+        static std::vector<SpheroSharedFramePtr> settings() {
+            return {
+                SpheroSharedFrame::encode(SetStabilizeCommand({ 1 })),
+                SpheroSharedFrame::encode(makeSetRGBCommand(0x10, 0x20, 0x30)),
+                SpheroSharedFrame::encode(makeRollCommand(0, 90, 0)),
+            };
+        }
+
+    public:
+        TEST_METHOD(testApplyCountsAcknowledged) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.failEvery = 2;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+
+            // The second setting is rejected
+            Assert::AreEqual((std::size_t) 2,
+                SpheroStandbyPool::apply(robot, settings(), std::chrono::milliseconds(500)));
+            Assert::AreEqual((std::size_t) 0, robot.getConnection().queued());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testApplyGivesUpAtTimeout) {
+            bench::LoopbackDevice device((bench::LoopbackDevice::LinkConfig()));
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            device.setSilent(true);
+
+            auto start = std::chrono::steady_clock::now();
+            Assert::AreEqual((std::size_t) 0,
+                SpheroStandbyPool::apply(robot, settings(), std::chrono::milliseconds(200)));
+            Assert::IsTrue(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(400));
+            // Not retried, even though these commands' policies would
+            Assert::AreEqual((uint64_t) 3, device.commandsReceived());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+    };
+}
@@ -0,0 +1,100 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroStateCacheTest) {
+        const uint32_t locatorFields =
+            SpheroStateCache::STREAM_ODOMETER_X | SpheroStateCache::STREAM_ODOMETER_Y |
+            SpheroStateCache::STREAM_VELOCITY_X | SpheroStateCache::STREAM_VELOCITY_Y;
+
+    public:
+        TEST_METHOD(testLocatorFromLastStreamedSample) {
+            // MASK1: two fields; MASK2: quaternion Q0 ahead of the locator fields
+            uint32_t mask1 = 0x00C00000;
+            uint32_t mask2 = 0x80000000 | locatorFields;
+
+            // Two samples of 7 fields each; the second one counts
+            std::vector<unsigned char> data = {
+                0, 1, 0, 2, 0, 3, 0, 4, 0, 5, 0, 6, 0, 7,
+                0, 1, 0, 2, 0, 3, 0x01, 0x2C, 0xFF, 0x9C, 0x00, 0x1E, 0xFF, 0xD8,
+            };
+            unsigned char locator[SpheroStateCache::LOCATOR_DATA_SIZE];
+            Assert::IsTrue(SpheroStateCache::locatorFromStream(
+                mask1, mask2, data.data(), data.size(), locator));
+
+            std::vector<unsigned char> expected = {
+                0x01, 0x2C,     // X = 300cm
+                0xFF, 0x9C,     // Y = -100cm
+                0x00, 0x03,     // VX = 30mm/s streamed, 3cm/s
+                0xFF, 0xFC,     // VY = -40mm/s streamed, -4cm/s
+                0x00, 0x05,     // SOG = 5cm/s
+            };
+            Assert::IsTrue(expected == std::vector<unsigned char>(locator, locator + sizeof(locator)));
+        }
+
+        TEST_METHOD(testLocatorNeedsAllFields) {
+            std::vector<unsigned char> data(16, 0);
+            unsigned char locator[SpheroStateCache::LOCATOR_DATA_SIZE];
+
+            Assert::IsFalse(SpheroStateCache::locatorFromStream(
+                0, locatorFields & ~SpheroStateCache::STREAM_VELOCITY_Y,
+                data.data(), data.size(), locator));
+
+            // Shorter than a single sample
+            Assert::IsFalse(SpheroStateCache::locatorFromStream(
+                0xFF000000, locatorFields, data.data(), data.size(), locator));
+        }
+
+        TEST_METHOD(testFreshEntryIsServedFromCache) {
+            bench::LoopbackDevice device((bench::LoopbackDevice::LinkConfig()));
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            SpheroStateCache cache(robot);
+            cache.setTtl<GetPowerStateCommand>(std::chrono::milliseconds(200));
+
+            auto first = cache.get<GetPowerStateCommand>();
+            Assert::IsTrue(first.get() != nullptr);
+            Assert::IsTrue(cache.get<GetPowerStateCommand>() == first);
+            Assert::AreEqual((uint64_t) 1, cache.hits());
+            Assert::AreEqual((uint64_t) 1, cache.fetches());
+            Assert::AreEqual((uint64_t) 1, device.commandsReceived());
+
+            // Stale once the TTL is up
+            std::this_thread::sleep_for(std::chrono::milliseconds(250));
+            Assert::IsTrue(cache.get<GetPowerStateCommand>().get() != nullptr);
+            Assert::AreEqual((uint64_t) 2, cache.fetches());
+            Assert::AreEqual((uint64_t) 2, device.commandsReceived());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testConcurrentGetsShareOneFetch) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.delay = std::chrono::microseconds(100000);
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            SpheroStateCache cache(robot);
+
+            SpheroResponsePtr first;
+            std::thread fetcher([&]() { first = cache.get<GetPowerStateCommand>(); });
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            // Mid round trip: waits for the fetch already under way
+            auto second = cache.get<GetPowerStateCommand>();
+            fetcher.join();
+
+            Assert::IsTrue(second.get() != nullptr);
+            Assert::IsTrue(first == second);
+            Assert::AreEqual((uint64_t) 1, cache.fetches());
+            Assert::AreEqual((uint64_t) 1, cache.joined());
+            Assert::AreEqual((uint64_t) 1, device.commandsReceived());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+    };
+}
@@ -0,0 +1,119 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+#define TEST_LOG_PATH "btut-telemetry.tlog"
+
+namespace BTUT {
+    TEST_CLASS(SpheroTelemetryLogTest) {
+        typedef std::chrono::steady_clock Clock;
+
+        // Odometer X and Y
+        const uint32_t mask2 = SpheroStateCache::STREAM_ODOMETER_X | SpheroStateCache::STREAM_ODOMETER_Y;
+
+        void feedRows(SpheroTelemetryLog & log, unsigned source, short from, short to) {
+            for (short v = from; v <= to; ++v) {
+                unsigned char data[] = {
+                    (unsigned char)((unsigned short)v >> 8), (unsigned char)v,
+                    0xFF, (unsigned char)(0x100 - v)    // -v
+                };
+                log.feed(source, data, sizeof(data), Clock::now());
+            }
+        }
+
+    public:
+        SpheroTelemetryLogTest() {
+            remove(TEST_LOG_PATH);
+        }
+        ~SpheroTelemetryLogTest() {
+            remove(TEST_LOG_PATH);
+        }
+
+        TEST_METHOD(testColumnsReadBack) {
+            SpheroTelemetryLogOptions options;
+            options.segmentBytes = 64 * 1024;
+            options.blockRows = 100;
+            {
+                SpheroTelemetryLog log(TEST_LOG_PATH, options);
+                unsigned a = log.addSource(0, mask2);
+                unsigned b = log.addSource(0, mask2);
+                feedRows(log, a, 1, 10);
+                feedRows(log, b, 1, 120);   // spills into a second block
+            }
+
+            SpheroTelemetryLogReader reader(TEST_LOG_PATH);
+            Assert::AreEqual((uint64_t) 130, reader.rows());
+            Assert::AreEqual((std::size_t) 3, reader.blocks().size());
+
+            auto const& block = reader.blocks()[0];
+            Assert::AreEqual((uint32_t) 0, block.source);
+            Assert::AreEqual((uint32_t) 2, block.columns);
+            Assert::AreEqual((uint64_t) 10, block.rows);
+            for (uint64_t i = 0; i < block.rows; ++i) {
+                Assert::AreEqual((int) i + 1, (int) block.column(0)[i]);
+                Assert::AreEqual(-((int) i + 1), (int) block.column(1)[i]);
+                if (i > 0) Assert::IsTrue(block.micros[i] >= block.micros[i - 1]);
+            }
+
+            Assert::AreEqual((uint64_t) 20, reader.blocks()[2].rows);
+            Assert::AreEqual((int) 101, (int) reader.blocks()[2].column(0)[0]);
+        }
+
+        TEST_METHOD(testOnlyCommittedRowsVisible) {
+            SpheroTelemetryLogOptions options;
+            options.segmentBytes = 64 * 1024;
+            options.commitInterval = std::chrono::milliseconds(60000);
+
+            SpheroTelemetryLog log(TEST_LOG_PATH, options);
+            unsigned source = log.addSource(0, mask2);
+            feedRows(log, source, 1, 5);
+            log.commit();
+            feedRows(log, source, 6, 8);
+
+            {
+                SpheroTelemetryLogReader reader(TEST_LOG_PATH);
+                Assert::AreEqual((uint64_t) 5, reader.rows());
+            }
+
+            log.close();
+            SpheroTelemetryLogReader reader(TEST_LOG_PATH);
+            Assert::AreEqual((uint64_t) 8, reader.rows());
+        }
+
+        TEST_METHOD(testCompressedBlocksReadBack) {
+            SpheroTelemetryLogOptions options;
+            options.segmentBytes = 64 * 1024;
+            options.blockRows = 100;
+            options.commitInterval = std::chrono::milliseconds(60000);
+            options.compress = true;
+
+            SpheroTelemetryLog log(TEST_LOG_PATH, options);
+            unsigned source = log.addSource(0, mask2);
+            feedRows(log, source, 1, 120);
+            log.commit();
+            feedRows(log, source, 121, 125);
+            log.close();
+
+            // A full block, what was staged at the commit, then at close
+            SpheroTelemetryLogReader reader(TEST_LOG_PATH);
+            Assert::AreEqual((uint64_t) 125, reader.rows());
+            Assert::AreEqual((std::size_t) 3, reader.blocks().size());
+            Assert::IsTrue(log.bytesWritten() < 125 * (8 + 2 * 2));
+
+            std::vector<uint64_t> micros;
+            std::vector<short> data;
+            short expected = 1;
+            for (auto const& block : reader.blocks()) {
+                Assert::IsTrue(block.compressed);
+                Assert::IsTrue(SpheroTelemetryLogReader::decode(block, micros, data));
+                for (uint64_t i = 0; i < block.rows; ++i, ++expected) {
+                    Assert::AreEqual((int) expected, (int) data[i]);
+                    Assert::AreEqual(-(int) expected, (int) data[block.rows + i]);
+                    if (i > 0) Assert::IsTrue(micros[i] >= micros[i - 1]);
+                }
+            }
+            Assert::AreEqual((int) 126, (int) expected);
+        }
+    };
+}
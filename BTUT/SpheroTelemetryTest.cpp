@@ -0,0 +1,108 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "TestPeer.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroTelemetryTest) {
+        typedef std::chrono::steady_clock Clock;
+
+        // Streaming layout: quaternion Q0 ahead of velocity X
+        const uint32_t q0 = 0x80000000;
+        const uint32_t vx = SpheroStateCache::STREAM_VELOCITY_X;
+
+        void feedValues(SpheroTelemetry & telemetry, short from, short to) {
+            auto at = Clock::now();
+            for (short v = from; v <= to; ++v) {
+                unsigned char data[] = { 0x7F, 0x00,
+                    (unsigned char)((unsigned short)v >> 8), (unsigned char)v };
+                at += std::chrono::milliseconds(10);
+                telemetry.feed(data, sizeof(data), at);
+            }
+        }
+
+    public:
+        TEST_METHOD(testRawRingKeepsLatestSamples) {
+            SpheroTelemetryOptions options;
+            options.mask2 = vx;
+            options.rawSamples = 4;
+            options.tiers = 0;
+            SpheroTelemetry telemetry(options);
+            unsigned channel = SpheroTelemetry::channel(0, vx);
+
+            // Without the layout there is nothing to record
+            feedValues(telemetry, 1, 1);
+            Assert::AreEqual((uint64_t) 1, telemetry.unparsed());
+
+            telemetry.setStreamingMask(0, q0 | vx);
+            feedValues(telemetry, -1, 4);
+            auto samples = telemetry.raw(channel);
+            Assert::AreEqual((std::size_t) 4, samples.size());
+            for (std::size_t i = 0; i < samples.size(); ++i)
+                Assert::AreEqual((int) i + 1, (int) samples[i].value);
+            Assert::IsTrue(samples[0].at < samples[3].at);
+
+            // Q0 is streamed but not recorded
+            Assert::IsFalse(telemetry.recorded(SpheroTelemetry::channel(0, q0)));
+            Assert::AreEqual((std::size_t) 0, telemetry.raw(SpheroTelemetry::channel(0, q0)).size());
+        }
+
+        TEST_METHOD(testTiersCascade) {
+            SpheroTelemetryOptions options;
+            options.mask2 = vx;
+            options.rawSamples = 4;
+            options.tiers = 2;
+            options.bucketsPerTier = 8;
+            options.decimation = 2;
+            SpheroTelemetry telemetry(options);
+            telemetry.setStreamingMask(0, q0 | vx);
+            unsigned channel = SpheroTelemetry::channel(0, vx);
+
+            feedValues(telemetry, 1, 9);    // 9 is still in a partial bucket
+
+            auto tier1 = telemetry.tier(channel, 1);
+            Assert::AreEqual((std::size_t) 4, tier1.size());
+            Assert::AreEqual((int) 7, (int) tier1[3].min);
+            Assert::AreEqual((int) 8, (int) tier1[3].max);
+            Assert::AreEqual(7.5, (double) tier1[3].mean, 1e-6);
+
+            auto tier2 = telemetry.tier(channel, 2);
+            Assert::AreEqual((std::size_t) 2, tier2.size());
+            Assert::AreEqual((int) 1, (int) tier2[0].min);
+            Assert::AreEqual((int) 4, (int) tier2[0].max);
+            Assert::AreEqual(2.5, (double) tier2[0].mean, 1e-6);
+            Assert::IsTrue(tier2[1].start == tier1[2].start);
+
+            Assert::AreEqual((std::size_t) 0, telemetry.tier(channel, 3).size());
+            Assert::AreEqual(SpheroTelemetry::bytesPerChannel(options), telemetry.memoryBytes());
+        }
+
+        TEST_METHOD(testRobotStreamingLayoutIsUsed) {
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            peer.accept();
+
+            SpheroTelemetryOptions options;
+            options.mask2 = vx;
+            options.tiers = 0;
+            SpheroTelemetry telemetry(robot, options);
+            unsigned channel = SpheroTelemetry::channel(0, vx);
+
+            // Nothing to parse with until the robot takes a layout
+            peer.write(RawPeer::sensorData(1));
+            Assert::IsTrue(waitFor([&]() { return telemetry.unparsed() == 1; },
+                std::chrono::milliseconds(500)));
+
+            SetDataStreamingCommand stream({ 0, 10, 0, 1, 0, 0, 0, 0, 0,
+                (unsigned char)(vx >> 24), 0, 0, 0 });
+            robot.sendCommand(stream);
+            peer.write(RawPeer::response(peer.readCommand()[4]));
+            peer.write(RawPeer::sensorData(7));
+
+            Assert::IsTrue(waitFor([&]() { return telemetry.raw(channel).size() == 1; },
+                std::chrono::milliseconds(500)));
+            Assert::AreEqual((short) 0x0707, telemetry.raw(channel)[0].value);
+        }
+    };
+}
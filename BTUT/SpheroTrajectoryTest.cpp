@@ -0,0 +1,124 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+#include "TestPeer.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroTrajectoryTest) {
+        typedef std::chrono::milliseconds ms;
+
+        struct Completion {
+            boost::atomic<int> calls;
+            boost::atomic<bool> completed;
+
+            Completion() : calls(0), completed(false) {
+            }
+            SpheroTrajectoryExecutor::CompletionHandler handler() {
+                return [this](bool done) {
+                    completed.store(done);
+                    calls.fetch_add(1);
+                };
+            }
+        };
+
+    public:
+        TEST_METHOD(testStepsAreSentInTimeOrder) {
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, ms(10)));
+            peer.accept();
+
+            // Added out of order; steps due at the same time keep theirs
+            SpheroTrajectory trajectory;
+            trajectory
+                .at(ms(30), makeSetRGBCommand(3, 0, 0))
+                .at(ms(10), makeSetRGBCommand(1, 0, 0))
+                .at(ms(30), makeSetRGBCommand(4, 0, 0))
+                .at(ms(20), makeSetRGBCommand(2, 0, 0));
+
+            SpheroTrajectoryExecutor executor(robot);
+            Completion completion;
+            executor.start(trajectory, completion.handler());
+            Assert::IsTrue(executor.isRunning());
+
+            for (unsigned char red = 1; red <= 4; ++red) {
+                std::vector<unsigned char> frame = peer.readCommand();
+                Assert::AreEqual((int) SetRGBCommand::slot(),
+                    (int) spheroCommandSlot(frame[2], frame[3]));
+                Assert::AreEqual((int) red, (int) frame[6]);
+            }
+
+            Assert::IsTrue(waitFor([&]() { return completion.calls.load() > 0; }, ms(500)));
+            Assert::AreEqual(1, completion.calls.load());
+            Assert::IsTrue(completion.completed.load());
+            Assert::IsFalse(executor.isRunning());
+            Assert::AreEqual((uint64_t) 4, executor.stepsSent());
+            Assert::AreEqual((uint64_t) 0, executor.stepsDropped());
+        }
+
+        TEST_METHOD(testLateStepsAreDropped) {
+            bench::LoopbackDevice device((bench::LoopbackDevice::LinkConfig()));
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, ms(10)));
+
+            SpheroTrajectory trajectory;
+            trajectory
+                .at(ms(0), makeRollCommand(10, 0, 1))
+                .at(ms(10), makeRollCommand(20, 0, 1))
+                .at(ms(20), makeRollCommand(30, 0, 1))
+                .at(ms(30), makeRollCommand(40, 0, 1))
+                .at(ms(250), makeRollCommand(0, 0, 0));
+
+            SpheroTrajectoryExecutor::Options options;
+            options.dropLaterThan = ms(20);
+            SpheroTrajectoryExecutor executor(robot, options);
+            Completion completion;
+
+            // Hold up the io thread so the first four are all overdue at once
+            robot.getConnection().ioService().post([]() {
+                std::this_thread::sleep_for(ms(100));
+            });
+            executor.start(trajectory, completion.handler());
+
+            Assert::IsTrue(waitFor([&]() { return completion.calls.load() > 0; }, ms(1000)));
+            Assert::IsTrue(completion.completed.load());
+
+            // The newest overdue step still goes out, the older ones don't
+            Assert::AreEqual((uint64_t) 2, executor.stepsSent());
+            Assert::AreEqual((uint64_t) 3, executor.stepsDropped());
+            Assert::IsTrue(waitFor([&]() { return device.commandsReceived() == 2; }, ms(500)));
+
+            device.stop();
+        }
+
+        TEST_METHOD(testCancelStopsTheRun) {
+            bench::LoopbackDevice device((bench::LoopbackDevice::LinkConfig()));
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, ms(10)));
+
+            SpheroTrajectory trajectory;
+            trajectory
+                .at(ms(0), makeRollCommand(50, 90, 1))
+                .at(ms(300), makeRollCommand(0, 90, 0));
+
+            SpheroTrajectoryExecutor executor(robot);
+            Completion completion;
+            executor.start(trajectory, completion.handler());
+            Assert::IsTrue(waitFor([&]() { return executor.stepsSent() == 1; }, ms(500)));
+
+            executor.cancel();
+            Assert::IsFalse(executor.isRunning());
+            Assert::IsTrue(waitFor([&]() { return completion.calls.load() > 0; }, ms(500)));
+            Assert::IsFalse(completion.completed.load());
+
+            // The second step never goes out, and nothing completes twice
+            std::this_thread::sleep_for(ms(400));
+            Assert::AreEqual((uint64_t) 1, executor.stepsSent());
+            Assert::AreEqual(1, completion.calls.load());
+            Assert::AreEqual((uint64_t) 1, device.commandsReceived());
+
+            device.stop();
+        }
+    };
+}
@@ -0,0 +1,137 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+#include "TestPeer.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+#define TEST_CACHE_PATH "btut-uploads.cache"
+
+namespace BTUT {
+    TEST_CLASS(SpheroUploadCacheTest) {
+        std::vector<unsigned char> program;
+
+    public:
+        SpheroUploadCacheTest() : program(600, 0x42) {
+            remove(TEST_CACHE_PATH);
+        }
+        ~SpheroUploadCacheTest() {
+            remove(TEST_CACHE_PATH);
+        }
+
+        TEST_METHOD(testUnchangedProgramIsCurrent) {
+            SpheroUploadCache cache(TEST_CACHE_PATH);
+            Assert::IsFalse(cache.isCurrent(1, SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                program.data(), program.size()));
+
+            cache.stored(1, SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                program.data(), program.size());
+            Assert::IsTrue(cache.isCurrent(1, SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                program.data(), program.size()));
+
+            // Another robot, another target or another program all miss
+            Assert::IsFalse(cache.isCurrent(2, SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                program.data(), program.size()));
+            Assert::IsFalse(cache.isCurrent(1, SpheroUploadCache::TARGET_TEMP_MACRO,
+                program.data(), program.size()));
+            program[300] ^= 1;
+            Assert::IsFalse(cache.isCurrent(1, SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                program.data(), program.size()));
+        }
+
+        TEST_METHOD(testResetForgetsOnlyRam) {
+            SpheroUploadCache cache(TEST_CACHE_PATH);
+            cache.stored(1, SpheroUploadCache::TARGET_TEMP_MACRO, program.data(), program.size());
+            cache.stored(1, SpheroUploadCache::TARGET_ORBBASIC_FLASH, program.data(), program.size());
+
+            cache.deviceReset(1);
+
+            Assert::IsFalse(cache.isCurrent(1, SpheroUploadCache::TARGET_TEMP_MACRO,
+                program.data(), program.size()));
+            Assert::IsTrue(cache.isCurrent(1, SpheroUploadCache::TARGET_ORBBASIC_FLASH,
+                program.data(), program.size()));
+        }
+
+        TEST_METHOD(testRamEntriesExpireWithInactivity) {
+            // A negative lifetime makes every RAM entry already expired
+            SpheroUploadCache cache(TEST_CACHE_PATH, std::chrono::seconds(-1));
+            cache.stored(1, SpheroUploadCache::TARGET_ORBBASIC_RAM, program.data(), program.size());
+            cache.stored(1, SpheroUploadCache::TARGET_ORBBASIC_FLASH, program.data(), program.size());
+
+            Assert::IsFalse(cache.isCurrent(1, SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                program.data(), program.size()));
+            Assert::IsTrue(cache.isCurrent(1, SpheroUploadCache::TARGET_ORBBASIC_FLASH,
+                program.data(), program.size()));
+        }
+
+        TEST_METHOD(testSaveAndLoad) {
+            SpheroUploadCache cache(TEST_CACHE_PATH);
+            cache.stored(0x000666123456ULL, SpheroUploadCache::TARGET_ORBBASIC_FLASH,
+                program.data(), program.size());
+            Assert::IsTrue(cache.save());
+
+            SpheroUploadCache reloaded(TEST_CACHE_PATH);
+            Assert::IsTrue(reloaded.load());
+            Assert::IsTrue(reloaded.isCurrent(0x000666123456ULL,
+                SpheroUploadCache::TARGET_ORBBASIC_FLASH, program.data(), program.size()));
+        }
+
+        TEST_METHOD(testWatchForgetsRamProgramsOnSleep) {
+            SpheroUploadCache cache(TEST_CACHE_PATH);
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            peer.accept();
+            SpheroUploadWatch watch(cache, robot);
+
+            cache.stored(watch.device(), SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                program.data(), program.size());
+            cache.stored(watch.device(), SpheroUploadCache::TARGET_ORBBASIC_FLASH,
+                program.data(), program.size());
+            peer.write(RawPeer::preSleep());
+
+            Assert::IsTrue(waitFor([&]() {
+                return !cache.isCurrent(watch.device(), SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                    program.data(), program.size());
+            }, std::chrono::milliseconds(500)));
+            Assert::IsTrue(cache.isCurrent(watch.device(), SpheroUploadCache::TARGET_ORBBASIC_FLASH,
+                program.data(), program.size()));
+        }
+
+        TEST_METHOD(testWatchForgetsRamProgramsOnReconnect) {
+            SpheroUploadCache cache(TEST_CACHE_PATH);
+            RawPeer peer;
+            SpheroHandler robot(peer.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            peer.accept();
+            uint64_t device = SpheroUploadCache::deviceKey(robot.getConnection().remoteEndpoint());
+
+            cache.stored(device, SpheroUploadCache::TARGET_TEMP_MACRO, program.data(), program.size());
+            SpheroUploadWatch watch(cache, robot);
+            Assert::IsFalse(cache.isCurrent(device, SpheroUploadCache::TARGET_TEMP_MACRO,
+                program.data(), program.size()));
+        }
+
+        TEST_METHOD(testWatchForgetsRamProgramsOnDeadLink) {
+            SpheroUploadCache cache(TEST_CACHE_PATH);
+            bench::LoopbackDevice device((bench::LoopbackDevice::LinkConfig()));
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+            SpheroUploadWatch watch(cache, robot);
+
+            SpheroKeepaliveOptions options;
+            options.interval = std::chrono::milliseconds(50);
+            options.timeout = std::chrono::milliseconds(50);
+            options.missedBeats = 2;
+            SpheroKeepalive keepalive(robot, options, [&watch]() { watch.linkLost(); });
+
+            cache.stored(watch.device(), SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                program.data(), program.size());
+            device.setSilent(true);
+            Assert::IsTrue(waitFor([&]() {
+                return !cache.isCurrent(watch.device(), SpheroUploadCache::TARGET_ORBBASIC_RAM,
+                    program.data(), program.size());
+            }, SpheroKeepalive::detectionTime(options) + std::chrono::milliseconds(200)));
+
+            device.stop();
+        }
+    };
+}
@@ -0,0 +1,81 @@
+#include "stdafx.h"
+#include "CppUnitTest.h"
+#include "../bluetoothconn/bench/LoopbackDevice.h"
+
+using namespace Microsoft::VisualStudio::CppUnitTestFramework;
+
+namespace BTUT {
+    TEST_CLASS(SpheroUploadTest) {
+    public:
+        TEST_METHOD(testWindowHidesRoundTrips) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.delay = std::chrono::microseconds(50000);
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+
+            // Eight chunks: one at a time would take at least 800ms
+            std::vector<unsigned char> macro(SpheroUploadProtocol::MAX_DATA * 8, 0x42);
+            SpheroUploader uploader(robot);
+            SpheroUploadResult result = uploader.uploadMacro(macro);
+
+            Assert::IsTrue(result.ok);
+            Assert::AreEqual((std::size_t) 8, result.progress.chunksDone);
+            Assert::AreEqual((unsigned) 0, result.retries);
+            Assert::AreEqual((uint64_t) 8, device.commandsReceived());
+            Assert::IsTrue(result.progress.elapsed < std::chrono::milliseconds(600));
+            Assert::AreEqual((std::size_t) 0, robot.getConnection().queued());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testRejectedChunkIsResent) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.failEvery = 3;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+
+            // Commands 3 and 6 are the third and fifth chunks, with
+            // nothing behind them
+            SpheroUploadOptions options;
+            options.window = 1;
+            std::vector<unsigned char> macro(SpheroUploadProtocol::MAX_DATA * 4 + 50, 0x42);
+            SpheroUploader uploader(robot, options);
+            SpheroUploadResult result = uploader.uploadMacro(macro);
+
+            Assert::IsTrue(result.ok);
+            Assert::AreEqual((unsigned) 2, result.retries);
+            Assert::AreEqual((unsigned) 0, result.restarts);
+            Assert::AreEqual((uint64_t) 7, device.commandsReceived());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+
+        TEST_METHOD(testRejectionBehindAcceptedChunksRestarts) {
+            bench::LoopbackDevice::LinkConfig link;
+            link.failEvery = 5;
+            bench::LoopbackDevice device(link);
+            device.start();
+            SpheroHandler robot(device.endpoint(), SpheroConnectOptions(0, std::chrono::milliseconds(10)));
+
+            // Command 5 is the fourth chunk, rejected after the fifth and
+            // sixth were sent: erase and start over one chunk at a time,
+            // which then has the second and the sixth chunk sent again
+            std::string program(253 * 5 + 100, 'A');
+            SpheroUploader uploader(robot);
+            SpheroUploadResult result = uploader.uploadOrbBasic(program);
+
+            Assert::IsTrue(result.ok);
+            Assert::AreEqual((unsigned) 1, result.restarts);
+            Assert::AreEqual((unsigned) 3, result.retries);
+            Assert::AreEqual((std::size_t) 6, result.progress.chunksDone);
+            Assert::AreEqual((uint64_t) 16, device.commandsReceived());
+
+            robot.getConnection().close();
+            device.stop();
+        }
+    };
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+namespace BTUT {
+    /**
+     * The robot's end of a loopback connection, writing exactly the
+     * bytes a test hands it.
+     */
+    class RawPeer {
+        boost::asio::io_service io_;
+        boost::asio::ip::tcp::acceptor acceptor_;
+        boost::asio::ip::tcp::socket socket_;
+
+    public:
+        RawPeer() :
+            acceptor_(io_, boost::asio::ip::tcp::endpoint(
+                boost::asio::ip::address_v4::loopback(), 0)),
+            socket_(io_) {
+        }
+
+        BluetoothProto::endpoint endpoint() const {
+            return BluetoothProto::endpoint(acceptor_.local_endpoint());
+        }
+        void accept() {
+            acceptor_.accept(socket_);
+        }
+        void write(std::vector<unsigned char> const& bytes) {
+            boost::asio::write(socket_, boost::asio::buffer(bytes));
+        }
+
+        /**
+         * Block until the next command frame (SOP1 SOP2 DID CID SEQ DLEN
+         * <DLEN bytes>) has arrived and return it whole.
+         */
+        std::vector<unsigned char> readCommand() {
+            std::vector<unsigned char> frame(6);
+            boost::asio::read(socket_, boost::asio::buffer(frame));
+            frame.resize(6 + frame[5]);
+            boost::asio::read(socket_, boost::asio::buffer(&frame[6], frame[5]));
+            return frame;
+        }
+
+        static std::vector<unsigned char> response(unsigned char seq, unsigned char mrsp = 0) {
+            std::vector<unsigned char> frame = { 0xFF, 0xFF, mrsp, seq, 0x01 };
+            frame.push_back((unsigned char)~(mrsp + seq + 0x01));
+            return frame;
+        }
+        static std::vector<unsigned char> sensorData(unsigned char value) {
+            std::vector<unsigned char> frame = { 0xFF, 0xFE, ASYNC_SENSOR_DATA, 0x00, 0x03, value, value };
+            frame.push_back((unsigned char)~(ASYNC_SENSOR_DATA + 0x03 + value + value));
+            return frame;
+        }
+        static std::vector<unsigned char> powerNotify() {
+            std::vector<unsigned char> frame = { 0xFF, 0xFE, ASYNC_POWER_NOTIFY, 0x00, 0x02, POWER_STATE_OK };
+            frame.push_back((unsigned char)~(ASYNC_POWER_NOTIFY + 0x02 + POWER_STATE_OK));
+            return frame;
+        }
+        static std::vector<unsigned char> preSleep() {
+            std::vector<unsigned char> frame = { 0xFF, 0xFE, ASYNC_PRE_SLEEP, 0x00, 0x01 };
+            frame.push_back((unsigned char)~(ASYNC_PRE_SLEEP + 0x01));
+            return frame;
+        }
+    };
+
+    /**
+     * Poll pred until it holds or timeout passes.
+     */
+    template <class Predicate>
+    bool waitFor(Predicate pred, std::chrono::milliseconds timeout) {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!pred()) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+}
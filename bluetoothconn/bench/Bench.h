@@ -0,0 +1,167 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * A minimal benchmark harness: runs an operation repeatedly for a minimum
+ * amount of time and reports the average time and heap allocations per
+ * operation.
+ *
+ * Allocations are counted by replacement global operator new/delete, which
+ * must be instantiated exactly once per benchmark program by placing
+ * BENCH_COUNT_ALLOCATIONS() at namespace scope in one translation unit.
+ */
+namespace bench {
+
+extern boost::atomic<uint64_t> allocationCount;
+
+struct Options {
+    std::chrono::milliseconds minTime;
+    uint64_t minIterations;
+    uint64_t maxIterations;
+
+    Options() :
+        minTime(200), minIterations(10), maxIterations(100000000) {
+    }
+    Options(std::chrono::milliseconds t, uint64_t minIt, uint64_t maxIt) :
+        minTime(t), minIterations(minIt), maxIterations(maxIt) {
+    }
+};
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double allocsPerOp;
+};
+
+/**
+ * Keep the compiler from discarding a computed value.
+ */
+template <class T>
+inline void doNotOptimize(T const& value) {
+    static volatile unsigned char sink;
+    sink = *reinterpret_cast<volatile const unsigned char *>(&value);
+}
+
+/**
+ * Time op() in batches that double in size until both minTime and
+ * minIterations are reached (or maxIterations is hit).
+ */
+template <class Op>
+Result run(std::string const& name, Op && op, Options const& opts = Options()) {
+    typedef std::chrono::steady_clock Clock;
+
+    op(); // warm up caches and any lazily-initialized statics
+
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    uint64_t allocsBefore = allocationCount.load();
+    Clock::duration elapsed(0);
+
+    while (iterations < opts.maxIterations &&
+           (elapsed < opts.minTime || iterations < opts.minIterations)) {
+        batch = (std::min)(batch, opts.maxIterations - iterations);
+
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < batch; ++i)
+            op();
+        elapsed += Clock::now() - start;
+
+        iterations += batch;
+        batch *= 2;
+    }
+
+    Result ret;
+    ret.name = name;
+    ret.iterations = iterations;
+    ret.nsPerOp = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        elapsed).count() / (double)iterations;
+    ret.allocsPerOp =
+        (double)(allocationCount.load() - allocsBefore) / (double)iterations;
+    return ret;
+}
+
+/**
+ * The benchmarks a run was asked for: those whose name contains filter,
+ * or all of them if it is empty. Others are skipped rather than run and
+ * then hidden.
+ */
+class Suite {
+    std::string filter_;
+    std::vector<Result> results_;
+
+public:
+    explicit Suite(std::string const& filter) :
+        filter_(filter) {
+    }
+
+    bool wants(std::string const& name) const {
+        return filter_.empty() || name.find(filter_) != std::string::npos;
+    }
+
+    template <class Op>
+    void run(std::string const& name, Op && op, Options const& opts = Options()) {
+        if (wants(name)) results_.push_back(bench::run(name, std::forward<Op>(op), opts));
+    }
+
+    std::vector<Result> const& results() const {
+        return results_;
+    }
+};
+
+inline void printHeader(std::ostream & out) {
+    out << std::left << std::setw(48) << "benchmark"
+        << std::right << std::setw(14) << "iterations"
+        << std::setw(16) << "ns/op"
+        << std::setw(14) << "allocs/op" << std::endl;
+}
+
+inline void print(std::ostream & out, Result const& result) {
+    out << std::left << std::setw(48) << result.name
+        << std::right << std::setw(14) << result.iterations
+        << std::setw(16) << std::fixed << std::setprecision(1) << result.nsPerOp
+        << std::setw(14) << std::setprecision(2) << result.allocsPerOp
+        << std::endl;
+}
+
+}
+
+#define BENCH_COUNT_ALLOCATIONS()                                   \
+    boost::atomic<uint64_t> bench::allocationCount(0);              \
+    void * operator new(std::size_t size) {                         \
+        bench::allocationCount.fetch_add(1, boost::memory_order_relaxed); \
+        if (void * p = std::malloc(size ? size : 1)) return p;      \
+        throw std::bad_alloc();                                     \
+    }                                                               \
+    void * operator new[](std::size_t size) {                       \
+        return operator new(size);                                  \
+    }                                                               \
+    void operator delete(void * p) noexcept {                       \
+        std::free(p);                                               \
+    }                                                               \
+    void operator delete[](void * p) noexcept {                     \
+        std::free(p);                                               \
+    }                                                               \
+    void operator delete(void * p, std::size_t) noexcept {          \
+        std::free(p);                                               \
+    }                                                               \
+    void operator delete[](void * p, std::size_t) noexcept {        \
+        std::free(p);                                               \
+    }
@@ -0,0 +1,367 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file LatencySlo.cpp
+ * End-to-end latency and throughput SLO harness.
+ *
+ * Runs a SpheroHandler against a LoopbackDevice over an emulated link,
+ * drives a command mix alongside a streaming load, and checks the results
+ * against service level objectives. Latencies run from a command being
+ * sent to the application's reader getting its response out of
+ * readResponse(), so they include the handoff from the io thread; the
+ * io thread's own view is reported alongside as io_latency. Results are
+ * written as JSON; the exit code is non-zero if any objective is missed.
+ *
+ * Usage: btconn_slo [--option=value ...]
+ *
+ *   --duration-ms       length of the run                      (10000)
+ *   --delay-us          one-way link delay                     (5000)
+ *   --bandwidth         link bytes per second, 0 = unlimited   (11520)
+ *   --roll-hz           rate of Roll commands                  (50)
+ *   --rgb-hz            rate of SetRGB commands                (10)
+ *   --locator-hz        rate of ReadLocator commands           (5)
+ *   --ping-hz           rate of Ping commands                  (1)
+ *   --stream-hz         rate of streamed sensor packets        (200)
+ *   --stream-bytes      sensor bytes per streamed packet       (32)
+ *   --collision-hz      rate of collision notifications        (5)
+ *   --slo-roll-p99-us   maximum p99 Roll response time, as
+ *                       the reader sees it                     (40000)
+ *   --slo-all-p999-us   maximum p99.9 over all commands, as
+ *                       the reader sees it                     (100000)
+ *   --slo-ack-ratio     minimum fraction of commands acked     (0.99)
+ *   --slo-event-p99-us  maximum p99 time from a collision's
+ *                       read completing to its subscriber      (1000)
+ *   --slo-delivered-hz  minimum rate of frames handed to the
+ *                       reader via readResponse(), 0 = off     (0)
+ *   --load-threads      busy threads competing for the CPU     (0)
+ *   --io-cpus           cores for the io and sending threads,
+ *                       comma separated, empty = any           ()
+ *   --io-fifo           SCHED_FIFO priority of those threads,
+ *                       0 = normal scheduling                  (0)
+ *   --lock-memory       1 to lock the process in memory        (0)
+ *   --device-fifo       SCHED_FIFO priority of the emulated
+ *                       robot, so host load doesn't slow it    (0)
+ *   --json              write the report to a file instead of stdout
+ *
+ * To see what pinning and priority buy under load, compare e.g.
+ *
+ *   btconn_slo --device-fifo=20 --load-threads=8
+ *   btconn_slo --device-fifo=20 --load-threads=8 --io-fifo=10 --lock-memory=1
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn.h"
+
+#include <iomanip>
+#include <map>
+
+#include "LoopbackDevice.h"
+
+using namespace std;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Scenario {
+    map<string, string> options;
+
+    double number(string const& name, double fallback) const {
+        auto it = options.find(name);
+        return (it == options.end()) ? fallback : atof(it->second.c_str());
+    }
+    string text(string const& name, string const& fallback) const {
+        auto it = options.find(name);
+        return (it == options.end()) ? fallback : it->second;
+    }
+};
+
+/**
+ * The policy the <prefix>-cpus and <prefix>-fifo options ask for.
+ */
+BtThreadPolicy threadPolicy(Scenario const& scenario, string const& prefix) {
+    BtThreadPolicy policy;
+    istringstream cpus(scenario.text(prefix + "-cpus", ""));
+    string cpu;
+    while (getline(cpus, cpu, ','))
+        policy.cpus.push_back((unsigned)atoi(cpu.c_str()));
+    policy.priority = (int)scenario.number(prefix + "-fifo", 0);
+    policy.realtime = policy.priority > 0;
+    return policy;
+}
+
+/**
+ * Keeps the CPU busy until stopping is set, like a vision pipeline
+ * sharing the host.
+ */
+void burn(boost::atomic<bool> const& stopping) {
+    volatile uint64_t sink = 0;
+    while (!stopping.load(boost::memory_order_relaxed)) {
+        for (int i = 0; i < 10000; ++i)
+            sink = sink + i;
+    }
+}
+
+/**
+ * Sends one kind of command at a fixed rate.
+ */
+struct Stream {
+    string name;
+    unsigned slot;
+    double hz;
+    Clock::time_point next;
+    uint64_t sent;
+    std::function<SpheroSharedFramePtr(uint64_t)> frame;
+};
+
+struct Objective {
+    string name;
+    double limit;
+    double actual;
+    bool upperBound;
+
+    bool pass() const {
+        return upperBound ? actual <= limit : actual >= limit;
+    }
+};
+
+void writeSnapshot(ostream & out, LatencyHistogram::Snapshot const& snap) {
+    out << "{\"acked\": " << snap.count()
+        << ", \"mean_us\": " << snap.mean()
+        << ", \"p50_us\": " << snap.percentile(50.0)
+        << ", \"p99_us\": " << snap.percentile(99.0)
+        << ", \"p999_us\": " << snap.percentile(99.9)
+        << ", \"max_us\": " << snap.max() << "}";
+}
+
+}
+
+int main(int argc, char ** argv) {
+    Scenario scenario;
+    for (int i = 1; i < argc; ++i) {
+        string arg(argv[i]);
+        auto eq = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || eq == string::npos) {
+            cerr << "Unrecognized argument " << arg << endl;
+            return 2;
+        }
+        scenario.options[arg.substr(2, eq - 2)] = arg.substr(eq + 1);
+    }
+
+    bench::LoopbackDevice::LinkConfig link;
+    link.delay = std::chrono::microseconds(
+        (long long)scenario.number("delay-us", 5000));
+    link.bytesPerSecond = scenario.number("bandwidth", 11520);
+    link.streamingHz = (unsigned)scenario.number("stream-hz", 200);
+    link.streamingBytes = (unsigned)scenario.number("stream-bytes", 32);
+    link.collisionHz = (unsigned)scenario.number("collision-hz", 5);
+    auto duration = std::chrono::milliseconds(
+        (long long)scenario.number("duration-ms", 10000));
+
+    link.thread = threadPolicy(scenario, "device");
+    BtThreadPolicy ioPolicy = threadPolicy(scenario, "io");
+    ioPolicy.lockMemory = scenario.number("lock-memory", 0) != 0;
+
+    // New threads inherit SCHED_FIFO, so start the load first
+    boost::atomic<bool> loadStopping(false);
+    vector<std::thread> load;
+    for (int i = 0; i < (int)scenario.number("load-threads", 0); ++i)
+        load.push_back(std::thread([&loadStopping]() { burn(loadStopping); }));
+
+    bench::LoopbackDevice device(link);
+    device.start();
+    SpheroConnectOptions connectOptions;
+    connectOptions.ioThread = ioPolicy;
+    SpheroHandler robot(device.endpoint(), connectOptions);
+
+    // This thread sends the commands
+    if (!ioPolicy.empty() && !ioPolicy.apply())
+        cerr << "Could not apply the requested thread policy, see the log" << endl;
+
+    SpheroEvents events(robot);
+    boost::atomic<uint64_t> collisionsSeen(0);
+    events.onCollision([&](SpheroCollisionEvent const&) {
+        collisionsSeen.fetch_add(1, boost::memory_order_relaxed);
+    });
+
+    vector<Stream> streams = {
+        { "Roll", RollCommand::slot(), scenario.number("roll-hz", 50),
+          Clock::time_point(), 0,
+          [](uint64_t n) {
+              return SpheroSharedFrame::encode(makeRollCommand(0x80, (unsigned short)((n * 7) % 360)));
+          } },
+        { "SetRGB", SetRGBCommand::slot(), scenario.number("rgb-hz", 10),
+          Clock::time_point(), 0,
+          [](uint64_t n) {
+              return SpheroSharedFrame::encode(makeSetRGBCommand((unsigned char)n, 0x20, 0x40));
+          } },
+        { "ReadLocator", ReadLocatorCommand::slot(), scenario.number("locator-hz", 5),
+          Clock::time_point(), 0,
+          [](uint64_t) {
+              return SpheroSharedFrame::encode(ReadLocatorCommand());
+          } },
+        { "Ping", PingCommand::slot(), scenario.number("ping-hz", 1),
+          Clock::time_point(), 0,
+          [](uint64_t) {
+              return SpheroSharedFrame::encode(PingCommand());
+          } },
+    };
+
+    // Drain responses the way an application would, timing each one
+    // up to the moment the reader has it
+    SpheroLatencyRecorder handoff;
+    boost::atomic<bool> stopping(false);
+    boost::atomic<uint64_t> delivered(0);
+    std::thread reader([&]() {
+        while (!stopping.load()) {
+            auto response = robot.readResponse();
+            if (response && response->startOfPacket() == 0xFF)
+                handoff.responseReceived(response->sequenceNum());
+            delivered.fetch_add(1);
+        }
+    });
+
+    auto start = Clock::now();
+    auto end = start + duration;
+    for (auto & stream : streams)
+        stream.next = start;
+
+    while (Clock::now() < end) {
+        Stream * due = nullptr;
+        for (auto & stream : streams) {
+            if (stream.hz > 0 && (!due || stream.next < due->next))
+                due = &stream;
+        }
+        if (!due) break;
+
+        std::this_thread::sleep_until(due->next);
+        // Stamped before it goes out, the response may beat us back
+        auto frame = due->frame(due->sent++);
+        unsigned char seq = robot.nextSeq();
+        handoff.commandSent(due->slot, seq);
+        robot.sendEncoded(frame->view(seq), due->slot, seq);
+        due->next += std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / due->hz));
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    loadStopping = true;
+    for (auto & t : load)
+        t.join();
+
+    // Let in-flight responses land, then release the reader
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    SpheroLatencyReport ioReport = robot.latency().report();
+    SpheroLatencyReport report = handoff.report();
+
+    stopping = true;
+    PingCommand wakeReader;
+    robot.sendCommand(wakeReader);
+    reader.join();
+
+    uint64_t sent = 0;
+    uint64_t acked = 0;
+    for (auto const& stream : streams) {
+        sent += stream.sent;
+        acked += ioReport.atSlot(stream.slot).count();
+    }
+
+    vector<Objective> objectives = {
+        { "roll_p99_us", scenario.number("slo-roll-p99-us", 40000),
+          (double)report.get<RollCommand>().percentile(99.0), true },
+        { "all_p999_us", scenario.number("slo-all-p999-us", 100000),
+          (double)report.total().percentile(99.9), true },
+        { "ack_ratio", scenario.number("slo-ack-ratio", 0.99),
+          sent ? (double)acked / (double)sent : 1.0, false },
+    };
+    if (link.collisionHz > 0) {
+        objectives.push_back({ "event_p99_us", scenario.number("slo-event-p99-us", 1000),
+            (double)events.latency().snapshot().percentile(99.0), true });
+    }
+    if (scenario.number("slo-delivered-hz", 0) > 0) {
+        objectives.push_back({ "delivered_hz", scenario.number("slo-delivered-hz", 0),
+            (double)delivered.load() / elapsed, false });
+    }
+
+    bool pass = true;
+    for (auto const& objective : objectives)
+        pass = pass && objective.pass();
+
+    ostringstream json;
+    json << std::fixed << std::setprecision(3);
+    json << "{\n  \"scenario\": {";
+    json << "\"duration_s\": " << elapsed
+         << ", \"delay_us\": " << link.delay.count()
+         << ", \"bandwidth_bps\": " << link.bytesPerSecond
+         << ", \"stream_hz\": " << link.streamingHz
+         << ", \"stream_bytes\": " << link.streamingBytes
+         << ", \"collision_hz\": " << link.collisionHz
+         << ", \"load_threads\": " << load.size()
+         << ", \"io_fifo\": " << (ioPolicy.realtime ? ioPolicy.priority : 0)
+         << ", \"io_cpus\": " << ioPolicy.cpus.size()
+         << ", \"lock_memory\": " << (ioPolicy.lockMemory ? "true" : "false") << "},\n";
+
+    json << "  \"commands\": {";
+    for (std::size_t i = 0; i < streams.size(); ++i) {
+        json << (i ? ",\n    " : "\n    ") << "\"" << streams[i].name << "\": "
+             << "{\"sent\": " << streams[i].sent << ", \"hz\": " << streams[i].hz
+             << ", \"latency\": ";
+        writeSnapshot(json, report.atSlot(streams[i].slot));
+        json << ", \"io_latency\": ";
+        writeSnapshot(json, ioReport.atSlot(streams[i].slot));
+        json << "}";
+    }
+    json << "\n  },\n";
+
+    json << "  \"events\": {\"collisions_sent\": " << device.collisionsSent()
+         << ", \"collisions_delivered\": " << collisionsSeen.load()
+         << ", \"latency\": ";
+    writeSnapshot(json, events.latency().snapshot());
+    json << "},\n";
+
+    json << "  \"throughput\": {"
+         << "\"commands_sent\": " << sent
+         << ", \"commands_acked\": " << acked
+         << ", \"acks_per_s\": " << (double)acked / elapsed
+         << ", \"stream_frames_sent\": " << device.streamFramesSent()
+         << ", \"delivered_per_s\": " << (double)delivered.load() / elapsed
+         << "},\n";
+
+    json << "  \"slo\": [";
+    for (std::size_t i = 0; i < objectives.size(); ++i) {
+        json << (i ? ",\n    " : "\n    ")
+             << "{\"name\": \"" << objectives[i].name << "\""
+             << ", \"limit\": " << objectives[i].limit
+             << ", \"actual\": " << objectives[i].actual
+             << ", \"pass\": " << (objectives[i].pass() ? "true" : "false") << "}";
+    }
+    json << "\n  ],\n";
+    json << "  \"pass\": " << (pass ? "true" : "false") << "\n}\n";
+
+    string path = scenario.text("json", "");
+    if (path.empty()) {
+        cout << json.str();
+    } else {
+        ofstream out(path.c_str());
+        out << json.str();
+    }
+
+    robot.getConnection().close();
+    device.stop();
+    return pass ? 0 : 1;
+}
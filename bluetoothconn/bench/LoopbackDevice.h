@@ -0,0 +1,336 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+namespace bench {
+
+/**
+ * A stand-in for a Sphero robot, listening on a loopback TCP port.
+ *
+ * The device answers every client command that asks for an answer with a
+ * successful response of a plausible size, and can stream asynchronous
+ * sensor packets and collision notifications at fixed rates. Traffic in both directions passes through
+ * an emulated link with a one-way delay and a bandwidth limit, so frames
+ * queue up behind each other the way they would over RFCOMM.
+ */
+class LoopbackDevice {
+public:
+    struct LinkConfig {
+        std::chrono::microseconds delay;      // one-way propagation delay
+        double bytesPerSecond;                // 0 means unlimited
+        std::chrono::microseconds processing; // device time per command
+        unsigned streamingHz;                 // 0 disables streaming
+        unsigned streamingBytes;              // sensor bytes per packet
+        unsigned collisionHz;                 // 0 reports no collisions
+        unsigned failEvery;                   // reject every Nth command, 0 never
+        unsigned dropEvery;                   // lose every Nth response, 0 never
+        unsigned lateEvery;                   // hold back every Nth response...
+        std::chrono::microseconds lateBy;     // ...by this much
+        bool backpressure;                    // stop reading while the uplink is busy
+        BtThreadPolicy thread;                // for the device's own thread
+
+        LinkConfig() :
+            delay(5000), bytesPerSecond(11520.0), processing(500),
+            streamingHz(0), streamingBytes(32), collisionHz(0), failEvery(0),
+            dropEvery(0), lateEvery(0), lateBy(0), backpressure(false) {
+        }
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    typedef boost::asio::ip::tcp tcp;
+
+    struct PendingFrame {
+        Clock::time_point arrival;
+        std::vector<unsigned char> bytes;
+    };
+
+    LinkConfig link_;
+    boost::asio::io_service io_;
+    tcp::acceptor acceptor_;
+    tcp::socket socket_;
+    boost::asio::steady_timer downlinkTimer_;
+    boost::asio::steady_timer uplinkTimer_;
+    boost::asio::steady_timer streamTimer_;
+    boost::asio::steady_timer collisionTimer_;
+    std::thread thread_;
+
+    std::array<unsigned char, 1024> readBuffer_;
+    std::vector<unsigned char> rxBytes_;
+    Clock::time_point uplinkFree_;
+    Clock::time_point downlinkFree_;
+    std::deque<PendingFrame> downlink_;
+    Clock::time_point nextStream_;
+    Clock::time_point nextCollision_;
+
+    boost::atomic<uint64_t> commandsReceived_;
+    boost::atomic<uint64_t> streamFramesSent_;
+    boost::atomic<uint64_t> collisionsSent_;
+    boost::atomic<bool> silent_;
+
+    Clock::duration serialization(std::size_t bytes) const {
+        if (link_.bytesPerSecond <= 0.0) return Clock::duration(0);
+        return std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>((double)bytes / link_.bytesPerSecond));
+    }
+
+    static unsigned char checksum(std::vector<unsigned char> const& frame) {
+        unsigned sum = 0;
+        for (std::size_t i = 2; i < frame.size(); ++i)
+            sum += frame[i];
+        return (unsigned char)(~sum);
+    }
+
+    static unsigned char responseDataLength(unsigned char did, unsigned char cid) {
+        if (did == DID_CORE) {
+            switch (cid) {
+                case CMD_VERSION: return 8;
+                case CMD_GET_BT_NAME: return 32;
+                case CMD_GET_AUTO_RECONNECT: return 2;
+                case CMD_GET_PWR_STATE: return 8;
+                default: return 0;
+            }
+        }
+        switch (cid) {
+            case CMD_READ_LOCATOR: return 10;
+            case CMD_GET_RGB_LED: return 3;
+            case CMD_GET_OPTIONS_FLAG: return 4;
+            case CMD_GET_TEMP_OPTIONS_FLAG: return 4;
+            case CMD_MACRO_STATUS: return 3;
+            default: return 0;
+        }
+    }
+
+    /**
+     * Put a frame on the device-to-host link no earlier than readyAt.
+     */
+    void transmit(std::vector<unsigned char> && frame, Clock::time_point readyAt) {
+        if (silent_.load()) return;
+        Clock::time_point departure = (std::max)(readyAt, downlinkFree_);
+        downlinkFree_ = departure + serialization(frame.size());
+
+        PendingFrame pending;
+        pending.arrival = downlinkFree_ + link_.delay;
+        pending.bytes = std::move(frame);
+
+        bool idle = downlink_.empty();
+        downlink_.push_back(std::move(pending));
+        if (idle) scheduleDownlink();
+    }
+
+    void scheduleDownlink() {
+        downlinkTimer_.expires_at(downlink_.front().arrival);
+        downlinkTimer_.async_wait([this](boost::system::error_code const& ec) {
+            if (ec) return;
+
+            // Frames due together leave in one write, so the host gets
+            // them in one read, as it does from RFCOMM
+            auto now = Clock::now();
+            std::vector<unsigned char> burst;
+            while (!downlink_.empty() && downlink_.front().arrival <= now) {
+                burst.insert(burst.end(),
+                    downlink_.front().bytes.begin(), downlink_.front().bytes.end());
+                downlink_.pop_front();
+            }
+            boost::system::error_code wec;
+            boost::asio::write(socket_, boost::asio::buffer(burst), wec);
+            if (!wec && !downlink_.empty()) scheduleDownlink();
+        });
+    }
+
+    void handleCommand(unsigned char const* frame, Clock::time_point arrival) {
+        uint64_t n = commandsReceived_.fetch_add(1) + 1;
+        bool fail = link_.failEvery > 0 && n % link_.failEvery == 0;
+
+        unsigned char sop2 = frame[1];
+        if ((sop2 & 0x01) == 0) return; // no answer requested
+        if (link_.dropEvery > 0 && n % link_.dropEvery == 0) return;
+        if (link_.lateEvery > 0 && n % link_.lateEvery == 0) arrival += link_.lateBy;
+
+        unsigned char dlen = fail ? 0 : responseDataLength(frame[2], frame[3]);
+        std::vector<unsigned char> response = {
+            0xFF, 0xFF,
+            (unsigned char)(fail ? ORBOTIX_RSP_CODE_EEXEC : ORBOTIX_RSP_CODE_OK),
+            frame[4], (unsigned char)(dlen + 1)
+        };
+        for (unsigned char i = 0; i < dlen; ++i)
+            response.push_back((unsigned char)(i + frame[4]));
+        response.push_back(checksum(response));
+
+        transmit(std::move(response), arrival + link_.processing);
+    }
+
+    void readCommands() {
+        socket_.async_read_some(boost::asio::buffer(readBuffer_),
+            [this](boost::system::error_code const& ec, std::size_t bytes) {
+                if (ec) return;
+
+                // Bytes arrive behind everything already on the uplink
+                auto now = Clock::now();
+                uplinkFree_ = (std::max)(now, uplinkFree_) + serialization(bytes);
+                auto arrival = uplinkFree_ + link_.delay;
+
+                rxBytes_.insert(rxBytes_.end(),
+                    readBuffer_.begin(), readBuffer_.begin() + bytes);
+
+                // SOP1 SOP2 DID CID SEQ DLEN <DLEN bytes incl. checksum>
+                std::size_t pos = 0;
+                while (rxBytes_.size() - pos >= 6) {
+                    if (rxBytes_[pos] != 0xFF) { ++pos; continue; }
+                    std::size_t len = 6 + rxBytes_[pos + 5];
+                    if (rxBytes_.size() - pos < len) break;
+                    handleCommand(&rxBytes_[pos], arrival);
+                    pos += len;
+                }
+                rxBytes_.erase(rxBytes_.begin(), rxBytes_.begin() + pos);
+
+                if (!link_.backpressure) {
+                    readCommands();
+                    return;
+                }
+
+                // Leave further bytes in the socket until the link could
+                // have carried these, so the sender's buffers fill up
+                uplinkTimer_.expires_at(uplinkFree_);
+                uplinkTimer_.async_wait([this](boost::system::error_code const& ec) {
+                    if (!ec) readCommands();
+                });
+            });
+    }
+
+    void streamTick() {
+        nextStream_ += std::chrono::microseconds(1000000 / link_.streamingHz);
+        streamTimer_.expires_at(nextStream_);
+        streamTimer_.async_wait([this](boost::system::error_code const& ec) {
+            if (ec) return;
+
+            unsigned dlen = link_.streamingBytes + 1;
+            std::vector<unsigned char> packet = {
+                0xFF, 0xFE, 0x03,
+                (unsigned char)(dlen >> 8), (unsigned char)(dlen & 0xFF)
+            };
+            for (unsigned i = 0; i < link_.streamingBytes; ++i)
+                packet.push_back((unsigned char)i);
+            packet.push_back(checksum(packet));
+
+            streamFramesSent_.fetch_add(1);
+            transmit(std::move(packet), Clock::now());
+            streamTick();
+        });
+    }
+
+    void collisionTick() {
+        nextCollision_ += std::chrono::microseconds(1000000 / link_.collisionHz);
+        collisionTimer_.expires_at(nextCollision_);
+        collisionTimer_.async_wait([this](boost::system::error_code const& ec) {
+            if (ec) return;
+
+            // X Y Z Axis xMagnitude yMagnitude Speed Timestamp
+            uint64_t n = collisionsSent_.fetch_add(1);
+            std::vector<unsigned char> packet = {
+                0xFF, 0xFE, 0x07, 0x00, 0x11,
+                0x00, 0x40, 0xFF, 0xC0, 0x00, 0x10,
+                0x01,
+                0x01, 0x00, 0x00, 0x20,
+                0x80,
+                (unsigned char)(n >> 24), (unsigned char)(n >> 16),
+                (unsigned char)(n >> 8), (unsigned char)n
+            };
+            packet.push_back(checksum(packet));
+
+            transmit(std::move(packet), Clock::now());
+            collisionTick();
+        });
+    }
+
+public:
+    explicit LoopbackDevice(LinkConfig const& link) :
+        link_(link),
+        acceptor_(io_, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0)),
+        socket_(io_),
+        downlinkTimer_(io_),
+        uplinkTimer_(io_),
+        streamTimer_(io_),
+        collisionTimer_(io_),
+        commandsReceived_(0),
+        streamFramesSent_(0),
+        collisionsSent_(0),
+        silent_(false) {
+        readBuffer_.fill(0);
+    }
+
+    ~LoopbackDevice() {
+        stop();
+    }
+
+    /**
+     * The endpoint a SpheroHandler or BtConnection should connect to.
+     */
+    BluetoothProto::endpoint endpoint() const {
+        return BluetoothProto::endpoint(acceptor_.local_endpoint());
+    }
+
+    /**
+     * Wait for the host to connect on a background thread and start
+     * serving it.
+     */
+    void start() {
+        // Set before the host connects, so the window it is offered is small
+        if (link_.backpressure)
+            acceptor_.set_option(boost::asio::socket_base::receive_buffer_size(256));
+        acceptor_.async_accept(socket_, [this](boost::system::error_code const& ec) {
+            if (ec) return;
+            socket_.set_option(tcp::no_delay(true));
+
+            uplinkFree_ = downlinkFree_ = nextStream_ = nextCollision_ = Clock::now();
+            readCommands();
+            if (link_.streamingHz > 0) streamTick();
+            if (link_.collisionHz > 0) collisionTick();
+        });
+        thread_ = std::thread([this]() {
+            if (!link_.thread.empty()) link_.thread.apply();
+            io_.run();
+        });
+    }
+
+    void stop() {
+        io_.stop();
+        if (thread_.joinable()) thread_.join();
+    }
+
+    /**
+     * Stop sending anything while keeping the connection open, like a
+     * robot that went out of range without the link noticing.
+     */
+    void setSilent(bool silent) {
+        silent_.store(silent);
+    }
+
+    uint64_t commandsReceived() const {
+        return commandsReceived_.load();
+    }
+    uint64_t streamFramesSent() const {
+        return streamFramesSent_.load();
+    }
+    uint64_t collisionsSent() const {
+        return collisionsSent_.load();
+    }
+};
+
+}
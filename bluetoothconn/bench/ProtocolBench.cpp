@@ -0,0 +1,313 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file ProtocolBench.cpp
+ * Microbenchmarks for the send and receive hot paths of the protocol.
+ *
+ * Usage: btconn_bench [name-filter]
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn.h"
+
+#include <iomanip>
+#include <cstdlib>
+#include <new>
+
+#include "Bench.h"
+
+BENCH_COUNT_ALLOCATIONS()
+
+using namespace std;
+using boost::asio::ip::tcp;
+
+namespace {
+
+unsigned char ROLL_DATA[] = { 0x80, 0x00, 0x5A, 0x01 };
+
+SpheroServerResponse locatorResponse() {
+    // ReadLocator response: X, Y, X-vel, Y-vel, speed, plus checksum
+    SpheroServerResponse ret({
+        0xFF, 0xFF, 0x00, 0x07, 0x0B,
+        0x00, 0x10, 0xFF, 0xF0, 0x00, 0x05, 0x00, 0x06, 0x00, 0x20, 0xC3
+    });
+    return ret;
+}
+
+void sendPathBenchmarks(bench::Suite & suite) {
+    RollCommand roll;
+    unsigned char seq = 0;
+    suite.run("send/generateCommandMessage", [&]() {
+        auto msg = roll.generateCommandMessage<SpheroClientCommand>(seq++);
+        bench::doNotOptimize(msg);
+    });
+
+    suite.run("send/assemble (fresh command)", [&]() {
+        SpheroClientCommand cmd(true, true);
+        cmd.setDeviceId(DID_SPHERO);
+        cmd.setCommandId(CMD_ROLL);
+        cmd.setSeqNum(seq++);
+        cmd.setData(ROLL_DATA, sizeof(ROLL_DATA));
+        cmd.assemble();
+        bench::doNotOptimize(cmd.back());
+    });
+
+    SpheroClientCommand reused(true, true);
+    reused.setDeviceId(DID_SPHERO);
+    reused.setCommandId(CMD_ROLL);
+    reused.setData(ROLL_DATA, sizeof(ROLL_DATA));
+    suite.run("send/assemble (reused buffer)", [&]() {
+        reused.clear();
+        reused.setSeqNum(seq++);
+        reused.assemble();
+        bench::doNotOptimize(reused.back());
+    });
+
+    SpheroClientCommand large(true, true);
+    vector<unsigned char> payload(253, 0x5A);
+    large.setData(payload.data(), payload.size());
+    suite.run("send/calculateChecksum (4 byte payload)", [&]() {
+        reused.setSeqNum(seq++);
+        bench::doNotOptimize(reused.calculateChecksum());
+    });
+    suite.run("send/calculateChecksum (253 byte payload)", [&]() {
+        large.setSeqNum(seq++);
+        bench::doNotOptimize(large.calculateChecksum());
+    });
+
+    suite.run("send/sendCommand path (generate+assemble)", [&]() {
+        auto msg = roll.generateCommandMessage<SpheroClientCommand>(seq++);
+        msg->setData(ROLL_DATA, sizeof(ROLL_DATA));
+        msg->assemble();
+        bench::doNotOptimize(msg->back());
+    });
+
+    // A swarm tick: a distinct Roll for each of 500 robots
+    const size_t robots = 500;
+    vector<unsigned char> speeds(robots), seqs(robots);
+    vector<unsigned short> headings(robots);
+    for (size_t i = 0; i < robots; ++i) {
+        speeds[i] = (unsigned char)i;
+        headings[i] = (unsigned short)(i % 360);
+    }
+    suite.run("send/500 rolls, one at a time", [&]() {
+        for (size_t i = 0; i < robots; ++i) {
+            auto msg = makeRollCommand(speeds[i], headings[i])
+                .generateCommandMessage<SpheroClientCommand>(seqs[i]++);
+            msg->assemble();
+            bench::doNotOptimize(msg->back());
+        }
+    });
+
+    vector<unsigned char> frames(robots * SpheroRollBatch::FRAME_SIZE);
+    suite.run("send/500 rolls, batch encodeFramesScalar", [&]() {
+        SpheroRollBatch::encodeFramesScalar(frames.data(), speeds.data(),
+            headings.data(), seqs.data(), nullptr, robots);
+        bench::doNotOptimize(frames.back());
+    });
+    suite.run("send/500 rolls, batch encodeFrames", [&]() {
+        SpheroRollBatch::encodeFrames(frames.data(), speeds.data(),
+            headings.data(), seqs.data(), nullptr, robots);
+        bench::doNotOptimize(frames.back());
+    });
+
+    SpheroRollBatch batch;
+    suite.run("send/500 rolls, SpheroRollBatch + frames", [&]() {
+        batch.encode(speeds.data(), headings.data(), seqs.data(), robots);
+        for (size_t i = 0; i < robots; ++i)
+            bench::doNotOptimize(batch.frame(i));
+    });
+
+}
+
+void receivePathBenchmarks(bench::Suite & suite) {
+    SpheroServerResponse response = locatorResponse();
+    suite.run("recv/parseFromInternalData", [&]() {
+        bench::doNotOptimize(response.parseFromInternalData().length());
+    });
+
+    {
+        bt::BtConnection<SpheroMessage>::RawData raw;
+        raw.fill(0);
+        std::copy(response.begin(), response.end(), raw.begin());
+        suite.run("recv/construct from RawData + parse", [&]() {
+            SpheroServerResponse fromRaw(raw);
+            fromRaw.parseFromInternalData();
+            bench::doNotOptimize(fromRaw.sequenceNum());
+        });
+    }
+
+    response.parseFromInternalData();
+    suite.run("recv/dataToNumerical<short>", [&]() {
+        bench::doNotOptimize(response.dataToNumerical<short>(2));
+    });
+    suite.run("recv/dataToNumerical<unsigned int>", [&]() {
+        bench::doNotOptimize(response.dataToNumerical<unsigned int>(4));
+    });
+    suite.run("recv/dataToString", [&]() {
+        bench::doNotOptimize(response.dataToString(0, 8).size());
+    });
+    suite.run("recv/messageResponseToString", [&]() {
+        bench::doNotOptimize(response.messageResponseToString().size());
+    });
+
+    SpheroFrameDecoder decoder;
+    suite.run("recv/SpheroFrameDecoder::feed", [&]() {
+        decoder.feed(response.data(), response.size(),
+            [](unsigned char const* frame, std::size_t len) {
+                bench::doNotOptimize(frame[len - 1]);
+            });
+    });
+
+    {
+        // IMU yaw, odometer and velocity, one sample per packet
+        SpheroPose pose;
+        pose.setStreamingMask(SpheroPose::STREAM_IMU_YAW,
+            SpheroStateCache::STREAM_ODOMETER_X | SpheroStateCache::STREAM_ODOMETER_Y |
+            SpheroStateCache::STREAM_VELOCITY_X | SpheroStateCache::STREAM_VELOCITY_Y);
+        unsigned char sample[10] = { 0x00, 0x2D, 0x00, 0x10, 0xFF, 0xF0, 0x01, 0xF4, 0x00, 0x00 };
+        auto at = std::chrono::steady_clock::now();
+        suite.run("recv/SpheroPose feed", [&]() {
+            at += std::chrono::microseconds(2500);
+            pose.feed(sample, sizeof(sample), at);
+        });
+        suite.run("recv/SpheroPose pose", [&]() {
+            bench::doNotOptimize(pose.pose().x);
+        });
+    }
+
+}
+
+/**
+ * Time from bytes hitting the socket until read() hands the parsed
+ * response to the consuming thread, using a loopback TCP peer in place
+ * of a robot.
+ */
+void handoffBenchmarks(bench::Suite & suite) {
+    const string name = "handoff/socket -> readQueue_ -> read()";
+    if (!suite.wants(name)) return;
+
+    boost::asio::io_service deviceIo;
+    tcp::acceptor acceptor(deviceIo,
+        tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    tcp::socket device(deviceIo);
+
+    bt::BtConnection<SpheroMessage> conn;
+    conn.setEndpoint(BluetoothProto::endpoint(acceptor.local_endpoint()));
+    conn.connect();
+    acceptor.accept(device);
+
+    SpheroServerResponse response = locatorResponse();
+    // Each round trip crosses threads, so enough of them to average out
+    // scheduler noise
+    suite.run(name, [&]() {
+        boost::asio::write(device,
+            boost::asio::buffer(response.data(), response.size()));
+        auto received = conn.read<SpheroServerResponse>();
+        bench::doNotOptimize(received);
+    }, bench::Options(std::chrono::milliseconds(200), 1000, 100000));
+
+    conn.close();
+}
+
+void loggerBenchmarks(bench::Suite & suite) {
+    suite.run("log/BtLogger line (as doSend)", []() {
+        BtLogger::log()
+            << "Successfully sent out 0x" << std::hex
+            << 10 << " bytes" << std::endl;
+    });
+    suite.run("log/BtLogger line (no flush)", []() {
+        BtLogger::log()
+            << "Successfully read 0x" << std::hex << 16 << " bytes.\n";
+    });
+
+    // 17 channels (IMU, accelerometer, gyro, quaternion, odometer,
+    // velocity) from each of 100 robots, one sample per packet
+    const string telemetryLog = "log/SpheroTelemetryLog feed (17 channels)";
+    if (!suite.wants(telemetryLog)) return;
+    {
+        const uint32_t mask1 = 0xE0000000 | 0x000E0000 | 0x00001C00;
+        const uint32_t mask2 = 0xF0000000 | 0x0D800000;
+        SpheroTelemetryLog log("btconn-bench.tlog");
+        vector<unsigned> sources;
+        for (int i = 0; i < 100; ++i)
+            sources.push_back(log.addSource(mask1, mask2));
+
+        vector<unsigned char> packet(34, 0x5A);
+        uint64_t n = 0;
+        auto at = std::chrono::steady_clock::now();
+        suite.run(telemetryLog, [&]() {
+            if (n % 100 == 0) at += std::chrono::microseconds(2500);
+            log.feed(sources[n++ % 100], packet.data(), packet.size(), at);
+        });
+    }
+    remove("btconn-bench.tlog");
+}
+
+void codecBenchmarks(bench::Suite & suite) {
+    // An accelerometer-like channel: a slow swing plus a few counts of
+    // noise, 4096 samples (8KB) per operation
+    const size_t count = 4096;
+    vector<short> values(count);
+    unsigned noise = 1;
+    for (size_t i = 0; i < count; ++i) {
+        noise = noise * 1103515245 + 12345;
+        values[i] = (short)(1000 * sin(i / 200.0) + (int)((noise >> 16) % 9) - 4);
+    }
+    vector<unsigned char> packed(SpheroDeltaCodec::maxEncodedSize(count));
+    vector<short> decoded(count);
+    size_t bytes = SpheroDeltaCodec::encode(values.data(), count, packed.data());
+
+    ostringstream ratio;
+    ratio << fixed << setprecision(1) << " (" << 2.0 * count / bytes << "x)";
+    suite.run("codec/SpheroDeltaCodec encode 8KB" + ratio.str(), [&]() {
+        bench::doNotOptimize(SpheroDeltaCodec::encode(values.data(), count, packed.data()));
+    });
+    suite.run("codec/SpheroDeltaCodec encodeScalar 8KB", [&]() {
+        bench::doNotOptimize(SpheroDeltaCodec::encodeScalar(values.data(), count, packed.data()));
+    });
+    suite.run("codec/SpheroDeltaCodec decode 8KB", [&]() {
+        size_t consumed = 0;
+        SpheroDeltaCodec::decode(packed.data(), bytes, decoded.data(), count, consumed);
+        bench::doNotOptimize(decoded[count - 1]);
+    });
+    suite.run("codec/SpheroDeltaCodec decodeScalar 8KB", [&]() {
+        size_t consumed = 0;
+        SpheroDeltaCodec::decodeScalar(packed.data(), bytes, decoded.data(), count, consumed);
+        bench::doNotOptimize(decoded[count - 1]);
+    });
+}
+
+}
+
+int main(int argc, char ** argv) {
+    string filter = (argc > 1) ? argv[1] : "";
+
+    bench::Suite suite(filter);
+    sendPathBenchmarks(suite);
+    receivePathBenchmarks(suite);
+    loggerBenchmarks(suite);
+    codecBenchmarks(suite);
+    handoffBenchmarks(suite);
+
+    bench::printHeader(cout);
+    for (auto const& result : suite.results())
+        bench::print(cout, result);
+
+    return 0;
+}
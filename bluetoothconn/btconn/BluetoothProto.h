@@ -40,6 +40,21 @@ struct BluetoothInqItem {
         address.port = 0;
         memcpy((void *)&address.serviceClassId, &RFCOMM_PROTOCOL_UUID, sizeof(GUID));
     }
+
+    /**
+     * A device whose RFCOMM channel is already known (e.g. from a
+     * BtDeviceCache); connecting to it skips the SDP service lookup.
+     * A channel of 0 falls back to the service lookup.
+     */
+    BluetoothInqItem(std::string const& n, BTH_ADDR btAddr, ULONG channel) {
+        name.assign(n);
+        memset(&address, 0, sizeof(SOCKADDR_BTH));
+        address.addressFamily = AF_BTH;
+        address.btAddr = btAddr;
+        address.port = channel;
+        if (channel == 0)
+            memcpy((void *)&address.serviceClassId, &RFCOMM_PROTOCOL_UUID, sizeof(GUID));
+    }
 };
 
 /**
@@ -62,9 +77,29 @@ public:
         return stream_protocol_;
     }
 
-#if defined(_WIN32)
+    typedef std::function<bool(BluetoothInqItem const&)> DeviceVisitor;
+
+    /**
+     * Synchronously perform a fresh inquiry and collect every device found.
+     */
     static void bluetoothInquire(std::vector<BluetoothInqItem> & vOut) {
         vOut.clear();
+        lookupDevices(true, [&vOut](BluetoothInqItem const& item) {
+            vOut.push_back(item);
+            return true;
+        });
+    }
+
+    /**
+     * Enumerate devices known to the OS, calling visit() for each one as
+     * it is returned, until visit() returns false or the list is exhausted.
+     *
+     * @param flushCache    Perform a fresh radio inquiry first (which blocks
+     *                      for the whole inquiry window) instead of only
+     *                      returning cached & remembered devices.
+     */
+#if defined(_WIN32)
+    static void lookupDevices(bool flushCache, DeviceVisitor visit) {
         const size_t QUERY_SET_COUNT = 4092;
         const size_t QUERY_SET_SIZE = QUERY_SET_COUNT * sizeof(WSAQUERYSETA);
 
@@ -80,7 +115,7 @@ public:
         result = WSALookupServiceBeginA(querySet,
                                         inqFlags
                                         | LUP_CONTAINERS
-                                        | LUP_FLUSHCACHE,
+                                        | (flushCache ? LUP_FLUSHCACHE : 0),
                                         &inqHandle);
         if (NO_ERROR == result && inqHandle) {
             do {
@@ -97,8 +132,8 @@ public:
                     PSOCKADDR_BTH sockAddr = reinterpret_cast<PSOCKADDR_BTH>(
                         querySet->lpcsaBuffer->RemoteAddr.lpSockaddr);
                     const char * name = querySet->lpszServiceInstanceName;
-                    vOut.push_back(
-                        BluetoothInqItem(name, sockAddr));
+                    if (!visit(BluetoothInqItem(name, sockAddr)))
+                        break;
                 }
             } while (NO_ERROR == result);
 
@@ -110,10 +145,132 @@ public:
 
 #elif defined(LINUX)
     // TODO: write a linux variant for bluetooth inquiry
-    static void bluetoothInquire(std::vector<BluetoothInqItem> & vOut) {
+    static void lookupDevices(bool flushCache, DeviceVisitor visit) {
     }
 
 #endif
 
 };
 
+/**
+ * What an asynchronous inquiry should report and when it should stop.
+ */
+struct BluetoothInquiryOptions {
+    std::string namePrefix;     // only report devices whose name starts with this
+    std::size_t maxResults;     // stop after this many reported devices (0 = no limit)
+    bool flushCache;            // also run a fresh radio inquiry for unseen devices
+
+    BluetoothInquiryOptions() :
+        maxResults(0), flushCache(true) {
+    }
+    explicit BluetoothInquiryOptions(std::string const& prefix,
+                                     std::size_t max = 0,
+                                     bool flush = true) :
+        namePrefix(prefix), maxResults(max), flushCache(flush) {
+    }
+};
+
+/**
+ * An asynchronous, incremental bluetooth inquiry.
+ *
+ * Devices already known to the OS are reported first, as fast as they can
+ * be enumerated; only then (and only if still needed) is a fresh radio
+ * inquiry run, reporting just the devices that weren't seen yet. The OS
+ * lookups block, so they run on a worker thread owned by this object, while
+ * every callback is posted to the given io_service (typically a connection's
+ * executor). The io_service is kept busy until the inquiry completes, so
+ * io.run() returns once onComplete has been called.
+ *
+ * Destroying the inquiry cancels it and waits for the worker to finish; keep
+ * the returned pointer alive until onComplete has been called.
+ */
+class BluetoothInquiry {
+public:
+    typedef std::function<bool(BluetoothInqItem const&)> DeviceHandler;
+    typedef std::function<void(std::size_t)> CompletionHandler;
+
+private:
+    struct State {
+        boost::asio::io_service & io;
+        BluetoothInquiryOptions options;
+        DeviceHandler onDevice;
+        CompletionHandler onComplete;
+        boost::atomic<bool> cancelled;
+        std::size_t reported;   // only touched on the io thread
+        std::unique_ptr<boost::asio::io_service::work> work;
+
+        State(boost::asio::io_service & ioService,
+              BluetoothInquiryOptions const& opts,
+              DeviceHandler const& deviceHandler,
+              CompletionHandler const& completionHandler) :
+            io(ioService), options(opts), onDevice(deviceHandler),
+            onComplete(completionHandler), cancelled(false), reported(0),
+            work(new boost::asio::io_service::work(ioService)) {
+        }
+    };
+
+    std::shared_ptr<State> state_;
+    std::thread worker_;
+
+    static void lookup(std::shared_ptr<State> state) {
+        std::vector<BTH_ADDR> seen;
+        auto visit = [&state, &seen](BluetoothInqItem const& item) {
+            if (state->cancelled.load()) return false;
+            if (std::find(seen.begin(), seen.end(), item.address.btAddr) != seen.end())
+                return true;
+            seen.push_back(item.address.btAddr);
+
+            if (item.name.compare(0, state->options.namePrefix.size(),
+                                  state->options.namePrefix) != 0)
+                return true;
+
+            state->io.post([state, item]() {
+                if (state->cancelled.load()) return;
+
+                ++state->reported;
+                bool more = state->onDevice(item);
+                if (!more || (state->options.maxResults > 0 &&
+                              state->reported >= state->options.maxResults))
+                    state->cancelled = true;
+            });
+            return true;
+        };
+
+        BluetoothProto::lookupDevices(false, visit);
+        if (state->options.flushCache && !state->cancelled.load())
+            BluetoothProto::lookupDevices(true, visit);
+
+        state->io.post([state]() {
+            if (state->onComplete) state->onComplete(state->reported);
+            state->work.reset();
+        });
+    }
+
+public:
+    BluetoothInquiry(boost::asio::io_service & io,
+                     BluetoothInquiryOptions const& options,
+                     DeviceHandler const& onDevice,
+                     CompletionHandler const& onComplete) :
+        state_(std::make_shared<State>(io, options, onDevice, onComplete)) {
+        std::shared_ptr<State> state = state_;
+        worker_ = std::thread([state]() { lookup(state); });
+    }
+
+    ~BluetoothInquiry() {
+        cancel();
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+    /**
+     * Stop reporting devices. An OS lookup already in progress still runs
+     * to completion, but nothing more is reported and onComplete follows.
+     */
+    void cancel() {
+        state_->cancelled = true;
+    }
+
+    bool cancelled() const {
+        return state_->cancelled.load();
+    }
+};
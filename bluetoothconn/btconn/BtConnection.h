@@ -19,10 +19,21 @@
 #pragma once
 
 #include "BluetoothProto.h"
+#include "BtThreadPolicy.h"
 #include "SpheroPacketTypes.h"
 
 namespace bt {
 
+/**
+ * The buffers BtConnection writes for a message. Message types that keep
+ * their bytes in several pieces can provide an overload of their own
+ * (found by argument-dependent lookup) returning a buffer sequence.
+ */
+template <class MSGTYPE>
+boost::asio::const_buffers_1 messageBuffers(MSGTYPE const& msg) {
+    return boost::asio::buffer((void const *)msg.data(), msg.length());
+}
+
 /**
  * Abstracts a persistent connection to a single bluetooth device.
  *
@@ -40,8 +51,20 @@ class BtConnection {
 public:
     typedef std::shared_ptr<MSGTYPE> MsgPtr;
     typedef std::array<unsigned char, 1024> RawData;
+    typedef std::function<bool(unsigned char const*, std::size_t)> ReadObserver;
+    typedef std::function<void(MsgPtr const&)> ReplaceObserver;
+
+    enum { NO_COALESCE = -1 };
 
 private:
+    struct Outgoing {
+        MsgPtr msg;
+        int coalesceKey;
+    };
+    struct Received {
+        RawData data;
+        std::size_t length;
+    };
 
     volatile bool connected_;
     volatile bool shutdown_;
@@ -51,11 +74,19 @@ private:
     BluetoothProto::socket socket_;
     BluetoothProto::endpoint endpoint_;
 
-    std::deque<MsgPtr> messageQueue_;
-    std::deque<RawData> readQueue_;
+    std::deque<Outgoing> messageQueue_;
+    boost::atomic<uint64_t> coalesced_;
+    std::deque<Received> readQueue_;
+    std::size_t readQueueLimit_;
+    uint64_t readQueueDropped_;
     RawData recv_buffer_;
     std::thread iothread_;
     std::mutex readQueueMutex;
+    std::condition_variable readQueueCond_;
+    ReadObserver readObserver_;
+    ReplaceObserver replaceObserver_;
+    int sendBufferSize_;
+    BtThreadPolicy threadPolicy_;
 
 public:
     /**
@@ -63,7 +94,8 @@ public:
      * bluetooth communications.
      */
     BtConnection() :
-        connected_(false), shutdown_(false), socket_(io_) {
+        connected_(false), shutdown_(false), socket_(io_), coalesced_(0),
+        readQueueLimit_(0), readQueueDropped_(0), sendBufferSize_(0) {
         socket_.open(proto_.streamProtocol());
         recv_buffer_.fill('\0');
     }
@@ -73,7 +105,8 @@ public:
      * communications to the specified bluetooth device.
      */
     BtConnection(const SOCKADDR_BTH & socket_address) :
-        connected_(false), shutdown_(false), socket_(io_) {
+        connected_(false), shutdown_(false), socket_(io_), coalesced_(0),
+        readQueueLimit_(0), readQueueDropped_(0), sendBufferSize_(0) {
         socket_.open(proto_.streamProtocol());
         recv_buffer_.fill('\0');
 
@@ -93,15 +126,28 @@ public:
      * Connect to the already-provided device.
      */
     void connect() {
+        if (sendBufferSize_ > 0) {
+            socket_.set_option(
+                boost::asio::socket_base::send_buffer_size(sendBufferSize_));
+        }
         socket_.connect(endpoint_);
         connected_ = true;
 
         readAsync();
-        iothread_ = std::thread([this]() { io_.run(); });
+        iothread_ = std::thread([this]() {
+            if (!threadPolicy_.empty()) threadPolicy_.apply();
+            io_.run();
+        });
     }
 
     void close() {
         shutdown_ = true;
+        {
+            // Wake up blocked readers so they can see shutdown_
+            std::lock_guard<std::mutex> readQueueLock(readQueueMutex);
+        }
+        readQueueCond_.notify_all();
+
         if (socket_.is_open()) {
             io_.post([this]() {
                 socket_.close();
@@ -111,8 +157,9 @@ public:
     }
 
     /**
-     * Read incomming data of a specific type from the input queue.
-     * This method blocks until data is available.
+     * Read incomming data of a specific type from the input queue,
+     * oldest first. This method blocks until data is available, and
+     * returns null if the connection shuts down while waiting.
      *
      * @note This method expects that the current state of this
      *       object has an active connection, otherwise an exception
@@ -123,34 +170,161 @@ public:
         if (!connected_)
             throw NotConnectedException("Unable to perform a read - Not connected");
 
-        while (readQueue_.empty())
-            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        std::unique_lock<std::mutex> readQueueLock(readQueueMutex);
+        readQueueCond_.wait(readQueueLock,
+            [this]() { return !readQueue_.empty() || shutdown_; });
+        if (readQueue_.empty()) return nullptr;
 
-        std::lock_guard<std::mutex> readQueueLock(readQueueMutex);
-        auto ret = std::shared_ptr<T>(new T(readQueue_.back()));
-        readQueue_.pop_back();
+        Received const& front = readQueue_.front();
+        auto ret = std::shared_ptr<T>(new T(front.data.data(), front.length));
+        readQueue_.pop_front();
+
+        return (ret);
+    }
+
+    /**
+     * Read the oldest queued data for which
+     * pred(unsigned char const* data, std::size_t len) holds, leaving
+     * everything else queued. Waits at most timeout for it to arrive;
+     * returns null on timeout or shutdown.
+     */
+    template <class T=MSGTYPE, class Predicate>
+    std::shared_ptr<T> readIf(Predicate pred, std::chrono::milliseconds timeout) {
+        if (!connected_)
+            throw NotConnectedException("Unable to perform a read - Not connected");
+
+        auto matches = [&pred](Received const& received) {
+            return pred(received.data.data(), received.length);
+        };
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        std::unique_lock<std::mutex> readQueueLock(readQueueMutex);
+        for (;;) {
+            auto it = std::find_if(readQueue_.begin(), readQueue_.end(), matches);
+            if (it != readQueue_.end()) {
+                auto ret = std::shared_ptr<T>(new T(it->data.data(), it->length));
+                readQueue_.erase(it);
+                return (ret);
+            }
+            if (shutdown_ ||
+                readQueueCond_.wait_until(readQueueLock, deadline) == std::cv_status::timeout)
+                break;
+        }
 
+        // One last look, for data that arrived right at the deadline
+        auto it = std::find_if(readQueue_.begin(), readQueue_.end(), matches);
+        if (it == readQueue_.end()) return nullptr;
+        auto ret = std::shared_ptr<T>(new T(it->data.data(), it->length));
+        readQueue_.erase(it);
         return (ret);
     }
 
+    /**
+     * Queue one complete message for read(), e.g. from a read observer
+     * that splits chunks into messages itself.
+     */
+    void queue(unsigned char const* data, std::size_t len) {
+        std::unique_lock<std::mutex> readQueueLock(readQueueMutex);
+        if (readQueueLimit_ != 0 && readQueue_.size() >= readQueueLimit_) {
+            // Nobody is reading, keep the newest
+            readQueue_.pop_front();
+            ++readQueueDropped_;
+        }
+        readQueue_.push_back(Received());
+        Received & received = readQueue_.back();
+        received.length = (std::min)(len, received.data.size());
+        std::copy(data, data + received.length, received.data.begin());
+        readQueueLock.unlock();
+        readQueueCond_.notify_all();
+    }
+
     /**
      * Send a message to the connected device.
      *
+     * Messages sent with the same coalesceKey (other than NO_COALESCE)
+     * replace each other while queued: if one is still waiting to be
+     * written when the next arrives, the newer message takes its place
+     * in the queue and the older one is never sent; the replace
+     * observer is then handed the older one.
+     *
      * @note This method expects that the current state of this
      *       object has an active connection, otherwise an exception
      *       is thrown.
      */
-    void send(MsgPtr msg) {
+    void send(MsgPtr msg, int coalesceKey = NO_COALESCE) {
         if (!connected_)
             throw NotConnectedException("Unable to perform a write - Not connected");
 
-        io_.post([this, msg]() {
+        io_.post([this, msg, coalesceKey]() {
+            if (coalesceKey != NO_COALESCE && messageQueue_.size() > 1) {
+                // The front message is being written, leave it alone
+                for (auto it = messageQueue_.begin() + 1; it != messageQueue_.end(); ++it) {
+                    if (it->coalesceKey == coalesceKey) {
+                        MsgPtr replaced = it->msg;
+                        it->msg = msg;
+                        coalesced_.fetch_add(1, boost::memory_order_relaxed);
+                        if (replaceObserver_) replaceObserver_(replaced);
+                        return;
+                    }
+                }
+            }
+
             bool qEmpty = messageQueue_.empty();
-            messageQueue_.push_back(msg);
+            Outgoing outgoing = { msg, coalesceKey };
+            messageQueue_.push_back(outgoing);
             if (qEmpty) doSend();
         });
     }
 
+    /**
+     * Messages waiting for read().
+     */
+    std::size_t queued() {
+        std::lock_guard<std::mutex> readQueueLock(readQueueMutex);
+        return readQueue_.size();
+    }
+
+    /**
+     * Keep at most limit messages for read() (0 = no limit); beyond
+     * that the oldest is dropped, so a client that never reads doesn't
+     * grow the queue for the life of the connection.
+     */
+    void setReadQueueLimit(std::size_t limit) {
+        std::lock_guard<std::mutex> readQueueLock(readQueueMutex);
+        readQueueLimit_ = limit;
+    }
+
+    /**
+     * Messages dropped from a full read queue.
+     */
+    uint64_t readQueueDropped() {
+        std::lock_guard<std::mutex> readQueueLock(readQueueMutex);
+        return readQueueDropped_;
+    }
+
+    /**
+     * Messages replaced by a newer one before being written.
+     */
+    uint64_t coalescedCount() const {
+        return coalesced_.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * The address of the connected peer. For a bluetooth device this
+     * holds the SOCKADDR_BTH actually connected to, including the RFCOMM
+     * channel resolved by the service lookup.
+     */
+    BluetoothProto::endpoint remoteEndpoint() const {
+        return socket_.remote_endpoint();
+    }
+
+    /**
+     * The executor on which this connection's reads, writes and
+     * callbacks run.
+     */
+    boost::asio::io_service & ioService() {
+        return io_;
+    }
+
     bool isConnected() const {
         return connected_;
     }
@@ -161,6 +335,45 @@ public:
         shutdown_ = true;
     }
 
+    /**
+     * Limit how many bytes the OS may hold for this socket once a write
+     * has completed (0 keeps the system default). A small buffer keeps
+     * messages in the send queue, where coalescing can still replace
+     * them, instead of in the stack. Takes effect on connect().
+     */
+    void setSendBufferSize(int bytes) {
+        sendBufferSize_ = bytes;
+    }
+
+    /**
+     * Pin and prioritize the io thread. Takes effect on connect(); a
+     * policy that can't be applied is logged and otherwise ignored.
+     */
+    void setThreadPolicy(BtThreadPolicy const& policy) {
+        threadPolicy_ = policy;
+    }
+
+    /**
+     * Install a callback that sees every chunk of bytes read from the
+     * device, on the io thread, before it is queued up for read().
+     * Returning true means it fully handled the chunk, which is then not
+     * queued; it can queue() the messages in it one by one instead. The
+     * observer must be installed before connect() is called.
+     */
+    void setReadObserver(ReadObserver observer) {
+        readObserver_ = observer;
+    }
+
+    /**
+     * Install a callback that is handed every message replaced by a
+     * newer one with the same coalesceKey, on the io thread. Such a
+     * message never reaches the device. The observer must be installed
+     * before connect() is called.
+     */
+    void setReplaceObserver(ReplaceObserver observer) {
+        replaceObserver_ = observer;
+    }
+
     /**
      * Use a copy of the socket address to the bluetooth device
      * as the communications endpoint.
@@ -171,12 +384,21 @@ public:
             sizeof(SOCKADDR_BTH));
     }
 
+    /**
+     * Use an arbitrary stream endpoint (e.g. a loopback TCP stand-in
+     * for a device). The socket is reopened to match the endpoint's
+     * protocol, so this must be called before connect().
+     */
+    void setEndpoint(BluetoothProto::endpoint const& endpoint) {
+        if (socket_.is_open()) socket_.close();
+        socket_.open(endpoint.protocol());
+        endpoint_ = endpoint;
+    }
+
 private:
 
     void doSend() {
-        auto buf = boost::asio::buffer(
-            (void *)messageQueue_.front()->data(),
-            messageQueue_.front()->length());
+        auto buf = messageBuffers(*messageQueue_.front().msg);
 
         async_write(socket_, buf,
             [this](boost::system::error_code ec, size_t bytes) {
@@ -224,22 +446,19 @@ private:
     }
 
     void readHandler(size_t len) {
-        std::lock_guard<std::mutex> readQueueLock(readQueueMutex);
-        readQueue_.push_back(RawData()); // Allocate array and assign to end of readQueue
-
-        readQueue_.back().fill((const unsigned char)'\0');
+        if (readObserver_ && readObserver_(recv_buffer_.data(), len)) {
+            recv_buffer_.fill('\0');
+            if (!shutdown_) readAsync();
+            return;
+        }
 
         // TODO: 0xff reading is probably too sphero-specific and should be moved.
 
         // 0xff marks the beginning of a message...
-        auto beginning = recv_buffer_.begin();
         size_t offset = 0;
-        while ((*beginning) != 0xff && beginning != recv_buffer_.end()) {
-            ++beginning; ++offset;
-        }
-
-        std::copy(beginning, beginning + (len - offset),
-                  readQueue_.back().begin());
+        while (offset < len && recv_buffer_[offset] != 0xff)
+            ++offset;
+        if (offset < len) queue(recv_buffer_.data() + offset, len - offset);
 
         recv_buffer_.fill('\0');
         if (!shutdown_) readAsync();
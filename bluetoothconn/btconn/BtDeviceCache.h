@@ -0,0 +1,112 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * A small on-disk cache of known devices: name, address, RFCOMM channel
+ * and when the device was last seen.
+ *
+ * Consult it before running an inquiry; cached devices with a known
+ * channel can be connected to straight away, skipping both the inquiry
+ * and the SDP service lookup. The cache can revalidate itself in the
+ * background with an asynchronous inquiry. All methods are thread-safe.
+ */
+class BtDeviceCache {
+public:
+    struct Entry {
+        std::string name;
+        BTH_ADDR address;
+        ULONG channel;          // 0 when not yet known
+        std::time_t lastSeen;
+
+        BluetoothInqItem item() const {
+            return BluetoothInqItem(name, address, channel);
+        }
+    };
+
+private:
+    std::string path_;
+    std::vector<Entry> entries_;
+    mutable std::mutex mutex_;
+
+    Entry & findOrAdd(BTH_ADDR address);
+
+public:
+    explicit BtDeviceCache(std::string const& path = "btconn-devices.cache");
+
+    /**
+     * Read the cache file, replacing the in-memory entries.
+     * Returns false if the file doesn't exist or can't be read.
+     */
+    bool load();
+
+    /**
+     * Write all entries to the cache file. The file is replaced
+     * atomically, so a crash mid-write leaves the old cache intact.
+     */
+    bool save() const;
+
+    /**
+     * Cached devices whose name starts with prefix, most recently
+     * seen first, ready to be connected to.
+     */
+    std::vector<BluetoothInqItem> devices(std::string const& prefix = "") const;
+
+    bool lookup(BTH_ADDR address, Entry & out) const;
+    std::vector<Entry> entries() const;
+
+    /**
+     * Record a device returned by an inquiry. Any known channel is kept.
+     */
+    void remember(BluetoothInqItem const& item);
+
+    /**
+     * Record a device that was just connected to, including the RFCOMM
+     * channel the connection resolved.
+     */
+    void remember(std::string const& name, BluetoothProto::endpoint const& connected);
+
+    template <class MSGTYPE>
+    void remember(std::string const& name, bt::BtConnection<MSGTYPE> const& connection) {
+        remember(name, connection.remoteEndpoint());
+    }
+
+    /**
+     * Drop a stale channel (e.g. after connecting to it failed), so the
+     * next connection goes through the service lookup again.
+     */
+    void invalidateChannel(BTH_ADDR address);
+
+    void forget(BTH_ADDR address);
+
+    /**
+     * Remove entries not seen for longer than maxAge.
+     */
+    void prune(std::chrono::seconds maxAge);
+
+    /**
+     * Refresh last-seen times (and pick up new devices) with a background
+     * inquiry whose callbacks run on io. onComplete is called with the
+     * number of devices seen; save() is left to the caller.
+     */
+    std::shared_ptr<BluetoothInquiry> revalidate(
+        boost::asio::io_service & io,
+        BluetoothInquiryOptions const& options,
+        BluetoothInquiry::CompletionHandler onComplete = nullptr);
+};
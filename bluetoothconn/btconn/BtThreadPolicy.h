@@ -0,0 +1,61 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Where, and how urgently, a latency sensitive thread runs: the io
+ * thread of a connection (see SpheroConnectOptions::ioThread), or any
+ * thread of the application's that drives robots.
+ *
+ * Without one, a busy host (a vision pipeline, a video encoder) can
+ * keep the io thread off the CPU for milliseconds at a time, which
+ * shows up directly in command latency.
+ */
+struct BtThreadPolicy {
+    std::vector<unsigned> cpus;     // cores the thread may run on, empty = any
+
+    /**
+     * Run ahead of every normal thread: SCHED_FIFO at priority on Linux,
+     * THREAD_PRIORITY_TIME_CRITICAL on Windows. Needs CAP_SYS_NICE (or
+     * an rtprio limit) on Linux. A realtime thread that spins starves
+     * the rest of its core, so keep whatever runs on it short.
+     */
+    bool realtime;
+    int priority;                   // SCHED_FIFO priority, 1 to 99
+
+    /**
+     * Lock the whole process in memory, current and future pages, so
+     * the thread never waits on a page fault. Linux only.
+     */
+    bool lockMemory;
+
+    BtThreadPolicy() :
+        realtime(false), priority(10), lockMemory(false) {
+    }
+
+    bool empty() const {
+        return cpus.empty() && !realtime && !lockMemory;
+    }
+
+    /**
+     * Apply to the calling thread. Every part is attempted; returns false
+     * (and logs why) if any was refused, e.g. for lack of privileges.
+     */
+    bool apply() const;
+};
@@ -0,0 +1,203 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * A fixed-size, high-dynamic-range histogram of latencies (in microseconds).
+ *
+ * Values below SUB_BUCKETS are counted exactly; above that, every power-of-two
+ * range is split into SUB_BUCKETS linear buckets, so any recorded value is
+ * reported within 1/SUB_BUCKETS (~3%) of its real value up to 2^MAX_EXPONENT
+ * microseconds (~67 seconds). Larger values are clamped into the last bucket.
+ *
+ * record() is a handful of relaxed atomic operations on preallocated
+ * counters: it never allocates or locks and may be called from the io thread.
+ */
+class LatencyHistogram {
+public:
+    static const unsigned SUB_BUCKET_BITS = 5;
+    static const unsigned SUB_BUCKETS = 1U << SUB_BUCKET_BITS;
+    static const unsigned MAX_EXPONENT = 26;
+    static const unsigned BUCKET_COUNT =
+        SUB_BUCKETS + (MAX_EXPONENT - SUB_BUCKET_BITS) * SUB_BUCKETS;
+
+    /**
+     * A plain, non-atomic copy of a histogram's contents. Snapshots
+     * from different histograms (or connections) can be merged.
+     */
+    class Snapshot {
+        std::array<uint64_t, BUCKET_COUNT> counts_;
+        uint64_t count_;
+        uint64_t sum_;
+        uint64_t min_;
+        uint64_t max_;
+
+        friend class LatencyHistogram;
+
+    public:
+        Snapshot() : count_(0), sum_(0),
+            min_(std::numeric_limits<uint64_t>::max()), max_(0) {
+            counts_.fill(0);
+        }
+
+        uint64_t count() const {
+            return count_;
+        }
+        uint64_t min() const {
+            return count_ ? min_ : 0;
+        }
+        uint64_t max() const {
+            return max_;
+        }
+        double mean() const {
+            return count_ ? (double)sum_ / (double)count_ : 0.0;
+        }
+
+        /**
+         * The value (in microseconds) at or below which the given
+         * percentage of recorded samples fall, e.g. percentile(99.9).
+         */
+        uint64_t percentile(double pct) const {
+            if (count_ == 0) return 0;
+            if (pct >= 100.0) return max_;
+
+            uint64_t target = (uint64_t)((pct / 100.0) * (double)count_ + 0.5);
+            if (target == 0) target = 1;
+
+            uint64_t seen = 0;
+            for (unsigned i = 0; i < BUCKET_COUNT; ++i) {
+                seen += counts_[i];
+                if (seen >= target)
+                    return (std::min)(bucketUpperBound(i), max_);
+            }
+            return max_;
+        }
+
+        void merge(Snapshot const& other) {
+            for (unsigned i = 0; i < BUCKET_COUNT; ++i)
+                counts_[i] += other.counts_[i];
+            count_ += other.count_;
+            sum_ += other.sum_;
+            if (other.count_ && other.min_ < min_) min_ = other.min_;
+            if (other.max_ > max_) max_ = other.max_;
+        }
+    };
+
+private:
+    boost::atomic<uint32_t> counts_[BUCKET_COUNT];
+    boost::atomic<uint64_t> count_;
+    boost::atomic<uint64_t> sum_;
+    boost::atomic<uint64_t> min_;
+    boost::atomic<uint64_t> max_;
+
+    static unsigned highestBit(uint64_t value) {
+#if defined(_MSC_VER) && defined(_WIN64)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return (unsigned)index;
+#elif defined(__GNUC__)
+        return 63U - (unsigned)__builtin_clzll(value);
+#else
+        unsigned index = 0;
+        while (value >>= 1) ++index;
+        return index;
+#endif
+    }
+
+public:
+    LatencyHistogram() {
+        reset();
+    }
+
+    static unsigned bucketIndex(uint64_t value) {
+        if (value < SUB_BUCKETS) return (unsigned)value;
+
+        unsigned exponent = highestBit(value);
+        if (exponent >= MAX_EXPONENT) return BUCKET_COUNT - 1;
+
+        unsigned shift = exponent - SUB_BUCKET_BITS;
+        unsigned sub = (unsigned)(value >> shift) - SUB_BUCKETS;
+        return SUB_BUCKETS + shift * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t bucketUpperBound(unsigned index) {
+        if (index < SUB_BUCKETS) return index;
+
+        unsigned shift = (index - SUB_BUCKETS) / SUB_BUCKETS;
+        unsigned sub = (index - SUB_BUCKETS) % SUB_BUCKETS;
+        uint64_t lower = (uint64_t)(SUB_BUCKETS + sub) << shift;
+        return lower + ((uint64_t)1 << shift) - 1;
+    }
+
+    void record(uint64_t micros) {
+        counts_[bucketIndex(micros)].fetch_add(1, boost::memory_order_relaxed);
+        count_.fetch_add(1, boost::memory_order_relaxed);
+        sum_.fetch_add(micros, boost::memory_order_relaxed);
+
+        uint64_t seen = min_.load(boost::memory_order_relaxed);
+        while (micros < seen &&
+               !min_.compare_exchange_weak(seen, micros, boost::memory_order_relaxed)) {
+        }
+        seen = max_.load(boost::memory_order_relaxed);
+        while (micros > seen &&
+               !max_.compare_exchange_weak(seen, micros, boost::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * Copy out the current contents. Concurrent record() calls may or
+     * may not be reflected, but none are lost from the histogram.
+     */
+    Snapshot snapshot() const {
+        Snapshot ret;
+        for (unsigned i = 0; i < BUCKET_COUNT; ++i)
+            ret.counts_[i] = counts_[i].load(boost::memory_order_relaxed);
+        ret.count_ = count_.load(boost::memory_order_relaxed);
+        ret.sum_ = sum_.load(boost::memory_order_relaxed);
+        ret.min_ = min_.load(boost::memory_order_relaxed);
+        ret.max_ = max_.load(boost::memory_order_relaxed);
+        return ret;
+    }
+
+    /**
+     * Copy out the current contents and start over from zero. Each
+     * counter is exchanged atomically, so a sample recorded concurrently
+     * lands in either this snapshot or the next one.
+     */
+    Snapshot snapshotAndReset() {
+        Snapshot ret;
+        for (unsigned i = 0; i < BUCKET_COUNT; ++i)
+            ret.counts_[i] = counts_[i].exchange(0, boost::memory_order_relaxed);
+        ret.count_ = count_.exchange(0, boost::memory_order_relaxed);
+        ret.sum_ = sum_.exchange(0, boost::memory_order_relaxed);
+        ret.min_ = min_.exchange(std::numeric_limits<uint64_t>::max(),
+                                 boost::memory_order_relaxed);
+        ret.max_ = max_.exchange(0, boost::memory_order_relaxed);
+        return ret;
+    }
+
+    void reset() {
+        for (unsigned i = 0; i < BUCKET_COUNT; ++i)
+            counts_[i].store(0, boost::memory_order_relaxed);
+        count_.store(0, boost::memory_order_relaxed);
+        sum_.store(0, boost::memory_order_relaxed);
+        min_.store(std::numeric_limits<uint64_t>::max(), boost::memory_order_relaxed);
+        max_.store(0, boost::memory_order_relaxed);
+    }
+};
@@ -97,13 +97,53 @@ enum MessageResponseCodes {
     ORBOTIX_RSP_CODE_MSG_TIMEOUT = 0x35,  // Msg state machine timed out
 };
 
+enum AsyncIdCode {
+    ASYNC_POWER_NOTIFY = 0x01,          // Power state changed
+    ASYNC_L1_DIAGS = 0x02,              // Level 1 diagnostic response
+    ASYNC_SENSOR_DATA = 0x03,           // Sensor data streaming
+    ASYNC_CONFIG_BLOCK = 0x04,          // Config block contents
+    ASYNC_PRE_SLEEP = 0x05,             // Pre-sleep warning (10 sec)
+    ASYNC_MACRO_MARKERS = 0x06,         // Macro markers
+    ASYNC_COLLISION = 0x07,             // Collision detected
+    ASYNC_ORBBAS_PRINT = 0x08,          // orbBasic PRINT message
+    ASYNC_ORBBAS_ERROR_ASCII = 0x09,    // orbBasic error message, ASCII
+    ASYNC_ORBBAS_ERROR_BINARY = 0x0A,   // orbBasic error message, binary
+    ASYNC_SELF_LEVEL = 0x0B,            // Self level result
+    ASYNC_GYRO_LIMITS = 0x0C,           // Gyro axis limit exceeded
+};
+
+enum PowerState {
+    POWER_STATE_CHARGING = 0x01,        // On the charger
+    POWER_STATE_OK = 0x02,              // Battery OK
+    POWER_STATE_LOW = 0x03,             // Battery low
+    POWER_STATE_CRITICAL = 0x04,        // Battery critical, about to sleep
+};
+
 class SpheroMessage;
 
+enum {
+    SPHERO_COMMAND_SLOTS = 49 // 48 known commands + 1 shared "unknown" slot
+};
+
+/**
+ * Maps a (DID, CID) pair onto a dense index in [0, SPHERO_COMMAND_SLOTS)
+ * so that per-command tables don't need to span the whole 16-bit space.
+ * Commands that aren't listed in SpheroCommandSlots share the last slot.
+ */
+unsigned spheroCommandSlot(unsigned char did, unsigned char cid);
+
+/**
+ * A printable name for the command occupying a slot returned by
+ * spheroCommandSlot().
+ */
+const char * spheroCommandName(unsigned slot);
+
 template<unsigned char DID, unsigned char CID>
 class SpheroCommand {
     std::string description;
     unsigned char did_;
     unsigned char cid_;
+    std::vector<unsigned char> data_;
 
 public:
     SpheroCommand() :
@@ -111,6 +151,15 @@ public:
         cid_(CID) {
     }
 
+    /**
+     * A command carrying a data segment (e.g. speed & heading for a Roll).
+     */
+    SpheroCommand(std::initializer_list<unsigned char> data) :
+        did_(DID),
+        cid_(CID),
+        data_(data) {
+    }
+
     unsigned char did() {
         return did_;
     }
@@ -118,12 +167,26 @@ public:
         return cid_;
     }
 
+    std::vector<unsigned char> const& data() const {
+        return data_;
+    }
+    void setData(unsigned char const* data, size_t data_len) {
+        data_.assign(data, data + data_len);
+    }
+
+    static unsigned slot() {
+        static const unsigned slot_ = spheroCommandSlot(DID, CID);
+        return slot_;
+    }
+
     template <class T = SpheroMessage>
     std::shared_ptr<T> generateCommandMessage(unsigned char seq) {
         std::shared_ptr<T> ret(new T(true, true));
         ret->setDeviceId(did());
         ret->setCommandId(cid());
         ret->setSeqNum(seq);
+        if (!data_.empty())
+            ret->setData(const_cast<unsigned char *>(data_.data()), data_.size());
         return ret;
     }
 };
@@ -179,3 +242,62 @@ typedef SpheroCommand<DID_SPHERO, CMD_EXEC_ORBBAS> ExecOrbbasCommand;
 typedef SpheroCommand<DID_SPHERO, CMD_ABORT_ORBBAS> AbortOrbbasCommand;
 typedef SpheroCommand<DID_SPHERO, CMD_ANSWER_INPUT> AnswerInputCommand;
 
+/**
+ * Roll at speed (0-255) towards heading (0-359 degrees).
+ * A state of 0 stops the robot in place.
+ */
+inline RollCommand makeRollCommand(unsigned char speed,
+                                   unsigned short heading,
+                                   unsigned char state = 1) {
+    return RollCommand({
+        speed,
+        (unsigned char)(heading >> 8),
+        (unsigned char)(heading & 0xFF),
+        state
+    });
+}
+
+/**
+ * Set the main LED color; persist saves it as the user LED color.
+ */
+inline SetRGBCommand makeSetRGBCommand(unsigned char red,
+                                       unsigned char green,
+                                       unsigned char blue,
+                                       bool persist = false) {
+    return SetRGBCommand({ red, green, blue, (unsigned char)(persist ? 1 : 0) });
+}
+
+
+/**
+ * Have the robot report collisions as ASYNC_COLLISION messages. A hit is
+ * reported when the impact along an axis exceeds its threshold plus its
+ * speed factor scaled by the current speed. deadTime (in 10ms units) is
+ * the quiet period after each report. Thresholds of 0 turn detection off.
+ */
+inline SetCollisionDetectionCommand makeSetCollisionDetectionCommand(
+        unsigned char xThreshold, unsigned char xSpeed,
+        unsigned char yThreshold, unsigned char ySpeed,
+        unsigned char deadTime = 10) {
+    unsigned char method = (xThreshold == 0 && yThreshold == 0) ? 0 : 1;
+    return SetCollisionDetectionCommand({
+        method, xThreshold, xSpeed, yThreshold, ySpeed, deadTime
+    });
+}
+
+/**
+ * Turn ASYNC_POWER_NOTIFY messages on battery state changes on or off.
+ */
+inline SetPowerNotifyCommand makeSetPowerNotifyCommand(bool enable) {
+    return SetPowerNotifyCommand({ (unsigned char)(enable ? 1 : 0) });
+}
+
+/**
+ * Put the robot to sleep after seconds (60 or more) without receiving a
+ * command that has the reset timeout bit of SOP2 set.
+ */
+inline SetInactiveTimerCommand makeSetInactiveTimerCommand(unsigned short seconds) {
+    return SetInactiveTimerCommand({
+        (unsigned char)(seconds >> 8),
+        (unsigned char)(seconds & 0xFF)
+    });
+}
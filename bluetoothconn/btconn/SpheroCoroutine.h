@@ -0,0 +1,167 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Coroutine support, for compilers with C++20 coroutines enabled.
+ *
+ * A robot session can be written as straight-line code while no thread
+ * blocks on it:
+ *
+ *     SpheroTask session(SpheroHandler & robot) {
+ *         co_await robot.send(PingCommand());
+ *         auto version = co_await robot.send(VersionCommand());
+ *         co_await robot.send(makeSetRGBCommand(0, 0xFF, 0));
+ *     }
+ *
+ * Each co_await resumes on the robot's io thread when the response with
+ * the matching SEQ arrives, so many sessions share a few threads. Keep
+ * the work between awaits short; it holds up that robot's reads.
+ */
+#if defined(__cpp_impl_coroutine)
+
+/**
+ * What co_await robot.send(cmd) waits on. Resumes with the response,
+ * which may carry an error code of its own (see messageResponse());
+ * throws boost::system::system_error if none arrived in time (after the
+ * retries allowed by the command's SpheroRetryPolicy) and
+ * NotConnectedException if the robot isn't connected.
+ */
+class SpheroResponseAwaitable {
+    SpheroHandler & robot_;
+    SpheroSharedFramePtr frame_;
+    std::chrono::milliseconds timeout_;
+    boost::system::error_code ec_;
+    SpheroResponsePtr response_;
+
+public:
+    SpheroResponseAwaitable(SpheroHandler & robot, SpheroSharedFramePtr const& frame,
+                            std::chrono::milliseconds timeout) :
+        robot_(robot), frame_(frame), timeout_(timeout) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<> caller) {
+        robot_.sendAsync(frame_,
+            [this, caller](boost::system::error_code const& ec, SpheroResponsePtr response) {
+                ec_ = ec;
+                response_ = response;
+                caller.resume();
+            }, timeout_);
+    }
+    SpheroResponsePtr await_resume() {
+        if (ec_) throw boost::system::system_error(ec_);
+        return response_;
+    }
+};
+
+template <unsigned char DID, unsigned char CID>
+SpheroResponseAwaitable SpheroHandler::send(SpheroCommand<DID, CID> const& cmd,
+                                            std::chrono::milliseconds timeout) {
+    return SpheroResponseAwaitable(*this, SpheroSharedFrame::encode(cmd), timeout);
+}
+
+/**
+ * A running robot session. It starts as soon as it is called and runs
+ * on its own; the SpheroTask can be awaited by another session, waited
+ * for from a plain thread, or dropped.
+ */
+class SpheroTask {
+    struct State {
+        std::mutex mutex;
+        std::condition_variable finished;
+        bool done;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        State() : done(false) {
+        }
+
+        void finish(std::exception_ptr e) {
+            std::coroutine_handle<> next;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done = true;
+                error = e;
+                next = continuation;
+            }
+            finished.notify_all();
+            if (next) next.resume();
+        }
+    };
+
+    std::shared_ptr<State> state_;
+
+    explicit SpheroTask(std::shared_ptr<State> const& state) :
+        state_(state) {
+    }
+
+public:
+    struct promise_type {
+        std::shared_ptr<State> state = std::make_shared<State>();
+
+        SpheroTask get_return_object() {
+            return SpheroTask(state);
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {
+            state->finish(nullptr);
+        }
+        void unhandled_exception() {
+            state->finish(std::current_exception());
+        }
+    };
+
+    bool done() const {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->done;
+    }
+
+    /**
+     * Block until the session ends, rethrowing what ended it. Not for
+     * use on an io thread.
+     */
+    void get() const {
+        std::unique_lock<std::mutex> lock(state_->mutex);
+        state_->finished.wait(lock, [this]() { return state_->done; });
+        if (state_->error) std::rethrow_exception(state_->error);
+    }
+
+    bool await_ready() const {
+        return done();
+    }
+    bool await_suspend(std::coroutine_handle<> caller) {
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (state_->done) return false;
+        state_->continuation = caller;
+        return true;
+    }
+    void await_resume() const {
+        if (state_->error) std::rethrow_exception(state_->error);
+    }
+};
+
+#endif
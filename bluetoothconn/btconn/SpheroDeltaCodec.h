@@ -0,0 +1,68 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Lossless compression for streams of 16 bit samples, such as a sensor
+ * channel or the words of a timestamp.
+ *
+ * Each value is replaced by its difference from the one before it,
+ * zigzag-mapped so small negative differences become small numbers, and
+ * every BLOCK_VALUES of those are bit-packed at the width of the largest.
+ * Slowly changing channels shrink to a few bits per sample; a block of
+ * noise costs one byte more than it did raw.
+ *
+ * An encoded block is a width byte followed by 16 * width bytes holding
+ * the values in 8 interleaved lanes, which lets SSE2 (where available)
+ * pack and unpack 8 values at a time. The scalar versions produce and
+ * accept exactly the same bytes. The number of values is not stored;
+ * callers keep it alongside the encoded data.
+ */
+class SpheroDeltaCodec {
+public:
+    enum { BLOCK_VALUES = 128 };
+
+    /**
+     * Upper bound on the bytes encode() writes for count values.
+     */
+    static std::size_t maxEncodedSize(std::size_t count) {
+        return (count + BLOCK_VALUES - 1) / BLOCK_VALUES * (1 + 2 * BLOCK_VALUES);
+    }
+
+    /**
+     * Encode count values into out, which must hold maxEncodedSize(count)
+     * bytes. Returns the number of bytes written.
+     */
+    static std::size_t encode(short const* values, std::size_t count, unsigned char * out);
+
+    /**
+     * Decode count values from the len bytes at in. Returns false if in
+     * is too short or malformed; otherwise consumed is set to the number
+     * of bytes used, so several streams can be stored back to back.
+     */
+    static bool decode(unsigned char const* in, std::size_t len,
+                       short * values, std::size_t count, std::size_t & consumed);
+
+    /**
+     * Same as encode and decode, one value at a time without SIMD.
+     */
+    static std::size_t encodeScalar(short const* values, std::size_t count, unsigned char * out);
+    static bool decodeScalar(unsigned char const* in, std::size_t len,
+                             short * values, std::size_t count, std::size_t & consumed);
+};
@@ -0,0 +1,124 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * A collision reported by the robot (ASYNC_COLLISION).
+ */
+struct SpheroCollisionEvent {
+    enum { X_AXIS = 0x01, Y_AXIS = 0x02 };
+
+    short x;                    // impact acceleration, accelerometer units
+    short y;
+    short z;
+    unsigned char axis;         // X_AXIS and/or Y_AXIS, whichever tripped
+    short xMagnitude;           // power of the hit along each axis
+    short yMagnitude;
+    unsigned char speed;        // speed at impact
+    uint32_t timestamp;         // robot clock, in ms
+    std::chrono::steady_clock::time_point arrival;
+};
+
+/**
+ * A change of battery state reported by the robot (ASYNC_POWER_NOTIFY).
+ */
+struct SpheroPowerEvent {
+    unsigned char state;        // a PowerState
+    std::chrono::steady_clock::time_point arrival;
+};
+
+/**
+ * Collision and power notifications, decoded and handed to subscribers
+ * on the io thread as soon as the read carrying them completes. They
+ * never go through the read queue.
+ *
+ * Subscribers run on the io thread and must return quickly; they must
+ * not subscribe or unsubscribe from within a callback. The time from the
+ * read completing to the first subscriber being called is recorded in
+ * latency(). The robot must be told to send these messages first, with
+ * makeSetCollisionDetectionCommand() and makeSetPowerNotifyCommand().
+ *
+ * SpheroEvents takes the robot's onAsync() callbacks for ASYNC_COLLISION
+ * and ASYNC_POWER_NOTIFY; frame observers still see the messages.
+ */
+class SpheroEvents {
+public:
+    typedef std::function<void(SpheroCollisionEvent const& event)> CollisionHandler;
+    typedef std::function<void(SpheroPowerEvent const& event)> PowerHandler;
+
+    enum { COLLISION_DATA_SIZE = 16 };
+
+private:
+    SpheroHandler & robot_;
+    std::mutex mutex_;
+    std::vector<std::pair<int, CollisionHandler>> collisionHandlers_;
+    std::vector<std::pair<int, PowerHandler>> powerHandlers_;
+    int nextId_;
+    LatencyHistogram latency_;
+    boost::atomic<uint64_t> collisions_;
+    boost::atomic<uint64_t> powerEvents_;
+    boost::atomic<uint64_t> malformed_;
+
+    void collisionReceived(SpheroResponseView const& view);
+    void powerReceived(SpheroResponseView const& view);
+    void recordLatency(std::chrono::steady_clock::time_point arrival);
+
+public:
+    /**
+     * Attach to robot, which must outlive this object.
+     */
+    explicit SpheroEvents(SpheroHandler & robot);
+    ~SpheroEvents();
+
+    /**
+     * Decode an ASYNC_COLLISION message. Returns false if it's too short.
+     */
+    static bool decodeCollision(SpheroResponseView const& view, SpheroCollisionEvent & out);
+
+    /**
+     * Decode an ASYNC_POWER_NOTIFY message. Returns false if it's empty.
+     */
+    static bool decodePower(SpheroResponseView const& view, SpheroPowerEvent & out);
+
+    /**
+     * Subscribe to collisions or power changes. Returns an id for
+     * unsubscribe().
+     */
+    int onCollision(CollisionHandler handler);
+    int onPowerChange(PowerHandler handler);
+    void unsubscribe(int id);
+
+    /**
+     * Microseconds from a notification's read completing to its
+     * subscribers being called.
+     */
+    LatencyHistogram & latency() {
+        return latency_;
+    }
+
+    uint64_t collisions() const {
+        return collisions_.load(boost::memory_order_relaxed);
+    }
+    uint64_t powerEvents() const {
+        return powerEvents_.load(boost::memory_order_relaxed);
+    }
+    uint64_t malformed() const {                // too short to decode
+        return malformed_.load(boost::memory_order_relaxed);
+    }
+};
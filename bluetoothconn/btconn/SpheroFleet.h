@@ -0,0 +1,200 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * The outcome of connecting a single robot of a fleet.
+ */
+struct SpheroConnectResult {
+    std::size_t index;                      // position in the address list
+    std::unique_ptr<SpheroHandler> robot;   // null if the connect failed
+    std::chrono::milliseconds latency;      // time spent, including retries
+    std::string error;
+
+    bool connected() const {
+        return robot != nullptr;
+    }
+};
+
+/**
+ * Options for bringing up a whole fleet at once.
+ */
+struct SpheroFleetConnectOptions {
+    /**
+     * Connects in progress at any one time. Most adapters can only page
+     * a few devices concurrently; beyond that, extra connects just queue
+     * up in the radio (or fail), so keep this small.
+     */
+    std::size_t parallelism;
+
+    /**
+     * Minimum spacing between starting two connects, so the adapter
+     * isn't handed a burst of page requests at once.
+     */
+    std::chrono::milliseconds startInterval;
+
+    SpheroConnectOptions connect;           // per-robot retry policy
+
+    SpheroFleetConnectOptions() :
+        parallelism(3), startInterval(50), connect(2, std::chrono::milliseconds(1000)) {
+    }
+};
+
+/**
+ * How long, and for how many robots, a broadcast waits for responses.
+ */
+struct SpheroBroadcastOptions {
+    std::chrono::milliseconds timeout;      // per robot, counted from the send
+    std::size_t quorum;                     // successful responses needed, 0 = all
+
+    SpheroBroadcastOptions() :
+        timeout(500), quorum(0) {
+    }
+    SpheroBroadcastOptions(std::chrono::milliseconds t, std::size_t q = 0) :
+        timeout(t), quorum(q) {
+    }
+};
+
+/**
+ * The responses gathered for one broadcast command.
+ */
+struct SpheroBroadcastResult {
+    enum { NOT_SENT = -1 };
+
+    std::vector<int> seqs;                      // per robot, or NOT_SENT
+    std::vector<SpheroResponsePtr> responses;   // per robot, null if none arrived
+    std::size_t sent;
+    std::size_t responded;
+    std::size_t succeeded;                      // responses with MRSP == OK
+    std::size_t quorum;
+
+    SpheroBroadcastResult() :
+        sent(0), responded(0), succeeded(0), quorum(0) {
+    }
+
+    bool quorumReached() const {
+        return succeeded >= quorum;
+    }
+};
+
+/**
+ * A group of connected robots.
+ */
+class SpheroFleet {
+public:
+    typedef std::function<void(SpheroConnectResult const&)> ConnectHandler;
+
+private:
+    std::vector<std::unique_ptr<SpheroHandler>> robots_;
+    SpheroRollBatch rollBatch_;
+    std::vector<unsigned char> rollSeqs_;
+
+    static std::vector<SpheroConnectResult> connectAll(
+        std::size_t count,
+        std::function<SpheroHandler *(std::size_t)> makeRobot,
+        SpheroFleetConnectOptions const& options,
+        ConnectHandler onResult);
+
+public:
+    SpheroFleet() {
+    }
+
+    /**
+     * Take ownership of every robot that connected successfully.
+     */
+    explicit SpheroFleet(std::vector<SpheroConnectResult> && results) {
+        for (auto & result : results) {
+            if (result.robot) robots_.push_back(std::move(result.robot));
+        }
+    }
+
+    /**
+     * Connect to all addresses concurrently, with at most
+     * options.parallelism connects in flight. onResult (if given) is
+     * called as each robot succeeds or fails, from the connecting thread
+     * but never concurrently with itself. Returns every result, in the
+     * order of the address list.
+     */
+    static std::vector<SpheroConnectResult> connect(
+        std::vector<SOCKADDR_BTH> const& addresses,
+        SpheroFleetConnectOptions const& options = SpheroFleetConnectOptions(),
+        ConnectHandler onResult = nullptr);
+
+    /**
+     * Same as above, for devices reachable through arbitrary endpoints.
+     */
+    static std::vector<SpheroConnectResult> connect(
+        std::vector<BluetoothProto::endpoint> const& endpoints,
+        SpheroFleetConnectOptions const& options = SpheroFleetConnectOptions(),
+        ConnectHandler onResult = nullptr);
+
+    /**
+     * Send one frame to every robot without waiting for any response.
+     * The data segment is shared by all links. Returns the sequence
+     * number used on each robot, or NOT_SENT if sending failed.
+     */
+    std::vector<int> sendAll(SpheroSharedFramePtr const& frame);
+
+    template <unsigned char DID, unsigned char CID>
+    std::vector<int> sendAll(SpheroCommand<DID, CID> const& cmd) {
+        return sendAll(SpheroSharedFrame::encode(cmd));
+    }
+
+    /**
+     * Send a different Roll to every robot: robot i rolls at speeds[i]
+     * towards headings[i] (and state states[i], if given). All frames are
+     * encoded in one batch and sent straight from the batch buffer.
+     * Returns the sequence numbers used, as sendAll() does.
+     */
+    std::vector<int> sendRolls(unsigned char const* speeds,
+                               unsigned short const* headings,
+                               unsigned char const* states = nullptr);
+
+    /**
+     * Collect the responses to a sendAll(). Stops waiting once the
+     * quorum is reached or can no longer be; responses that arrive
+     * after that stay queued on their connection.
+     */
+    SpheroBroadcastResult gather(std::vector<int> const& seqs,
+                                 SpheroBroadcastOptions const& options = SpheroBroadcastOptions());
+
+    /**
+     * sendAll() followed by gather().
+     */
+    SpheroBroadcastResult broadcast(SpheroSharedFramePtr const& frame,
+                                    SpheroBroadcastOptions const& options = SpheroBroadcastOptions()) {
+        return gather(sendAll(frame), options);
+    }
+
+    template <unsigned char DID, unsigned char CID>
+    SpheroBroadcastResult broadcast(SpheroCommand<DID, CID> const& cmd,
+                                    SpheroBroadcastOptions const& options = SpheroBroadcastOptions()) {
+        return broadcast(SpheroSharedFrame::encode(cmd), options);
+    }
+
+    std::size_t size() const {
+        return robots_.size();
+    }
+    SpheroHandler & operator[](std::size_t i) {
+        return *robots_[i];
+    }
+    std::vector<std::unique_ptr<SpheroHandler>> & robots() {
+        return robots_;
+    }
+};
@@ -0,0 +1,136 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Reassembles complete Sphero frames out of a raw RFCOMM byte stream.
+ *
+ * Frames may be split across reads or several may arrive in a single read;
+ * the decoder buffers partial frames in a fixed array and hands every
+ * complete frame with a valid checksum to the caller. Two layouts exist:
+ *
+ *   Synchronous response:  FF FF MRSP SEQ DLEN <DLEN-1 bytes> CHK
+ *   Asynchronous message:  FF FE IDCODE DLEN-MSB DLEN-LSB <DLEN-1 bytes> CHK
+ */
+class SpheroFrameDecoder {
+public:
+    static const std::size_t HEADER_SIZE = 5;
+    static const std::size_t MAX_FRAME_SIZE = 1024;
+
+private:
+    std::array<unsigned char, MAX_FRAME_SIZE> frame_;
+    std::size_t have_;
+    std::size_t need_;
+    uint64_t badChecksums_;
+    uint64_t discardedBytes_;
+
+public:
+    SpheroFrameDecoder() :
+        have_(0), need_(0), badChecksums_(0), discardedBytes_(0) {
+    }
+
+    static bool isAsync(unsigned char const* frame) {
+        return frame[1] == 0xFE;
+    }
+
+    /**
+     * Total frame size (header, data and checksum) as announced
+     * by a complete header.
+     */
+    static std::size_t frameLength(unsigned char const* header) {
+        if (isAsync(header))
+            return HEADER_SIZE + (((std::size_t)header[3] << 8) | header[4]);
+        return HEADER_SIZE + header[4];
+    }
+
+    static bool checksumMatches(unsigned char const* frame, std::size_t len) {
+        unsigned sum = 0;
+        for (std::size_t i = 2; i < len - 1; ++i)
+            sum += frame[i];
+        return (unsigned char)(~sum) == frame[len - 1];
+    }
+
+    uint64_t badChecksums() const {
+        return badChecksums_;
+    }
+    uint64_t discardedBytes() const {
+        return discardedBytes_;
+    }
+
+    void reset() {
+        have_ = need_ = 0;
+    }
+
+    /**
+     * True between frames, i.e. no partial frame is buffered.
+     */
+    bool idle() const {
+        return have_ == 0;
+    }
+
+    /**
+     * Consume a chunk of the byte stream, calling
+     * handler(unsigned char const* frame, std::size_t len) for every
+     * frame completed by it. The frame pointer is only valid for the
+     * duration of the call.
+     */
+    template <class Handler>
+    void feed(unsigned char const* data, std::size_t len, Handler && handler) {
+        while (len > 0) {
+            if (have_ < HEADER_SIZE) {
+                unsigned char b = *data++;
+                --len;
+
+                if (have_ == 0 && b != 0xFF) {
+                    ++discardedBytes_;
+                    continue;
+                }
+                if (have_ == 1 && b != 0xFF && b != 0xFE) {
+                    discardedBytes_ += 2;
+                    have_ = 0;
+                    continue;
+                }
+
+                frame_[have_++] = b;
+                if (have_ == HEADER_SIZE) {
+                    need_ = frameLength(frame_.data());
+                    if (need_ <= HEADER_SIZE || need_ > MAX_FRAME_SIZE) {
+                        discardedBytes_ += HEADER_SIZE;
+                        have_ = 0;
+                    }
+                }
+                continue;
+            }
+
+            std::size_t n = (std::min)(len, need_ - have_);
+            memcpy(frame_.data() + have_, data, n);
+            have_ += n;
+            data += n;
+            len -= n;
+
+            if (have_ == need_) {
+                if (checksumMatches(frame_.data(), need_))
+                    handler(frame_.data(), need_);
+                else
+                    ++badChecksums_;
+                have_ = 0;
+            }
+        }
+    }
+};
@@ -21,32 +21,394 @@
 typedef std::shared_ptr<SpheroServerResponse> SpheroResponsePtr;
 typedef std::shared_ptr<SpheroClientCommand> SpheroCmdPtr;
 
+class SpheroResponseAwaitable;
+
+/**
+ * How a command sent with sendAsync() or request() is retried when its
+ * response doesn't arrive: resent with a fresh SEQ after each timeout,
+ * up to retries more times. Only commands that can safely be applied
+ * twice should be retried.
+ */
+struct SpheroRetryPolicy {
+    unsigned retries;                       // attempts after the first one
+    std::chrono::milliseconds timeout;      // per attempt
+
+    SpheroRetryPolicy() :
+        retries(0), timeout(1000) {
+    }
+    SpheroRetryPolicy(unsigned r, std::chrono::milliseconds t) :
+        retries(r), timeout(t) {
+    }
+};
+
+/**
+ * How hard a SpheroHandler tries to establish its connection.
+ */
+struct SpheroConnectOptions {
+    int retries;                            // attempts after the first one
+    std::chrono::milliseconds retryDelay;   // pause between attempts
+    int sendBufferSize;                     // see BtConnection::setSendBufferSize
+    BtThreadPolicy ioThread;                // see BtConnection::setThreadPolicy
+
+    /**
+     * Frames kept for readResponse() (0 = no limit). Frames taken by
+     * sendAsync() handlers and callbacks are never queued; past the
+     * limit, the oldest of the rest are dropped.
+     */
+    std::size_t readQueueLimit;
+
+    SpheroConnectOptions() :
+        retries(5), retryDelay(5000), sendBufferSize(0), readQueueLimit(256) {
+    }
+    SpheroConnectOptions(int r, std::chrono::milliseconds delay) :
+        retries(r), retryDelay(delay), sendBufferSize(0), readQueueLimit(256) {
+    }
+};
+
 class SpheroHandler
 {
+public:
+    /**
+     * Sees every complete frame received, on the io thread. slot is the
+     * command a response answers (the shared unknown slot if it can't be
+     * told), or ASYNC_FRAME for asynchronous messages.
+     */
+    typedef std::function<void(unsigned char const* frame, std::size_t len,
+                               unsigned slot)> FrameObserver;
+
+    /**
+     * Told, on the io thread, of a command that was replaced by a newer
+     * one of its type before it was sent (see setCoalescing()), so its
+     * seq will never be answered.
+     */
+    typedef std::function<void(unsigned char seq, unsigned slot)> DropObserver;
+
+    /**
+     * Completes a sendAsync(): with the response, or with an error
+     * (timed_out, operation_aborted) and a null response.
+     */
+    typedef std::function<void(boost::system::error_code const& ec,
+                               SpheroResponsePtr response)> ResponseHandler;
+
+    /**
+     * Takes every response to one command type, or every asynchronous
+     * message with one ID code, on the io thread; see onResponse().
+     */
+    typedef std::function<void(SpheroResponseView const& response)> ResponseCallback;
+
+    enum { ASYNC_FRAME = SPHERO_COMMAND_SLOTS };
+
+    /**
+     * SOP2 bits of a command: the robot answers it, and it restarts the
+     * robot's inactivity timer (see makeSetInactiveTimerCommand()).
+     */
+    enum { SOP2_ANSWER = 0x01, SOP2_RESET_TIMEOUT = 0x02 };
+
+private:
+    struct PendingCall {
+        ResponseHandler handler;
+        std::weak_ptr<boost::asio::steady_timer> timer;
+        uint64_t id;
+        SpheroSharedFramePtr frame;
+        std::chrono::milliseconds timeout;
+        unsigned retriesLeft;
+        unsigned sentAt;                    // seqNum when sent
+    };
+
+    // Used from the io thread, so declared ahead of the connection
+    // to outlive it
+    SpheroFrameDecoder frameDecoder_;
+    SpheroLatencyRecorder latency_;
+    std::mutex observersMutex_;     // guards observers and callbacks
+    std::vector<std::pair<int, FrameObserver>> frameObservers_;
+    std::vector<std::pair<int, DropObserver>> dropObservers_;
+    int nextObserverId_;
+    std::array<ResponseCallback, SPHERO_COMMAND_SLOTS> responseCallbacks_;
+    std::array<ResponseCallback, 256> asyncCallbacks_;  // by ID code
+    std::mutex callsMutex_;                 // guards calls and retries
+    std::array<PendingCall, 256> calls_;    // by SEQ
+    uint64_t nextCallId_;
+    std::array<SpheroRetryPolicy, SPHERO_COMMAND_SLOTS> retryPolicies_;
+    std::array<uint64_t, SPHERO_COMMAND_SLOTS> newestCall_;
+    std::array<bool, SPHERO_COMMAND_SLOTS> newestWins_;     // setters
+    std::array<unsigned, 256> superseded_;  // seqNum + 1 of retransmitted SEQs
+    std::array<uint64_t, SPHERO_COMMAND_SLOTS> retransmits_;
+    uint64_t duplicates_;
+    uint64_t retriesExhausted_;
+    boost::atomic<int64_t> lastReceived_;       // steady_clock ticks
+    boost::atomic<int64_t> lastTimeoutReset_;
+    std::mutex streamingMutex_;             // guards the pending SetDataStreaming
+    int streamingSeq_;                      // awaiting its answer, or -1
+    uint64_t streamingPending_;
+    boost::atomic<uint64_t> streamingMasks_;
+
     bt::BtConnection<SpheroMessage> spheroConn_;
-    std::size_t seqNum;
+    boost::atomic<unsigned> seqNum;
+    std::array<bool, SPHERO_COMMAND_SLOTS> coalesce_;
+
+    int coalesceKey(unsigned slot) const {
+        return coalesce_[slot] ? (int)slot : bt::BtConnection<SpheroMessage>::NO_COALESCE;
+    }
+
+    void frameSent(unsigned char sop2);
+    void streamingSent(SpheroMessage const& msg);
+    void streamingAnswered(unsigned char const* frame);
+    bool onDataReceived(unsigned char const* data, std::size_t len);
+    void onReplaced(std::shared_ptr<SpheroMessage> const& msg);
+    bool completeCall(unsigned char seq, uint64_t id,
+                      boost::system::error_code const& ec,
+                      SpheroResponsePtr const& response);
+    void startCall(SpheroSharedFramePtr const& frame, ResponseHandler handler,
+                   std::chrono::milliseconds timeout, unsigned retries, uint64_t id);
+    void callTimedOut(unsigned char seq, uint64_t id);
+    bool suppressDuplicate(unsigned char seq);
+    void initRetryPolicies();
+    void connectWithRetry(std::function<void()> setEndpoint,
+                          SpheroConnectOptions const& options);
 
 public:
-    SpheroHandler(SOCKADDR_BTH * bluetoothAddress);
+    SpheroHandler(SOCKADDR_BTH * bluetoothAddress,
+                  SpheroConnectOptions const& options = SpheroConnectOptions());
+
+    /**
+     * Connect to a device reachable through any stream endpoint, such
+     * as a loopback stand-in used for testing.
+     */
+    explicit SpheroHandler(BluetoothProto::endpoint const& endpoint,
+                           SpheroConnectOptions const& options = SpheroConnectOptions());
     virtual ~SpheroHandler();
 
     bt::BtConnection<SpheroMessage> & getConnection() {
         return spheroConn_;
     }
 
+    /**
+     * Per-command round-trip latencies measured on this connection.
+     */
+    SpheroLatencyRecorder & latency() {
+        return latency_;
+    }
+
+    /**
+     * Let a newer command of this type replace an older one still waiting
+     * to be sent (last writer wins), e.g. for Roll or SetRGB updates
+     * produced faster than the link drains them. A replaced command gets
+     * no response: its sendAsync() completes with operation_aborted right
+     * away and drop observers are told. Commands outside
+     * SpheroCommandSlots can't coalesce.
+     */
+    void setCoalescing(unsigned slot, bool enabled = true) {
+        if (slot < SPHERO_COMMAND_SLOTS - 1) coalesce_[slot] = enabled;
+    }
+
+    template <class CMD>
+    void setCoalescing(bool enabled = true) {
+        setCoalescing(CMD::slot(), enabled);
+    }
+
+    /**
+     * Register an observer for incoming frames; returns an id for
+     * removeFrameObserver(). Observers run on the io thread and must not
+     * block, nor add or remove observers themselves.
+     */
+    int addFrameObserver(FrameObserver observer);
+
+    /**
+     * Once this returns, the observer is no longer running or called.
+     */
+    void removeFrameObserver(int id);
+
+    /**
+     * Same as above, for commands dropped by coalescing. Removed with
+     * removeFrameObserver().
+     */
+    int addDropObserver(DropObserver observer);
+
+    /**
+     * Deliver every response to CMD straight to callback on the io thread,
+     * instead of queueing it for readResponse(). The view is only valid
+     * during the call. Responses to sendAsync() calls still go to their
+     * own handlers. Pass nullptr to queue responses again. Callbacks must
+     * not block, nor register callbacks or observers themselves.
+     */
+    template <class CMD>
+    void onResponse(ResponseCallback callback) {
+        onResponse(CMD::slot(), callback);
+    }
+    void onResponse(unsigned slot, ResponseCallback callback);
+
+    /**
+     * Same as above, for asynchronous messages with an AsyncIdCode,
+     * e.g. ASYNC_SENSOR_DATA or ASYNC_COLLISION.
+     */
+    void onAsync(unsigned char idCode, ResponseCallback callback);
+
+    /**
+     * The layout of this robot's sensor streaming packets: the masks of
+     * the last SetDataStreaming it acknowledged (or was sent, if it asked
+     * for no answer). Empty until then. Everything parsing the robot's
+     * streamed samples reads it from here.
+     */
+    SpheroStreamLayout streamingLayout() const {
+        return SpheroStreamLayout(streamingMasks_.load(boost::memory_order_acquire));
+    }
+
+    /**
+     * Commands dropped because a newer one of the same type replaced them.
+     */
+    uint64_t coalescedCommands() const {
+        return spheroConn_.coalescedCount();
+    }
+
     template<unsigned char DID, unsigned char CID>
     void sendCommand(SpheroCommand<DID, CID> & cmd) {
         if (!spheroConn_.isConnected())
             throw NotConnectedException(
                     "Unable to send Sphero Commands - Not Connected");
 
-        auto msg = cmd.generateCommandMessage<SpheroClientCommand>(
-            (unsigned char)seqNum);
+        unsigned char seq = nextSeq();
+        auto msg = cmd.generateCommandMessage<SpheroClientCommand>(seq);
         msg->assemble();
-        spheroConn_.send(msg);
-        ++seqNum;
+        unsigned slot = SpheroCommand<DID, CID>::slot();
+        latency_.commandSent(slot, seq);
+        frameSent(msg->startOfPacket());
+        if (slot == SetDataStreamingCommand::slot()) streamingSent(*msg);
+        spheroConn_.send(msg, coalesceKey(slot));
     }
 
+    /**
+     * Send a frame encoded once for many robots; only the sequence
+     * number and checksum are this connection's own. Returns the
+     * sequence number used.
+     */
+    unsigned char sendFrame(SpheroSharedFramePtr const& frame);
+
+    /**
+     * Claim the sequence number for a frame encoded outside of
+     * sendCommand(), e.g. by a SpheroRollBatch. Safe to call from
+     * any thread.
+     */
+    unsigned char nextSeq() {
+        return (unsigned char)seqNum.fetch_add(1, boost::memory_order_relaxed);
+    }
+
+    /**
+     * Send a frame already encoded with a sequence number obtained from
+     * nextSeq(). slot identifies the command for latency tracking.
+     */
+    void sendEncoded(std::shared_ptr<SpheroMessage> const& frame,
+                     unsigned slot, unsigned char seq);
+
+    /**
+     * Send frame and call handler on the io thread once its response
+     * arrives, or with timed_out once every attempt allowed by the
+     * command's retry policy timed out. A timeout of 0 uses the policy's.
+     * The response is not queued for readResponse(). Thousands of these
+     * can be outstanding without a thread waiting on any of them.
+     */
+    void sendAsync(SpheroSharedFramePtr const& frame, ResponseHandler handler,
+                   std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    template <unsigned char DID, unsigned char CID>
+    void sendAsync(SpheroCommand<DID, CID> const& cmd, ResponseHandler handler,
+                   std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        sendAsync(SpheroSharedFrame::encode(cmd), handler, timeout);
+    }
+
+    /**
+     * Same as above, retried as policy says rather than as the
+     * command's retry policy does.
+     */
+    void sendAsync(SpheroSharedFramePtr const& frame, ResponseHandler handler,
+                   SpheroRetryPolicy const& policy);
+
+    /**
+     * Send cmd and wait for its response, retrying as its retry policy
+     * allows. Returns null once all attempts timed out. Must not be
+     * called on the io thread.
+     */
+    SpheroResponsePtr request(SpheroSharedFramePtr const& frame,
+                              std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    template <unsigned char DID, unsigned char CID>
+    SpheroResponsePtr request(SpheroCommand<DID, CID> const& cmd,
+                              std::chrono::milliseconds timeout = std::chrono::milliseconds(0)) {
+        return request(SpheroSharedFrame::encode(cmd), timeout);
+    }
+
+    /**
+     * The retry policy for a command type. By default getters and setters
+     * of absolute values are retried twice after 500ms; everything else
+     * is not retried and times out after 1000ms. Only the newest call of
+     * each setter type is retried, so a retried setter never overtakes a
+     * newer one; getters are retried independently of each other. A
+     * timeout given to sendAsync() or request() overrides the policy's.
+     */
+    template <class CMD>
+    void setRetryPolicy(SpheroRetryPolicy const& policy) {
+        setRetryPolicy(CMD::slot(), policy);
+    }
+    void setRetryPolicy(unsigned slot, SpheroRetryPolicy const& policy);
+
+    template <class CMD>
+    SpheroRetryPolicy retryPolicy() {
+        return retryPolicy(CMD::slot());
+    }
+    SpheroRetryPolicy retryPolicy(unsigned slot);
+
+    /**
+     * Commands of a type resent after a timeout.
+     */
+    template <class CMD>
+    uint64_t retransmits() {
+        return retransmits(CMD::slot());
+    }
+    uint64_t retransmits(unsigned slot);
+
+    /**
+     * Late responses to SEQs that had already been resent, dropped.
+     */
+    uint64_t duplicatesSuppressed();
+
+    /**
+     * Calls that failed after using up all their attempts.
+     */
+    uint64_t retriesExhausted();
+
+    /**
+     * When a frame last arrived from the robot, and when a command that
+     * restarts its inactivity timer was last sent; the epoch if never.
+     */
+    std::chrono::steady_clock::time_point lastReceived() const {
+        return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(
+            lastReceived_.load(boost::memory_order_relaxed)));
+    }
+    std::chrono::steady_clock::time_point lastTimeoutReset() const {
+        return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(
+            lastTimeoutReset_.load(boost::memory_order_relaxed)));
+    }
+
+#if defined(__cpp_impl_coroutine)
+    /**
+     * co_await robot.send(cmd) resumes with the response on the io
+     * thread; see SpheroCoroutine.h.
+     */
+    template <unsigned char DID, unsigned char CID>
+    SpheroResponseAwaitable send(SpheroCommand<DID, CID> const& cmd,
+        std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+#endif
+
+    /**
+     * The oldest frame that no callback or sendAsync() handler took, a
+     * response or an asynchronous message. Blocks until one arrives;
+     * returns null once the connection shuts down.
+     */
     SpheroResponsePtr readResponse();
+
+    /**
+     * Wait at most timeout for the response to the command sent with
+     * sequence number seq. Other responses stay queued.
+     */
+    SpheroResponsePtr readResponse(unsigned char seq, std::chrono::milliseconds timeout);
 };
 
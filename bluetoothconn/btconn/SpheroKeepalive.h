@@ -0,0 +1,139 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * When a SpheroKeepalive pings, and when it gives up on the link.
+ */
+struct SpheroKeepaliveOptions {
+    /**
+     * Ping once nothing has been received from the robot, or nothing
+     * that restarts its inactivity timer has been sent, for this long.
+     */
+    std::chrono::milliseconds interval;
+
+    std::chrono::milliseconds timeout;      // wait for each Ping's answer
+    unsigned missedBeats;                   // unanswered Pings in a row that mean dead
+
+    /**
+     * If not 0, sent with SetInactiveTimer on start, so a robot whose host
+     * went away falls asleep after this many seconds (60 or more). The
+     * interval is shortened to half of it if needed, to keep the robot
+     * awake for as long as the host is there.
+     */
+    unsigned short inactiveTimer;
+
+    bool closeOnDead;                       // close the connection once dead
+
+    SpheroKeepaliveOptions() :
+        interval(1000), timeout(500), missedBeats(3), inactiveTimer(0), closeOnDead(true) {
+    }
+};
+
+/**
+ * Heartbeat for one robot's link, so a half-open connection is noticed
+ * within detectionTime() instead of at the next failed write.
+ *
+ * A Ping is only sent when the link has gone quiet (see
+ * SpheroKeepaliveOptions::interval), so a busy link carries no extra
+ * traffic. Pings go out with the reset timeout bit of SOP2 set, like
+ * every other command, so they also keep the robot from falling asleep.
+ * The round trip of each answered Ping is recorded in rtt(). After
+ * missedBeats unanswered Pings in a row, sent back to back, the link is
+ * declared dead: onDead is called on the io thread, the connection is
+ * closed if so configured, and no more Pings are sent.
+ *
+ * Destroy the keepalive before its robot. onDead must not destroy it.
+ */
+class SpheroKeepalive {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<void()> DeadHandler;
+
+private:
+    /**
+     * Everything the io thread's callbacks use, kept alive by them so
+     * they can outlast the keepalive.
+     */
+    struct State {
+        SpheroHandler * robot;
+        SpheroKeepaliveOptions options;
+        boost::asio::steady_timer timer;
+        SpheroSharedFramePtr ping;
+        std::mutex mutex;
+        DeadHandler onDead;
+        bool stopped;
+        bool pinging;
+        Clock::time_point sentAt;
+        LatencyHistogram rtt;
+        boost::atomic<bool> alive;
+        boost::atomic<unsigned> missed;     // in a row
+        boost::atomic<uint64_t> pings;
+        boost::atomic<uint64_t> missedTotal;
+        boost::atomic<int64_t> lastRtt;     // in us
+
+        State(SpheroHandler & robot, SpheroKeepaliveOptions const& options,
+              DeadHandler onDead);
+    };
+
+    std::shared_ptr<State> state_;
+
+    static void schedule(std::shared_ptr<State> const& state, Clock::time_point at);
+    static void tick(std::shared_ptr<State> const& state);
+    static void sendPing(std::shared_ptr<State> const& state);
+    static void answered(std::shared_ptr<State> const& state, SpheroResponsePtr const& response);
+
+public:
+    SpheroKeepalive(SpheroHandler & robot,
+                    SpheroKeepaliveOptions const& options = SpheroKeepaliveOptions(),
+                    DeadHandler onDead = nullptr);
+
+    /**
+     * Once this returns, onDead is not running and won't be called.
+     */
+    ~SpheroKeepalive();
+
+    /**
+     * The longest a dead link can go unnoticed with options.
+     */
+    static std::chrono::milliseconds detectionTime(SpheroKeepaliveOptions const& options) {
+        return options.interval + options.timeout * (long long)options.missedBeats;
+    }
+
+    bool alive() const {
+        return state_->alive.load(boost::memory_order_relaxed);
+    }
+
+    /**
+     * Round trip of every answered Ping, in microseconds.
+     */
+    LatencyHistogram & rtt() {
+        return state_->rtt;
+    }
+    std::chrono::microseconds lastRtt() const {
+        return std::chrono::microseconds(state_->lastRtt.load(boost::memory_order_relaxed));
+    }
+
+    uint64_t pings() const {
+        return state_->pings.load(boost::memory_order_relaxed);
+    }
+    uint64_t missed() const {               // over the keepalive's life
+        return state_->missedTotal.load(boost::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,150 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "LatencyHistogram.h"
+#include "SpheroCommands.h"
+
+/**
+ * Round-trip latency histograms for every command type, as copied
+ * out of a SpheroLatencyRecorder. Reports from several connections
+ * can be merged into a fleet-wide view.
+ */
+class SpheroLatencyReport {
+    std::vector<LatencyHistogram::Snapshot> commands_;
+
+public:
+    SpheroLatencyReport() : commands_(SPHERO_COMMAND_SLOTS) {
+    }
+
+    template <class CMD>
+    LatencyHistogram::Snapshot const& get() const {
+        return commands_[CMD::slot()];
+    }
+    LatencyHistogram::Snapshot const& get(unsigned char did, unsigned char cid) const {
+        return commands_[spheroCommandSlot(did, cid)];
+    }
+    LatencyHistogram::Snapshot const& atSlot(unsigned slot) const {
+        return commands_.at(slot);
+    }
+    LatencyHistogram::Snapshot & atSlot(unsigned slot) {
+        return commands_.at(slot);
+    }
+
+    /**
+     * All command types folded into a single histogram.
+     */
+    LatencyHistogram::Snapshot total() const {
+        LatencyHistogram::Snapshot ret;
+        for (auto const& snap : commands_)
+            ret.merge(snap);
+        return ret;
+    }
+
+    void merge(SpheroLatencyReport const& other) {
+        for (unsigned i = 0; i < SPHERO_COMMAND_SLOTS; ++i)
+            commands_[i].merge(other.commands_[i]);
+    }
+};
+
+/**
+ * Measures command round-trip times on a single connection.
+ *
+ * The send path stamps the SEQ of every outgoing command with the time
+ * and the command's slot; the response path closes the SEQ and records
+ * the elapsed time in that command's histogram. Both sides are a single
+ * atomic operation on a fixed table, so neither allocates nor locks.
+ * A SEQ that is reused (256 commands later) before its response arrives
+ * simply restarts the measurement.
+ */
+class SpheroLatencyRecorder {
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point epoch_;
+    boost::atomic<uint64_t> inFlight_[256]; // (micros since epoch + 1) << 8 | slot
+    std::unique_ptr<LatencyHistogram[]> histograms_;
+
+    uint64_t now() const {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - epoch_).count();
+    }
+
+public:
+    SpheroLatencyRecorder() :
+        epoch_(Clock::now()),
+        histograms_(new LatencyHistogram[SPHERO_COMMAND_SLOTS]) {
+        for (auto & slot : inFlight_)
+            slot.store(0, boost::memory_order_relaxed);
+    }
+
+    void commandSent(unsigned slot, unsigned char seq) {
+        inFlight_[seq].store(((now() + 1) << 8) | (slot & 0xFF),
+                             boost::memory_order_relaxed);
+    }
+
+    /**
+     * Close the measurement for a SEQ. Returns false for responses
+     * nobody is waiting on (duplicates, or SEQs this side never sent);
+     * otherwise stores the slot of the command answered in slotOut.
+     */
+    bool responseReceived(unsigned char seq, unsigned * slotOut = nullptr) {
+        uint64_t stamp = inFlight_[seq].exchange(0, boost::memory_order_relaxed);
+        if (stamp == 0) return false;
+
+        unsigned slot = (unsigned)(stamp & 0xFF);
+        uint64_t sentAt = (stamp >> 8) - 1;
+        uint64_t nowMicros = now();
+        if (slot >= SPHERO_COMMAND_SLOTS) return false;
+        if (slotOut) *slotOut = slot;
+
+        histograms_[slot].record(nowMicros > sentAt ? nowMicros - sentAt : 0);
+        return true;
+    }
+
+    /**
+     * Forget a SEQ that will never be answered, e.g. a command replaced
+     * before it was sent. Nothing is recorded for it.
+     */
+    void commandDropped(unsigned char seq) {
+        inFlight_[seq].store(0, boost::memory_order_relaxed);
+    }
+
+    LatencyHistogram const& histogram(unsigned slot) const {
+        return histograms_[slot];
+    }
+
+    SpheroLatencyReport report() const {
+        SpheroLatencyReport ret;
+        for (unsigned i = 0; i < SPHERO_COMMAND_SLOTS; ++i)
+            ret.atSlot(i) = histograms_[i].snapshot();
+        return ret;
+    }
+
+    SpheroLatencyReport reportAndReset() {
+        SpheroLatencyReport ret;
+        for (unsigned i = 0; i < SPHERO_COMMAND_SLOTS; ++i)
+            ret.atSlot(i) = histograms_[i].snapshotAndReset();
+        return ret;
+    }
+
+    void reset() {
+        for (unsigned i = 0; i < SPHERO_COMMAND_SLOTS; ++i)
+            histograms_[i].reset();
+    }
+};
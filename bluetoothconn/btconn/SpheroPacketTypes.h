@@ -28,6 +28,13 @@ typedef std::vector<unsigned char> SpheroPacket;
 class SpheroMessage : public SpheroPacket
 {
 public:
+    /**
+     * The bytes of a message as they go out on the wire, as up to three
+     * buffers written with a single gathered write. Unused entries are
+     * left empty.
+     */
+    typedef std::array<boost::asio::const_buffer, 3> WireBuffers;
+
     SpheroMessage() {
     }
     virtual ~SpheroMessage() {
@@ -50,8 +57,20 @@ public:
     virtual SpheroPacket::size_type length() const {
         return this->size();
     }
+
+    virtual WireBuffers wireBuffers() const {
+        WireBuffers ret = {{ boost::asio::buffer(this->data(), length()) }};
+        return ret;
+    }
 };
 
+/**
+ * Lets bt::BtConnection send a SpheroMessage without flattening it first.
+ */
+inline SpheroMessage::WireBuffers messageBuffers(SpheroMessage const& msg) {
+    return msg.wireBuffers();
+}
+
 /**
  * This class specializes responses from the Sphero Device.
  */
@@ -227,6 +246,72 @@ public:
     }
 };
 
+/**
+ * A received frame, borrowed from the connection's read buffer for the
+ * duration of a callback. Reading it costs no copy; call copy() to keep
+ * the response beyond the callback.
+ */
+class SpheroResponseView {
+    unsigned char const* frame_;
+    std::size_t len_;
+    std::chrono::steady_clock::time_point arrival_;
+
+public:
+    SpheroResponseView(unsigned char const* frame, std::size_t len,
+                       std::chrono::steady_clock::time_point arrival =
+                           std::chrono::steady_clock::time_point()) :
+        frame_(frame), len_(len), arrival_(arrival) {
+    }
+
+    bool isAsync() const {
+        return frame_[1] == 0xFE;
+    }
+    unsigned char messageResponse() const {     // synchronous responses
+        return frame_[2];
+    }
+    unsigned char sequenceNum() const {         // synchronous responses
+        return frame_[3];
+    }
+    unsigned char idCode() const {              // asynchronous messages
+        return frame_[2];
+    }
+    unsigned char const* msgData() const {
+        return frame_ + 5;
+    }
+    /**
+     * Bytes of data, not counting the checksum as DLEN does.
+     */
+    std::size_t dataLength() const {
+        return len_ - 6;
+    }
+    unsigned char const* frame() const {
+        return frame_;
+    }
+    std::size_t frameLength() const {
+        return len_;
+    }
+    /**
+     * When the read carrying the frame completed.
+     */
+    std::chrono::steady_clock::time_point arrival() const {
+        return arrival_;
+    }
+
+    /**
+     * The big-endian 16 bit value at offset into the data, 0 past its end.
+     */
+    unsigned short word(std::size_t offset) const {
+        if (offset + 1 >= dataLength()) return 0;
+        return (unsigned short)((msgData()[offset] << 8) | msgData()[offset + 1]);
+    }
+
+    std::shared_ptr<SpheroServerResponse> copy() const {
+        auto ret = std::make_shared<SpheroServerResponse>(frame_, len_);
+        ret->parseFromInternalData();
+        return ret;
+    }
+};
+
 /**
  * This class specializes a request to a Sphero Device.
  */
@@ -355,3 +440,142 @@ public:
         SpheroClientCommand(init) {
     }
 };
+
+class SpheroFrameView;
+
+/**
+ * A command encoded once, to be sent over many connections.
+ *
+ * The data segment is immutable and shared by every link; each link only
+ * gets its own sequence number and checksum, through a SpheroFrameView.
+ * The checksum is the complement of the byte sum, so the sum over
+ * everything but SEQ is computed once here and each view just adds its SEQ.
+ */
+class SpheroSharedFrame : public std::enable_shared_from_this<SpheroSharedFrame> {
+public:
+    static const std::size_t HEADER_SIZE = 6;   // SOP1 SOP2 DID CID SEQ DLEN
+
+private:
+    std::array<unsigned char, HEADER_SIZE> header_;
+    std::vector<unsigned char> body_;
+    unsigned partialSum_;
+    unsigned slot_;
+
+public:
+    SpheroSharedFrame(unsigned char did, unsigned char cid,
+                      unsigned char const* data, std::size_t data_len,
+                      bool answer = true) :
+            body_(data, data + data_len),
+            partialSum_(0),
+            slot_(spheroCommandSlot(did, cid)) {
+        if (data_len > 254)
+            throw std::out_of_range("Length of data must be < 255 bytes");
+
+        header_[0] = 0xFF;
+        header_[1] = answer ? 0xFF : 0xFE;
+        header_[2] = did;
+        header_[3] = cid;
+        header_[4] = 0x00;
+        header_[5] = (unsigned char)(data_len + 1);
+
+        partialSum_ = did + cid + header_[5];
+        for (auto b : body_)
+            partialSum_ += b;
+    }
+
+    template <unsigned char DID, unsigned char CID>
+    static std::shared_ptr<SpheroSharedFrame const> encode(
+            SpheroCommand<DID, CID> const& cmd, bool answer = true) {
+        return std::make_shared<SpheroSharedFrame>(
+            DID, CID, cmd.data().data(), cmd.data().size(), answer);
+    }
+
+    unsigned char deviceId() const {
+        return header_[2];
+    }
+    unsigned char commandId() const {
+        return header_[3];
+    }
+    unsigned slot() const {
+        return slot_;
+    }
+    bool answered() const {
+        return header_[1] == 0xFF;
+    }
+    std::array<unsigned char, HEADER_SIZE> const& header() const {
+        return header_;
+    }
+    std::vector<unsigned char> const& body() const {
+        return body_;
+    }
+    unsigned char checksum(unsigned char seq) const {
+        return (unsigned char)~(partialSum_ + seq);
+    }
+
+    /**
+     * The frame as sent with sequence number seq. The view keeps this
+     * frame alive.
+     */
+    std::shared_ptr<SpheroFrameView> view(unsigned char seq) const;
+};
+
+typedef std::shared_ptr<SpheroSharedFrame const> SpheroSharedFramePtr;
+
+/**
+ * One link's copy of a SpheroSharedFrame: its own header and checksum
+ * around the shared data segment.
+ */
+class SpheroFrameView : public SpheroMessage {
+    SpheroSharedFramePtr frame_;
+    std::array<unsigned char, SpheroSharedFrame::HEADER_SIZE> header_;
+    unsigned char chksum_;
+
+public:
+    SpheroFrameView(SpheroSharedFramePtr frame, unsigned char seq) :
+            frame_(frame), header_(frame->header()), chksum_(frame->checksum(seq)) {
+        header_[4] = seq;
+    }
+
+    unsigned char sequenceNum() const {
+        return header_[4];
+    }
+    unsigned char checksum() const {
+        return chksum_;
+    }
+    SpheroSharedFramePtr const& frame() const {
+        return frame_;
+    }
+
+    /**
+     * Copy the whole frame into this message's own storage. Only needed
+     * to inspect it; sending uses wireBuffers() and never copies.
+     */
+    void assemble() {
+        this->assign(header_.begin(), header_.end());
+        this->insert(this->end(), frame_->body().begin(), frame_->body().end());
+        this->push_back(chksum_);
+    }
+    unsigned char dataLength() {
+        return (unsigned char)frame_->body().size();
+    }
+    unsigned char* msgData() {
+        return const_cast<unsigned char*>(frame_->body().data());
+    }
+
+    virtual SpheroPacket::size_type length() const {
+        return SpheroSharedFrame::HEADER_SIZE + frame_->body().size() + 1;
+    }
+
+    virtual WireBuffers wireBuffers() const {
+        WireBuffers ret = {{
+            boost::asio::buffer(header_),
+            boost::asio::buffer(frame_->body()),
+            boost::asio::buffer(&chksum_, 1)
+        }};
+        return ret;
+    }
+};
+
+inline std::shared_ptr<SpheroFrameView> SpheroSharedFrame::view(unsigned char seq) const {
+    return std::make_shared<SpheroFrameView>(shared_from_this(), seq);
+}
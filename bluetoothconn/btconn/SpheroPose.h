@@ -0,0 +1,147 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Where a robot is, as last estimated by a SpheroPose.
+ */
+struct SpheroPoseEstimate {
+    typedef std::chrono::steady_clock Clock;
+
+    double x;                   // cm, in the frame of SetLocator
+    double y;
+    double vx;                  // cm/s
+    double vy;
+    double heading;             // degrees clockwise, 0 to 360
+    Clock::time_point at;       // when the newest sample was taken
+    uint64_t samples;           // samples folded in; 0 until the first
+
+    bool valid() const {
+        return samples != 0;
+    }
+    double speed() const {
+        return std::sqrt(vx * vx + vy * vy);
+    }
+
+    /**
+     * The position at time when, assuming the velocity held since at.
+     */
+    SpheroPoseEstimate extrapolate(Clock::time_point when) const {
+        SpheroPoseEstimate ret = *this;
+        double dt = std::chrono::duration<double>(when - at).count();
+        ret.x += vx * dt;
+        ret.y += vy * dt;
+        ret.at = when;
+        return ret;
+    }
+};
+
+/**
+ * Dead-reckoned pose of one robot, kept current from what the robot
+ * sends anyway: streamed odometer, velocity and IMU yaw samples, and the
+ * responses to any ReadLocator. Planners read it every tick instead of
+ * polling ReadLocator.
+ *
+ * Each sample costs a constant amount of work. The odometer, when
+ * streamed, is the position; otherwise the velocity is integrated. The
+ * heading is the IMU yaw if streamed, otherwise the direction of travel
+ * while moving. A locator response replaces position and velocity.
+ *
+ * Samples are folded in on the io thread. pose() copies out the latest
+ * estimate without taking a lock, and retries in the rare case it races
+ * an update.
+ */
+class SpheroPose {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * SetDataStreaming MASK1 bit of the filtered IMU yaw angle. The
+     * MASK2 bits used are those of SpheroStateCache.
+     */
+    enum { STREAM_IMU_YAW = 0x00010000 };
+
+private:
+    enum { WORDS = 7 };
+
+    /**
+     * Offsets of the fields used within one sample, in bytes, or -1
+     * when not streamed.
+     */
+    struct Layout {
+        SpheroStreamLayout stream;
+        int odometerX;
+        int odometerY;
+        int velocityX;
+        int velocityY;
+        int yaw;
+    };
+
+    SpheroHandler * robot_;
+    int observerId_;
+    boost::atomic<uint64_t> layout_;        // set when fed through feed()
+    boost::atomic<uint64_t> sequence_;      // odd while an update is written
+    boost::atomic<uint64_t> words_[WORDS];
+    boost::atomic<uint64_t> unparsed_;
+
+    // Only touched by the writer
+    Layout layoutSeen_;
+    SpheroPoseEstimate current_;
+    SpheroStreamClock clock_;
+
+    void init();
+    void update(Clock::time_point at, unsigned char const* sample);
+    void publish();
+
+public:
+    /**
+     * Track robot, which must outlive this object.
+     */
+    explicit SpheroPose(SpheroHandler & robot);
+
+    /**
+     * An estimator that is only fed through feed() and feedLocator().
+     */
+    SpheroPose();
+    ~SpheroPose();
+
+    /**
+     * For an estimator fed through feed(), the masks last sent with
+     * SetDataStreaming; packets are ignored until this is called. One
+     * tracking a robot follows the robot's streamingLayout().
+     */
+    void setStreamingMask(uint32_t mask1, uint32_t mask2);
+
+    /**
+     * Fold in the samples of a streaming packet's data segment that
+     * arrived at arrival, or the data segment of a ReadLocator response.
+     * Called from the io thread; there must only be one caller at a time.
+     */
+    void feed(unsigned char const* data, std::size_t len, Clock::time_point arrival);
+    void feedLocator(unsigned char const* data, std::size_t len, Clock::time_point arrival);
+
+    /**
+     * The latest estimate. Never blocks.
+     */
+    SpheroPoseEstimate pose() const;
+
+    uint64_t unparsed() const {             // no layout, or too short
+        return unparsed_.load(boost::memory_order_relaxed);
+    }
+};
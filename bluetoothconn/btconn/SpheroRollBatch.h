@@ -0,0 +1,136 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * One frame inside a SpheroRollBatch buffer. Sending it writes straight
+ * out of the batch buffer, which the frame keeps alive.
+ */
+class SpheroBatchFrame : public SpheroMessage {
+    std::shared_ptr<std::vector<unsigned char> const> buffer_;
+    std::size_t offset_;
+    std::size_t length_;
+
+public:
+    SpheroBatchFrame(std::shared_ptr<std::vector<unsigned char> const> buffer,
+                     std::size_t offset, std::size_t length) :
+        buffer_(buffer), offset_(offset), length_(length) {
+    }
+
+    unsigned char const* frameData() const {
+        return buffer_->data() + offset_;
+    }
+    unsigned char sequenceNum() const {
+        return frameData()[4];
+    }
+
+    /**
+     * Copy the frame into this message's own storage. Only needed to
+     * inspect it; sending uses wireBuffers() and never copies.
+     */
+    void assemble() {
+        this->assign(frameData(), frameData() + length_);
+    }
+    unsigned char dataLength() {
+        return (unsigned char)(length_ - 7);
+    }
+    unsigned char* msgData() {
+        return const_cast<unsigned char*>(frameData() + 6);
+    }
+
+    virtual SpheroPacket::size_type length() const {
+        return length_;
+    }
+
+    virtual WireBuffers wireBuffers() const {
+        WireBuffers ret = {{ boost::asio::buffer(frameData(), length_) }};
+        return ret;
+    }
+};
+
+/**
+ * Encodes a distinct Roll for each of many robots in one pass.
+ *
+ * Inputs are given as parallel arrays (speeds[i], headings[i] and seqs[i]
+ * all belong to robot i) and every frame is written back to back into a
+ * single buffer, with checksums computed 16 frames at a time using SSE2
+ * where available. Frames handed out by frame() point into that buffer.
+ *
+ * The buffer is reused by the next encode() unless frames from the
+ * previous one are still queued for sending, in which case a new one is
+ * allocated and the old one is freed along with its last frame.
+ */
+class SpheroRollBatch {
+public:
+    enum { FRAME_SIZE = 11 };   // 6 header + 4 data + checksum
+
+private:
+    std::shared_ptr<std::vector<unsigned char>> buffer_;
+    std::size_t count_;
+
+public:
+    SpheroRollBatch() :
+        count_(0) {
+    }
+
+    /**
+     * Encode count Roll frames. states may be null, meaning every robot
+     * keeps rolling (state 1).
+     */
+    void encode(unsigned char const* speeds,
+                unsigned short const* headings,
+                unsigned char const* seqs,
+                std::size_t count,
+                unsigned char const* states = nullptr);
+
+    std::size_t size() const {
+        return count_;
+    }
+
+    /**
+     * The contiguous frames, FRAME_SIZE bytes each.
+     */
+    unsigned char const* data() const {
+        return buffer_ ? buffer_->data() : nullptr;
+    }
+
+    std::shared_ptr<SpheroBatchFrame> frame(std::size_t i) const {
+        return std::make_shared<SpheroBatchFrame>(buffer_, i * FRAME_SIZE, FRAME_SIZE);
+    }
+
+    /**
+     * Write count Roll frames to out (count * FRAME_SIZE bytes).
+     */
+    static void encodeFrames(unsigned char * out,
+                             unsigned char const* speeds,
+                             unsigned short const* headings,
+                             unsigned char const* seqs,
+                             unsigned char const* states,
+                             std::size_t count);
+
+    /**
+     * Same as encodeFrames, one frame at a time without SIMD.
+     */
+    static void encodeFramesScalar(unsigned char * out,
+                                   unsigned char const* speeds,
+                                   unsigned short const* headings,
+                                   unsigned char const* seqs,
+                                   unsigned char const* states,
+                                   std::size_t count);
+};
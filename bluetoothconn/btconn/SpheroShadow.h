@@ -0,0 +1,130 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * How close a setting must be to what the robot already has for a
+ * SpheroShadow to drop it. All deadbands default to 0 (identical only).
+ */
+struct SpheroShadowOptions {
+    unsigned colorDeadband;     // per channel, for SetRGB and SetBackLed
+    unsigned headingDeadband;   // degrees, for Roll
+    unsigned speedDeadband;     // for Roll
+
+    SpheroShadowOptions() :
+        colorDeadband(0), headingDeadband(0), speedDeadband(0) {
+    }
+};
+
+/**
+ * The settings a robot last acknowledged, per connection, used to skip
+ * setters that wouldn't change anything.
+ *
+ * Commands sent through send() are compared with the last acknowledged
+ * command of the same type; if they are the same (or within a deadband)
+ * they never reach the link. Only setters whose effect is fully described
+ * by their data are tracked: SetRGB, SetBackLed, Roll, SetStabilize,
+ * SetRotationRate, the option flags, SetPowerNotify, SetAutoReconnect,
+ * SetInactiveTimer and SetMotionTimeout. Everything else is sent as is.
+ *
+ * A setting is forgotten when the robot rejects it, when a command of its
+ * type is sent around the shadow, and when the robot goes to sleep. Call
+ * invalidateAll() after reconnecting. Note that an elided Roll doesn't
+ * restart the robot's motion timeout.
+ */
+class SpheroShadow {
+public:
+    enum { ELIDED = -1 };
+
+private:
+    struct Setting {
+        SpheroSharedFramePtr frame;
+        bool known;
+        unsigned inFlight;              // sent, not yet answered
+
+        Setting() : known(false), inFlight(0) {
+        }
+    };
+    struct Pending {
+        unsigned slot;                  // SPHERO_COMMAND_SLOTS when unused
+        SpheroSharedFramePtr frame;
+    };
+
+    SpheroHandler & robot_;
+    SpheroShadowOptions options_;
+    int observerId_;
+    int dropObserverId_;
+    mutable std::mutex mutex_;
+    std::array<Setting, SPHERO_COMMAND_SLOTS> acked_;
+    std::array<Pending, 256> pending_;  // by SEQ
+    uint64_t sent_;
+    uint64_t elided_;
+
+    void onFrame(unsigned char const* frame, std::size_t len, unsigned slot);
+    void onDropped(unsigned char seq, unsigned slot);
+    void release(Pending & pending);
+
+public:
+    /**
+     * Attach to robot, which must outlive the shadow.
+     */
+    explicit SpheroShadow(SpheroHandler & robot,
+                          SpheroShadowOptions const& options = SpheroShadowOptions());
+    ~SpheroShadow();
+
+    /**
+     * Send frame unless it would leave the robot as it is. Returns the
+     * sequence number used, or ELIDED.
+     */
+    int send(SpheroSharedFramePtr const& frame);
+
+    template <unsigned char DID, unsigned char CID>
+    int send(SpheroCommand<DID, CID> const& cmd) {
+        return send(SpheroSharedFrame::encode(cmd));
+    }
+
+    static bool tracked(unsigned slot);
+
+    /**
+     * Whether a setter with data would leave a robot whose last
+     * acknowledged setter of that type carried acked unchanged.
+     */
+    static bool redundant(unsigned slot,
+                          std::vector<unsigned char> const& acked,
+                          std::vector<unsigned char> const& data,
+                          SpheroShadowOptions const& options);
+
+    void setOptions(SpheroShadowOptions const& options);
+
+    /**
+     * Every setting the robot is known to have, as the frames that set
+     * it, so they can be replayed on another robot. Roll comes last.
+     */
+    std::vector<SpheroSharedFramePtr> settings() const;
+
+    template <class CMD>
+    void invalidate() {
+        invalidate(CMD::slot());
+    }
+    void invalidate(unsigned slot);
+    void invalidateAll();
+
+    uint64_t sent() const;
+    uint64_t elided() const;
+};
@@ -0,0 +1,136 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * How a SpheroStandbyPool keeps its spares, and how it brings one in.
+ */
+struct SpheroStandbyOptions {
+    /**
+     * Heartbeat for each waiting spare. A spare only talks to the host
+     * when it's pinged, so a long interval keeps the links (and the
+     * robots) awake for very little radio time.
+     */
+    SpheroKeepaliveOptions keepalive;
+
+    /**
+     * Sent to every spare as it joins the pool, e.g. the show's stream
+     * and collision setup, so promoting it only has to restore what
+     * differs per robot.
+     */
+    std::vector<SpheroSharedFramePtr> prepare;
+
+    std::chrono::milliseconds applyTimeout;     // for all of a batch of settings
+
+    SpheroStandbyOptions() :
+        applyTimeout(500) {
+        keepalive.interval = std::chrono::milliseconds(5000);
+        keepalive.missedBeats = 2;
+    }
+};
+
+/**
+ * The outcome of replacing one active robot with a spare.
+ */
+struct SpheroFailoverResult {
+    bool promoted;                          // false if no spare was ready
+    std::unique_ptr<SpheroHandler> failed;  // the robot that was replaced
+    std::size_t settings;                   // settings replayed on the spare
+    std::size_t applied;                    // of which acknowledged
+    std::chrono::microseconds latency;      // from the call to the last answer
+
+    SpheroFailoverResult() :
+        promoted(false), settings(0), applied(0), latency(0) {
+    }
+};
+
+/**
+ * Connected spare robots, held ready to stand in for an active one.
+ *
+ * Connecting a robot takes seconds (tens of them with discovery and
+ * retries); a spare has paid for that up front. While it waits, each
+ * spare has a SpheroKeepalive of its own, so one that drops off or
+ * falls asleep is noticed and discarded instead of being handed out.
+ *
+ * promote() swaps a spare into the slot of a failed robot and replays
+ * the failed robot's settings on it, as recorded by its SpheroShadow.
+ * Everything attached to the failed robot (shadow, events, pose...)
+ * stays attached to it and has to be recreated for the new one.
+ */
+class SpheroStandbyPool {
+    struct Spare {
+        std::unique_ptr<SpheroHandler> robot;
+        std::unique_ptr<SpheroKeepalive> keepalive;
+    };
+
+    SpheroStandbyOptions options_;
+    mutable std::mutex mutex_;
+    std::deque<Spare> spares_;
+    uint64_t lost_;
+
+    std::vector<Spare> pruneLocked();
+
+public:
+    explicit SpheroStandbyPool(SpheroStandbyOptions const& options = SpheroStandbyOptions());
+
+    /**
+     * Send frames to robot all at once and wait (at most timeout) for
+     * their answers, without retrying any. Returns how many were
+     * acknowledged.
+     */
+    static std::size_t apply(SpheroHandler & robot,
+                             std::vector<SpheroSharedFramePtr> const& frames,
+                             std::chrono::milliseconds timeout);
+
+    /**
+     * Prepare robot and keep it as a spare. Returns false, and drops
+     * robot, if it didn't acknowledge every prepare frame.
+     */
+    bool add(std::unique_ptr<SpheroHandler> robot);
+
+    /**
+     * add() every robot that connected. Returns how many were kept.
+     */
+    std::size_t add(std::vector<SpheroConnectResult> && results);
+
+    /**
+     * Hand out the longest waiting live spare, without its keepalive.
+     * Returns null if there is none.
+     */
+    std::unique_ptr<SpheroHandler> take();
+
+    /**
+     * Put a spare in place of active and replay settings on it. The
+     * robot that was in active is returned in the result.
+     */
+    SpheroFailoverResult promote(std::unique_ptr<SpheroHandler> & active,
+                                 std::vector<SpheroSharedFramePtr> const& settings);
+
+    SpheroFailoverResult promote(SpheroFleet & fleet, std::size_t index,
+                                 std::vector<SpheroSharedFramePtr> const& settings) {
+        return promote(fleet.robots().at(index), settings);
+    }
+
+    /**
+     * Live spares. Dead ones are dropped along the way.
+     */
+    std::size_t ready();
+
+    uint64_t lost() const;                  // spares dropped for a dead link
+};
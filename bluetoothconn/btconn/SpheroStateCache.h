@@ -0,0 +1,141 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Read-through cache of a robot's state, one entry per query command
+ * (GetPowerState, Version, GetBTName, GetRGB, ReadLocator, ...).
+ *
+ * Entries are filled from every response to a query, whoever sent it,
+ * and - while the robot streams odometer and velocity X and Y (see
+ * SpheroHandler::streamingLayout()) - ReadLocator is also kept current
+ * from streamed sensor data. A get() within the entry's time-to-live
+ * costs no link traffic. Concurrent gets of the same stale entry share
+ * a single round trip. Commands that change a cached value (SetRGB,
+ * SetBTName, SetLocator) drop the entry when the robot acknowledges them.
+ * All methods are thread-safe.
+ */
+class SpheroStateCache {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    /**
+     * SetDataStreaming MASK2 bits the locator is built from.
+     */
+    enum {
+        STREAM_ODOMETER_X = 0x08000000,
+        STREAM_ODOMETER_Y = 0x04000000,
+        STREAM_VELOCITY_X = 0x01000000,
+        STREAM_VELOCITY_Y = 0x00800000,
+        LOCATOR_DATA_SIZE = 10      // X, Y, VX, VY, SOG
+    };
+
+private:
+    struct Entry {
+        SpheroResponsePtr value;
+        Clock::time_point at;
+        Clock::duration ttl;        // 0 = never served from the cache
+        bool fetching;
+        uint64_t generation;        // bumped on every store
+
+        Entry() :
+            ttl(0), fetching(false), generation(0) {
+        }
+    };
+
+    SpheroHandler & robot_;
+    int observerId_;
+    mutable std::mutex mutex_;
+    std::condition_variable stored_;
+    std::array<Entry, SPHERO_COMMAND_SLOTS> entries_;
+    uint64_t hits_;
+    uint64_t fetches_;
+    uint64_t joined_;
+
+    void onFrame(unsigned char const* frame, std::size_t len, unsigned slot);
+    void store(unsigned slot, SpheroResponsePtr const& value);
+
+    SpheroResponsePtr get(unsigned slot, SpheroSharedFramePtr (*encode)(),
+                          std::chrono::milliseconds timeout);
+
+    template <class CMD>
+    static SpheroSharedFramePtr encodeQuery() {
+        return SpheroSharedFrame::encode(CMD());
+    }
+
+public:
+    /**
+     * Attach to robot, which must outlive the cache. Entries start with
+     * TTLs suited to how often each value changes; see setTtl().
+     */
+    explicit SpheroStateCache(SpheroHandler & robot);
+    ~SpheroStateCache();
+
+    /**
+     * How long a response to CMD stays fresh. A TTL of 0 disables
+     * caching, though concurrent gets still share a round trip.
+     */
+    template <class CMD>
+    void setTtl(Clock::duration ttl) {
+        setTtl(CMD::slot(), ttl);
+    }
+    void setTtl(unsigned slot, Clock::duration ttl);
+
+    /**
+     * The response to CMD: the cached one if fresh, otherwise fetched from
+     * the robot, waiting at most timeout; within it the query is retried
+     * as CMD's retry policy allows. Returns null if no response arrived
+     * in time. Responses are shared and must not be modified.
+     */
+    template <class CMD>
+    SpheroResponsePtr get(std::chrono::milliseconds timeout = std::chrono::milliseconds(1000)) {
+        return get(CMD::slot(), &encodeQuery<CMD>, timeout);
+    }
+
+    /**
+     * The cached response to CMD, fresh or not, without touching the
+     * link; null if there is none. age tells how old it is.
+     */
+    template <class CMD>
+    SpheroResponsePtr peek(Clock::duration * age = nullptr) const {
+        return peek(CMD::slot(), age);
+    }
+    SpheroResponsePtr peek(unsigned slot, Clock::duration * age = nullptr) const;
+
+    template <class CMD>
+    void invalidate() {
+        invalidate(CMD::slot());
+    }
+    void invalidate(unsigned slot);
+    void invalidateAll();
+
+    /**
+     * Build the data segment of a ReadLocator response out of the last
+     * sample in a sensor streaming packet, converting the streamed
+     * velocities from mm/s to ReadLocator's cm/s. Returns false if the
+     * masks don't include the fields needed or the packet is short.
+     */
+    static bool locatorFromStream(uint32_t mask1, uint32_t mask2,
+                                  unsigned char const* data, std::size_t len,
+                                  unsigned char (&locator)[LOCATOR_DATA_SIZE]);
+
+    uint64_t hits() const;          // gets answered from the cache
+    uint64_t fetches() const;       // round trips made by gets
+    uint64_t joined() const;        // gets that waited on another's round trip
+};
@@ -0,0 +1,136 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+/**
+ * Where the fields of a sensor streaming packet (ASYNC_SENSOR_DATA) sit
+ * for a pair of SetDataStreaming masks. Each field is a big-endian int16,
+ * in mask bit order from MASK1 bit 31 down to MASK2 bit 0, and a packet
+ * holds a whole number of samples.
+ */
+class SpheroStreamLayout {
+    uint64_t masks_;        // MASK1 high
+    unsigned fields_;
+
+    static unsigned bitCount(uint64_t v) {
+        unsigned n = 0;
+        for (; v; v &= v - 1) ++n;
+        return n;
+    }
+
+public:
+    SpheroStreamLayout() :
+        masks_(0), fields_(0) {
+    }
+    SpheroStreamLayout(uint32_t mask1, uint32_t mask2) :
+        masks_(((uint64_t)mask1 << 32) | mask2), fields_(bitCount(masks_)) {
+    }
+    explicit SpheroStreamLayout(uint64_t masks) :
+        masks_(masks), fields_(bitCount(masks)) {
+    }
+
+    uint64_t masks() const {
+        return masks_;
+    }
+    uint32_t mask1() const {
+        return (uint32_t)(masks_ >> 32);
+    }
+    uint32_t mask2() const {
+        return (uint32_t)masks_;
+    }
+    unsigned fields() const {
+        return fields_;
+    }
+    std::size_t sampleSize() const {
+        return 2 * (std::size_t)fields_;
+    }
+
+    /**
+     * Whole samples in a data segment of len bytes; 0 while the layout
+     * is empty.
+     */
+    std::size_t samples(std::size_t len) const {
+        return fields_ ? len / sampleSize() : 0;
+    }
+
+    /**
+     * Byte offset within a sample of the field of a single MASK1 or MASK2
+     * bit (pass 0 for the other mask), or -1 if it isn't streamed.
+     */
+    int offset(uint32_t mask1Bit, uint32_t mask2Bit) const {
+        uint64_t bit = ((uint64_t)mask1Bit << 32) | mask2Bit;
+        if (!(masks_ & bit)) return -1;
+        return 2 * (int)bitCount(masks_ & ~(bit | (bit - 1)));
+    }
+
+    static short value(unsigned char const* field) {
+        return (short)(uint16_t)((field[0] << 8) | field[1]);
+    }
+
+    bool operator==(SpheroStreamLayout const& other) const {
+        return masks_ == other.masks_;
+    }
+    bool operator!=(SpheroStreamLayout const& other) const {
+        return masks_ != other.masks_;
+    }
+};
+
+/**
+ * Times the samples of consecutive streaming packets. A packet holding
+ * several samples is sent once the last of them is taken, so they are
+ * spread evenly over the time since the previous packet.
+ */
+class SpheroStreamClock {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+private:
+    Clock::time_point last_;
+    Clock::duration spacing_;
+    std::size_t count_;
+
+public:
+    SpheroStreamClock() :
+        spacing_(0), count_(0) {
+    }
+
+    /**
+     * Start on a packet of count (at least 1) samples that arrived at
+     * arrival.
+     */
+    void packet(Clock::time_point arrival, std::size_t count) {
+        spacing_ = Clock::duration(0);
+        if (last_ != Clock::time_point() && arrival > last_)
+            spacing_ = (arrival - last_) / (Clock::rep)count;
+        last_ = arrival;
+        count_ = count;
+    }
+
+    /**
+     * When sample i of the current packet was taken.
+     */
+    Clock::time_point at(std::size_t i) const {
+        return last_ - spacing_ * (Clock::rep)(count_ - 1 - i);
+    }
+
+    void reset() {
+        *this = SpheroStreamClock();
+    }
+};
@@ -0,0 +1,196 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Which streamed channels a SpheroTelemetry records, and how much memory
+ * each one gets. Nothing is allocated after construction.
+ */
+struct SpheroTelemetryOptions {
+    uint32_t mask1;                 // SetDataStreaming MASK1 bits to record
+    uint32_t mask2;                 // SetDataStreaming MASK2 bits to record
+    std::size_t rawSamples;         // full-resolution samples kept per channel
+    unsigned tiers;                 // downsampled tiers below the raw samples
+    std::size_t bucketsPerTier;     // buckets kept per channel and tier
+    unsigned decimation;            // inputs merged into one bucket of the next tier
+
+    /**
+     * At 400Hz: 5s of raw samples, then 15s at 40Hz, 150s at 4Hz and
+     * 25min at 0.4Hz, in about 44KB per channel.
+     */
+    SpheroTelemetryOptions() :
+        mask1(0), mask2(0), rawSamples(2000), tiers(3), bucketsPerTier(600), decimation(10) {
+    }
+};
+
+/**
+ * Fixed-memory history of a robot's streamed sensor channels.
+ *
+ * Every channel keeps a ring of its latest raw samples plus a cascade of
+ * downsampled tiers: each bucket of tier 1 holds the min, max and mean of
+ * options.decimation raw samples, each bucket of tier 2 those of
+ * options.decimation tier 1 buckets, and so on. Old data is overwritten,
+ * so memory use is fixed by the options; see bytesPerChannel().
+ *
+ * Samples are written by the io thread as streaming packets arrive.
+ * Readers copy out a consistent snapshot without taking a lock, so they
+ * never hold up the io thread; a reader racing the writer only loses the
+ * entries overwritten while it was copying.
+ *
+ * Channels are numbered in streaming order, MASK1 bit 31 being channel 0
+ * and MASK2 bit 0 channel 63; see channel().
+ */
+class SpheroTelemetry {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    enum { CHANNELS = 64 };
+
+    struct Sample {
+        Clock::time_point at;
+        short value;
+    };
+
+    struct Bucket {
+        Clock::time_point start;        // time of the first sample in it
+        short min;
+        short max;
+        float mean;
+    };
+
+private:
+    /**
+     * Single-writer ring of packed entries. The writer publishes an entry
+     * by advancing head; readers check head again after copying to drop
+     * anything overwritten in the meantime.
+     */
+    struct Ring {
+        std::unique_ptr<boost::atomic<uint64_t>[]> words;
+        std::size_t capacity;
+        unsigned wordsPerEntry;
+        boost::atomic<uint64_t> head;   // entries ever written
+
+        Ring(std::size_t entries, unsigned width);
+        void push(uint64_t const* entry);
+        uint64_t copy(std::vector<uint64_t> & out) const;
+    };
+
+    /**
+     * A bucket being filled; only touched by the writer.
+     */
+    struct Partial {
+        uint64_t start;
+        short min;
+        short max;
+        double sum;
+        uint64_t samples;
+        unsigned inputs;
+    };
+
+    struct Channel {
+        Ring raw;
+        std::vector<std::unique_ptr<Ring>> tiers;
+        std::vector<Partial> partials;
+
+        Channel(SpheroTelemetryOptions const& options);
+    };
+
+    SpheroTelemetryOptions options_;
+    SpheroHandler * robot_;
+    int observerId_;
+    Clock::time_point epoch_;
+    std::array<std::unique_ptr<Channel>, CHANNELS> channels_;
+    boost::atomic<uint64_t> layout_;    // set when fed through feed()
+    SpheroStreamClock clock_;           // writer only
+    boost::atomic<uint64_t> packets_;
+    boost::atomic<uint64_t> samples_;
+    boost::atomic<uint64_t> unparsed_;
+
+    void init();
+    void record(Channel & channel, uint64_t micros, short value);
+    void merge(Channel & channel, unsigned tier, uint64_t start,
+               short min, short max, double sum, uint64_t samples);
+
+public:
+    /**
+     * Record streaming packets received by robot, which must outlive
+     * this object.
+     */
+    SpheroTelemetry(SpheroHandler & robot,
+                    SpheroTelemetryOptions const& options = SpheroTelemetryOptions());
+
+    /**
+     * A store that is only fed through feed().
+     */
+    explicit SpheroTelemetry(SpheroTelemetryOptions const& options);
+    ~SpheroTelemetry();
+
+    /**
+     * The channel number of a single MASK1 or MASK2 bit (pass 0 for the
+     * other mask).
+     */
+    static unsigned channel(uint32_t mask1Bit, uint32_t mask2Bit);
+
+    /**
+     * Memory a recorded channel takes with options.
+     */
+    static std::size_t bytesPerChannel(SpheroTelemetryOptions const& options);
+
+    /**
+     * For a store fed through feed(), the masks last sent with
+     * SetDataStreaming, which decide where each channel sits in a packet;
+     * packets are ignored until this is called. One recording a robot
+     * follows the robot's streamingLayout().
+     */
+    void setStreamingMask(uint32_t mask1, uint32_t mask2);
+
+    /**
+     * Record the samples in the data segment of a streaming packet that
+     * arrived at arrival. Samples of a packet holding several are spread
+     * out over the time since the previous packet. Called from the io
+     * thread; there must only be one caller at a time.
+     */
+    void feed(unsigned char const* data, std::size_t len, Clock::time_point arrival);
+
+    bool recorded(unsigned channel) const {
+        return channel < CHANNELS && channels_[channel] != nullptr;
+    }
+
+    /**
+     * The raw samples of channel still held, oldest first.
+     */
+    std::vector<Sample> raw(unsigned channel) const;
+
+    /**
+     * The buckets of tier (1 to options.tiers) of channel, oldest first.
+     */
+    std::vector<Bucket> tier(unsigned channel, unsigned tier) const;
+
+    std::size_t memoryBytes() const;
+
+    uint64_t packets() const {
+        return packets_.load(boost::memory_order_relaxed);
+    }
+    uint64_t samples() const {                  // per channel
+        return samples_.load(boost::memory_order_relaxed);
+    }
+    uint64_t unparsed() const {                 // no layout, or too short
+        return unparsed_.load(boost::memory_order_relaxed);
+    }
+};
@@ -0,0 +1,330 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * On-disk layout of a telemetry log. Integers are in native (little-endian)
+ * byte order and every structure starts on an 8 byte boundary.
+ *
+ * The file is a sequence of segments, each segmentBytes long:
+ *
+ *     SegmentHeader | Block | Block | ... | unused | Footer[2]
+ *
+ * A block holds up to capacity rows of one source (robot): its header, a
+ * column of uint64 timestamps (microseconds since the log's epoch), then
+ * one int16 column per channel of the source's streaming mask, in
+ * streaming order, each capacity entries long.
+ *
+ * Nothing is valid until a footer says so. Commits are numbered; commit n
+ * writes the row count of each block it covers into rows[n & 1] along
+ * with n, then footers[n & 1]. A reader takes the footer with a good
+ * checksum and the highest number, and from each block below its end the
+ * row count with the highest number not above it. A crash at any point
+ * leaves the previous commit readable.
+ *
+ * A block flagged BLOCK_COMPRESSED instead holds bytes bytes of
+ * SpheroDeltaCodec streams after its header: the four 16 bit words of
+ * the timestamps, low word first, then each channel, every stream
+ * capacity values long. It is complete when written, so its row count
+ * (equal to capacity) is only set for the commit that covers it.
+ */
+struct SpheroTelemetryLogFormat {
+    enum {
+        SEGMENT_MAGIC = 0x474C5442,     // "BTLG"
+        BLOCK_MAGIC = 0x4B4C4254,       // "BTLK"
+        FOOTER_MAGIC = 0x46544C42,      // "BLTF"
+        VERSION = 1,
+        BLOCK_COMPRESSED = 1            // BlockHeader::flags
+    };
+
+    struct SegmentHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t segmentBytes;
+        uint64_t index;                 // position in the file
+        int64_t epoch;                  // system clock at timestamp 0, in us
+        uint64_t reserved[2];
+    };
+
+    struct RowCount {
+        uint64_t commit;
+        uint64_t rows;
+    };
+
+    struct BlockHeader {
+        uint32_t magic;
+        uint32_t source;
+        uint32_t mask1;                 // SetDataStreaming masks
+        uint32_t mask2;
+        uint32_t capacity;              // rows
+        uint32_t columns;               // channels, not counting timestamps
+        RowCount rows[2];
+        uint32_t flags;
+        uint32_t bytes;                 // after the header, if compressed
+    };
+
+    struct Footer {
+        uint32_t magic;
+        uint32_t sealed;                // nothing more is written to the segment
+        uint64_t commit;
+        uint64_t end;                   // offset just past the last block
+        uint64_t checksum;
+    };
+
+    static uint64_t blockBytes(uint32_t capacity, uint32_t columns) {
+        uint64_t bytes = sizeof(BlockHeader) + 8ULL * capacity + 2ULL * capacity * columns;
+        return (bytes + 7) & ~7ULL;
+    }
+
+    static uint64_t compressedBlockBytes(uint32_t bytes) {
+        return (sizeof(BlockHeader) + (uint64_t)bytes + 7) & ~7ULL;
+    }
+
+    static uint64_t footerOffset(uint64_t segmentBytes, uint64_t commit) {
+        return segmentBytes - (2 - (commit & 1)) * sizeof(Footer);
+    }
+
+    static uint64_t checksum(Footer const& footer) {
+        // FNV-1a over everything ahead of the checksum
+        uint64_t hash = 14695981039346656037ULL;
+        unsigned char const* p = (unsigned char const*)&footer;
+        for (std::size_t i = 0; i < offsetof(Footer, checksum); ++i) {
+            hash ^= p[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+};
+
+/**
+ * How a SpheroTelemetryLog lays out and commits its file.
+ */
+struct SpheroTelemetryLogOptions {
+    std::size_t segmentBytes;                   // the file grows by this much
+    uint32_t blockRows;                         // rows per block and source
+    std::chrono::milliseconds commitInterval;   // longest time between footers
+
+    /**
+     * Flush to disk around every footer, so a commit also survives a
+     * power loss. Without it, commits survive the process crashing but
+     * are only as durable as the OS's write-back makes them.
+     */
+    bool durable;
+
+    /**
+     * Keep up to blockRows rows of each source in memory and write them
+     * delta compressed (see SpheroDeltaCodec) when that many have been
+     * gathered or at the next commit, whichever comes first. Slowly
+     * changing channels take a fraction of the space, but rows are only
+     * in the file once committed, and a short commitInterval makes for
+     * small blocks that compress less.
+     */
+    bool compress;
+
+    SpheroTelemetryLogOptions() :
+        segmentBytes(16 << 20), blockRows(400), commitInterval(1000),
+        durable(false), compress(false) {
+    }
+};
+
+/**
+ * Append-only, columnar log of every streamed sensor sample of any number
+ * of robots, written through a memory-mapped segment of the file.
+ *
+ * Each robot is a source with its own streaming layout. Rows are copied
+ * straight into the mapping; the file is only touched when a segment
+ * fills up and a new one is mapped. Every commitInterval (and on close)
+ * a footer makes everything appended so far durable. See
+ * SpheroTelemetryLogFormat for the layout and SpheroTelemetryLogReader
+ * for reading it back.
+ *
+ * All methods are thread-safe, so sources can be fed from their robots'
+ * io threads. Constructing the log and mapping further segments throw
+ * boost::interprocess::interprocess_exception on I/O errors.
+ */
+class SpheroTelemetryLog {
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef SpheroTelemetryLogFormat Format;
+
+private:
+    struct Source {
+        uint32_t mask1;
+        uint32_t mask2;
+        unsigned columns;
+        Format::BlockHeader * block;    // null until the first row
+        uint32_t capacity;              // rows the current block (or stage) holds
+        uint32_t rows;
+        std::vector<uint64_t> stagedMicros;     // rows waiting to be compressed
+        std::vector<short> staged;
+        SpheroStreamClock clock;
+        SpheroHandler * robot;
+        int observerId;
+    };
+
+    std::string path_;
+    SpheroTelemetryLogOptions options_;
+    std::mutex mutex_;
+    boost::interprocess::file_mapping file_;
+    boost::interprocess::mapped_region region_;
+    unsigned char * base_;
+    uint64_t segment_;
+    uint64_t end_;                      // allocation frontier in the segment
+    uint64_t commit_;
+    Clock::time_point epoch_;
+    Clock::time_point lastCommit_;
+    std::vector<Source> sources_;
+    std::vector<Format::BlockHeader *> filled_;     // since the last commit
+    std::vector<short> words_;
+    std::vector<unsigned char> packed_;
+    uint64_t rowsWritten_;
+    uint64_t bytesWritten_;
+    bool closed_;
+
+    void mapSegment(uint64_t index);
+    void nextSegment();
+    unsigned char * reserve(uint64_t bytes);
+    void startBlock(Source & source);
+    void writeCompressed(Source & source);
+    unsigned char * nextRow(Source & source, uint64_t micros);
+    void writeFooter(bool sealed);
+    void commitLocked(bool sealed);
+    uint64_t micros(Clock::time_point at) const;
+
+public:
+    /**
+     * Create (or truncate) the log file at path and map its first segment.
+     */
+    explicit SpheroTelemetryLog(std::string const& path,
+                                SpheroTelemetryLogOptions const& options = SpheroTelemetryLogOptions());
+    ~SpheroTelemetryLog();
+
+    /**
+     * Add a source streaming with the given SetDataStreaming masks.
+     * Returns its number for append() and feed().
+     */
+    unsigned addSource(uint32_t mask1, uint32_t mask2);
+
+    /**
+     * Add a source and record every streaming packet robot receives,
+     * except while the robot's streamingLayout() is known to differ from
+     * the given masks. robot must outlive the log or be detached first.
+     */
+    unsigned attach(SpheroHandler & robot, uint32_t mask1, uint32_t mask2);
+    void detach(unsigned source);
+
+    /**
+     * Append one row: values holds one value per channel of the source,
+     * in streaming order.
+     */
+    void append(unsigned source, Clock::time_point at, short const* values);
+
+    /**
+     * Append the samples in the data segment of a streaming packet that
+     * arrived at arrival. Samples of a packet holding several are spread
+     * out over the time since the source's previous packet.
+     */
+    void feed(unsigned source, unsigned char const* data, std::size_t len,
+              Clock::time_point arrival);
+
+    /**
+     * Write a footer now rather than at the next commit interval.
+     */
+    void commit();
+
+    /**
+     * Commit, detach every robot and unmap the file. Called on destruction.
+     */
+    void close();
+
+    uint64_t rowsWritten();
+    uint64_t commits();
+
+    /**
+     * Bytes of blocks written so far, headers included. Against the
+     * 8 + 2 * columns bytes a row takes uncompressed, this gives the
+     * compression ratio.
+     */
+    uint64_t bytesWritten();
+};
+
+/**
+ * Read-only view of a telemetry log, including one still being written.
+ * Columns point straight into the mapped file: nothing is copied, and
+ * the pointers stay valid for as long as the reader lives. Only what the
+ * last footer of each segment committed is visible.
+ */
+class SpheroTelemetryLogReader {
+public:
+    typedef SpheroTelemetryLogFormat Format;
+
+    struct Block {
+        uint32_t source;
+        uint32_t mask1;
+        uint32_t mask2;
+        uint64_t rows;
+        int64_t epoch;                  // system clock at timestamp 0, in us
+        uint64_t const* micros;         // timestamps
+        short const* data;
+        uint32_t capacity;
+        uint32_t columns;
+        bool compressed;                // micros and data are null, see decode()
+        unsigned char const* packed;
+        uint32_t packedBytes;
+
+        /**
+         * The i-th channel of the block, in streaming order.
+         */
+        short const* column(unsigned i) const {
+            return data + (std::size_t)i * capacity;
+        }
+    };
+
+private:
+    boost::interprocess::file_mapping file_;
+    boost::interprocess::mapped_region region_;
+    std::vector<Block> blocks_;
+    std::size_t segments_;
+
+    void scanSegment(unsigned char const* segment, uint64_t segmentBytes);
+
+public:
+    /**
+     * Map the log at path. Throws
+     * boost::interprocess::interprocess_exception if it can't be opened.
+     */
+    explicit SpheroTelemetryLogReader(std::string const& path);
+
+    std::vector<Block> const& blocks() const {
+        return blocks_;
+    }
+    std::size_t segments() const {
+        return segments_;
+    }
+    uint64_t rows() const;
+
+    /**
+     * Copy the rows of a block into micros and data, decompressing it if
+     * needed. data is laid out like a block of capacity rows, so
+     * data.data() + i * block.rows is the i-th channel. Returns false if
+     * a compressed block is corrupt.
+     */
+    static bool decode(Block const& block, std::vector<uint64_t> & micros,
+                       std::vector<short> & data);
+};
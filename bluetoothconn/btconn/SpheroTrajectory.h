@@ -0,0 +1,135 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * A time-indexed sequence of commands for one robot, e.g. the Roll and
+ * SetRGB setpoints of a choreography. Each command is encoded once when
+ * added. Steps may be added in any order.
+ */
+class SpheroTrajectory {
+public:
+    struct Step {
+        std::chrono::microseconds at;   // offset from the start
+        SpheroSharedFramePtr frame;
+    };
+
+private:
+    std::vector<Step> steps_;
+
+public:
+    /**
+     * Send cmd at offset t. Setpoints usually don't need an answer, and
+     * unanswered commands leave nothing behind in the read queue.
+     */
+    template <unsigned char DID, unsigned char CID>
+    SpheroTrajectory & at(std::chrono::microseconds t,
+                          SpheroCommand<DID, CID> const& cmd,
+                          bool answer = false) {
+        Step step = { t, SpheroSharedFrame::encode(cmd, answer) };
+        steps_.push_back(step);
+        return *this;
+    }
+
+    std::vector<Step> const& steps() const {
+        return steps_;
+    }
+    std::chrono::microseconds duration() const {
+        std::chrono::microseconds ret(0);
+        for (auto const& step : steps_)
+            ret = (std::max)(ret, step.at);
+        return ret;
+    }
+};
+
+/**
+ * Plays a SpheroTrajectory on a robot from its connection's io thread.
+ *
+ * Every step is scheduled at an absolute time (start + offset) on a
+ * steady_timer, so a late wake-up delays only that step and never
+ * accumulates into drift. On Linux asio backs these timers with timerfd;
+ * on Windows their resolution follows the system timer resolution.
+ * How late each step actually went out is recorded in a histogram.
+ */
+class SpheroTrajectoryExecutor {
+public:
+    typedef std::function<void(bool completed)> CompletionHandler;
+
+    struct Options {
+        /**
+         * Steps due more than this long ago when their turn comes are
+         * dropped, unless they're the last step due; 0 sends every step.
+         */
+        std::chrono::microseconds dropLaterThan;
+
+        Options() :
+            dropLaterThan(0) {
+        }
+    };
+
+private:
+    // Shared with the timer handlers, which may outlive the executor
+    struct Stats {
+        LatencyHistogram lateness;
+        boost::atomic<uint64_t> sent;
+        boost::atomic<uint64_t> dropped;
+
+        Stats() : sent(0), dropped(0) {
+        }
+    };
+    struct Run;
+
+    SpheroHandler & robot_;
+    Options options_;
+    std::shared_ptr<Stats> stats_;
+    std::shared_ptr<Run> run_;
+
+public:
+    explicit SpheroTrajectoryExecutor(SpheroHandler & robot,
+                                      Options const& options = Options());
+
+    /**
+     * Cancels a run in progress.
+     */
+    ~SpheroTrajectoryExecutor();
+
+    /**
+     * Start playing trajectory now, replacing any run in progress.
+     * onComplete is called on the io thread when the last step has been
+     * sent (true) or the run was cancelled (false).
+     */
+    void start(SpheroTrajectory const& trajectory,
+               CompletionHandler onComplete = nullptr);
+
+    void cancel();
+    bool isRunning() const;
+
+    /**
+     * Actual minus scheduled send time of every step sent, in microseconds.
+     */
+    LatencyHistogram & lateness() {
+        return stats_->lateness;
+    }
+    uint64_t stepsSent() const {
+        return stats_->sent.load(boost::memory_order_relaxed);
+    }
+    uint64_t stepsDropped() const {
+        return stats_->dropped.load(boost::memory_order_relaxed);
+    }
+};
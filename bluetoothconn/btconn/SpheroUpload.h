@@ -0,0 +1,151 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Describes how a program is uploaded: the command carrying each chunk,
+ * bytes to put in front of every chunk, and an optional command that
+ * clears whatever was uploaded before.
+ */
+struct SpheroUploadProtocol {
+    static const std::size_t MAX_DATA = 254;    // DLEN is one byte and counts the checksum
+
+    unsigned char did;
+    unsigned char cid;
+    std::vector<unsigned char> prefix;
+    SpheroSharedFramePtr begin;                 // may be null
+    int cacheTarget;                            // a SpheroUploadCache::Target
+
+    SpheroUploadProtocol(unsigned char d, unsigned char c,
+                         int target = SpheroUploadCache::TARGET_NONE) :
+        did(d), cid(c), cacheTarget(target) {
+    }
+
+    std::size_t maxChunk() const {
+        return MAX_DATA - prefix.size();
+    }
+
+    /**
+     * Temporary macros, sent with Append Macro Chunk.
+     */
+    static SpheroUploadProtocol macro();
+
+    /**
+     * orbBasic programs, sent with Append Fragment after erasing the
+     * area (0 for RAM, 1 for persistent storage).
+     */
+    static SpheroUploadProtocol orbBasic(unsigned char area = 0);
+};
+
+struct SpheroUploadOptions {
+    std::size_t window;                     // chunks in flight at once
+    std::chrono::milliseconds timeout;      // per chunk response
+    unsigned maxRetries;                    // failed chunks tolerated per upload
+
+    SpheroUploadOptions() :
+        window(4), timeout(1000), maxRetries(3) {
+    }
+};
+
+struct SpheroUploadProgress {
+    std::size_t bytesDone;
+    std::size_t bytesTotal;
+    std::size_t chunksDone;
+    std::size_t chunksTotal;
+    std::chrono::microseconds elapsed;
+
+    double bytesPerSecond() const {
+        if (elapsed.count() <= 0) return 0.0;
+        return bytesDone * 1e6 / elapsed.count();
+    }
+};
+
+struct SpheroUploadResult {
+    bool ok;
+    bool skipped;                           // already on the robot, nothing sent
+    SpheroUploadProgress progress;
+    unsigned retries;                       // chunks sent again after a failure
+    unsigned restarts;                      // uploads started over from the first chunk
+    std::string error;
+
+    SpheroUploadResult() :
+        ok(false), skipped(false), retries(0), restarts(0) {
+    }
+};
+
+/**
+ * Uploads macros and orbBasic programs in maximal chunks, keeping a
+ * window of chunks in flight instead of waiting a round trip for each
+ * one, so the upload is bound by link bandwidth rather than latency.
+ *
+ * Chunks are appended by the robot in the order they arrive. A chunk that
+ * the robot rejects is sent again on its own if none of the chunks behind
+ * it were accepted. Otherwise the program on the robot is out of order:
+ * if the protocol has a begin command the upload starts over, else it
+ * fails. After the first failure the rest of the upload is sent one chunk
+ * at a time.
+ *
+ * With a SpheroUploadCache, a program the robot is known to hold already
+ * is not sent again.
+ */
+class SpheroUploader {
+public:
+    typedef std::function<void(SpheroUploadProgress const&)> ProgressHandler;
+
+private:
+    SpheroHandler & robot_;
+    SpheroUploadOptions options_;
+    ProgressHandler onProgress_;
+    SpheroUploadCache * cache_;
+
+    bool sendBegin(SpheroUploadProtocol const& protocol, std::string & error);
+
+public:
+    explicit SpheroUploader(SpheroHandler & robot,
+                            SpheroUploadOptions const& options = SpheroUploadOptions()) :
+        robot_(robot), options_(options), cache_(nullptr) {
+    }
+
+    /**
+     * Called after every acknowledged chunk, on the uploading thread.
+     */
+    void setProgressHandler(ProgressHandler handler) {
+        onProgress_ = handler;
+    }
+
+    /**
+     * Skip uploads the cache knows to be current, and record successful
+     * ones in it. The cache must outlive this uploader.
+     */
+    void setCache(SpheroUploadCache * cache) {
+        cache_ = cache;
+    }
+
+    SpheroUploadResult upload(SpheroUploadProtocol const& protocol,
+                              unsigned char const* data, std::size_t len);
+
+    SpheroUploadResult uploadMacro(std::vector<unsigned char> const& macro) {
+        return upload(SpheroUploadProtocol::macro(), macro.data(), macro.size());
+    }
+
+    SpheroUploadResult uploadOrbBasic(std::string const& program, unsigned char area = 0) {
+        return upload(SpheroUploadProtocol::orbBasic(area),
+            (unsigned char const*)program.data(), program.size());
+    }
+};
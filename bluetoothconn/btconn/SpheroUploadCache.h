@@ -0,0 +1,142 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/**
+ * Remembers, per device, a hash of the macro or orbBasic program last
+ * uploaded to each storage target, so unchanged programs aren't sent
+ * again on every reconnect or show restart.
+ *
+ * Temporary macros and orbBasic programs in RAM are lost when a robot
+ * sleeps or resets. Entries for those targets are dropped by
+ * deviceReset(), which a SpheroUploadWatch calls whenever a connected
+ * robot may have lost them, and expire on their own once the device
+ * hasn't been heard from for longer than its inactivity timeout (after
+ * which it will have gone to sleep). Programs stored in flash are kept
+ * until replaced or forgotten. All methods are thread-safe.
+ */
+class SpheroUploadCache {
+public:
+    enum Target {
+        TARGET_NONE = -1,
+        TARGET_TEMP_MACRO = 0,
+        TARGET_ORBBASIC_RAM = 1,
+        TARGET_ORBBASIC_FLASH = 2
+    };
+
+    struct Entry {
+        uint64_t device;
+        int target;
+        uint64_t hash;
+        std::size_t length;
+        std::time_t stored;
+        std::time_t lastContact;
+    };
+
+private:
+    std::string path_;
+    std::chrono::seconds volatileLifetime_;
+    std::vector<Entry> entries_;
+    mutable std::mutex mutex_;
+
+    static bool isVolatile(int target) {
+        return target != TARGET_ORBBASIC_FLASH;
+    }
+
+    bool expired(Entry const& entry, std::time_t now) const;
+
+public:
+    /**
+     * volatileLifetime should match the robots' inactivity timeout
+     * (SetInactiveTimerCommand, 600 seconds unless changed).
+     */
+    explicit SpheroUploadCache(std::string const& path = "btconn-uploads.cache",
+                               std::chrono::seconds volatileLifetime = std::chrono::seconds(600));
+
+    bool load();
+    bool save() const;
+
+    /**
+     * 64-bit FNV-1a hash of a program.
+     */
+    static uint64_t hash(unsigned char const* data, std::size_t len);
+
+    /**
+     * A key identifying the device behind an endpoint: its bluetooth
+     * address, or a hash of the endpoint for other transports.
+     */
+    static uint64_t deviceKey(BluetoothProto::endpoint const& endpoint);
+
+    /**
+     * True if exactly this program is known to be stored on the device.
+     */
+    bool isCurrent(uint64_t device, int target,
+                   unsigned char const* data, std::size_t len) const;
+
+    /**
+     * Record a program that was just uploaded successfully.
+     */
+    void stored(uint64_t device, int target,
+                unsigned char const* data, std::size_t len);
+
+    /**
+     * The device was just heard from, so it hasn't gone to sleep.
+     */
+    void touch(uint64_t device);
+
+    /**
+     * The device slept, reset or lost power: forget what was in its RAM.
+     */
+    void deviceReset(uint64_t device);
+
+    void forget(uint64_t device, int target);
+    void forget(uint64_t device);
+
+    std::vector<Entry> entries() const;
+};
+
+/**
+ * Keeps a SpheroUploadCache in step with one connected robot, dropping
+ * the robot's RAM programs from the cache whenever they may be gone:
+ * when the robot warns it is going to sleep (ASYNC_PRE_SLEEP), when its
+ * link is lost, and when a new connection to it is made, since it may
+ * have slept or been power cycled while nobody was connected.
+ *
+ * Call linkLost() from the robot's SpheroKeepalive onDead handler.
+ * Destroy the watch before the robot and the cache.
+ */
+class SpheroUploadWatch {
+    SpheroUploadCache & cache_;
+    SpheroHandler & robot_;
+    uint64_t device_;
+    int observerId_;
+
+public:
+    SpheroUploadWatch(SpheroUploadCache & cache, SpheroHandler & robot);
+    ~SpheroUploadWatch();
+
+    /**
+     * The link to the robot died; safe to call from the io thread.
+     */
+    void linkLost();
+
+    uint64_t device() const {
+        return device_;
+    }
+};
@@ -31,8 +31,15 @@
 #include <boost/asio/generic/stream_protocol.hpp>
 #include <boost/throw_exception.hpp>
 #include <boost/atomic.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
 #include <limits>
+#include <functional>
 #include <deque>
 #include <string>
 #include <vector>
@@ -45,3 +52,7 @@
 #include <fstream>
 #include <sstream>
 #include <mutex>
+#include <condition_variable>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
@@ -0,0 +1,201 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/BtDeviceCache.h"
+
+using namespace std;
+
+// One device per line: <address hex> <channel> <last seen> <name...>
+#define DEVICE_CACHE_HEADER "# btconn device cache v1"
+
+BtDeviceCache::BtDeviceCache(std::string const& path) :
+        path_(path) {
+}
+
+BtDeviceCache::Entry & BtDeviceCache::findOrAdd(BTH_ADDR address) {
+    for (auto & entry : entries_) {
+        if (entry.address == address) return entry;
+    }
+
+    Entry entry;
+    entry.address = address;
+    entry.channel = 0;
+    entry.lastSeen = 0;
+    entries_.push_back(entry);
+    return entries_.back();
+}
+
+bool BtDeviceCache::load() {
+    ifstream in(path_.c_str());
+    if (!in) return false;
+
+    vector<Entry> loaded;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        istringstream fields(line);
+        Entry entry;
+        unsigned long long address = 0;
+        unsigned long channel = 0;
+        long long lastSeen = 0;
+        if (!(fields >> hex >> address >> dec >> channel >> lastSeen)) {
+            BtLogger::log() << "Skipping malformed device cache line: "
+                << line << std::endl;
+            continue;
+        }
+        fields >> ws;
+        getline(fields, entry.name);
+
+        entry.address = (BTH_ADDR)address;
+        entry.channel = (ULONG)channel;
+        entry.lastSeen = (std::time_t)lastSeen;
+        loaded.push_back(entry);
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    entries_.swap(loaded);
+    return true;
+}
+
+bool BtDeviceCache::save() const {
+    string tmpPath = path_ + ".tmp";
+    {
+        ofstream out(tmpPath.c_str(), ios::out | ios::trunc);
+        if (!out) return false;
+
+        lock_guard<mutex> lock(mutex_);
+        out << DEVICE_CACHE_HEADER << "\n";
+        for (auto const& entry : entries_) {
+            out << hex << (unsigned long long)entry.address << dec
+                << " " << (unsigned long)entry.channel
+                << " " << (long long)entry.lastSeen
+                << " " << entry.name << "\n";
+        }
+        if (!out.flush()) return false;
+    }
+
+#if defined(_WIN32)
+    if (!MoveFileExA(tmpPath.c_str(), path_.c_str(), MOVEFILE_REPLACE_EXISTING))
+        return false;
+#else
+    if (rename(tmpPath.c_str(), path_.c_str()) != 0)
+        return false;
+#endif
+    return true;
+}
+
+std::vector<BluetoothInqItem> BtDeviceCache::devices(std::string const& prefix) const {
+    vector<Entry> matches;
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (auto const& entry : entries_) {
+            if (entry.name.compare(0, prefix.size(), prefix) == 0)
+                matches.push_back(entry);
+        }
+    }
+
+    stable_sort(matches.begin(), matches.end(),
+        [](Entry const& a, Entry const& b) { return a.lastSeen > b.lastSeen; });
+
+    vector<BluetoothInqItem> ret;
+    for (auto const& entry : matches)
+        ret.push_back(entry.item());
+    return ret;
+}
+
+bool BtDeviceCache::lookup(BTH_ADDR address, Entry & out) const {
+    lock_guard<mutex> lock(mutex_);
+    for (auto const& entry : entries_) {
+        if (entry.address == address) {
+            out = entry;
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<BtDeviceCache::Entry> BtDeviceCache::entries() const {
+    lock_guard<mutex> lock(mutex_);
+    return entries_;
+}
+
+void BtDeviceCache::remember(BluetoothInqItem const& item) {
+    lock_guard<mutex> lock(mutex_);
+    Entry & entry = findOrAdd(item.address.btAddr);
+    entry.name = item.name;
+    if (item.address.port != 0)
+        entry.channel = item.address.port;
+    entry.lastSeen = std::time(nullptr);
+}
+
+void BtDeviceCache::remember(std::string const& name,
+                             BluetoothProto::endpoint const& connected) {
+    if (connected.size() < sizeof(SOCKADDR_BTH) ||
+        connected.protocol().family() != AF_BTH)
+        return;
+
+    SOCKADDR_BTH address;
+    memcpy(&address, connected.data(), sizeof(SOCKADDR_BTH));
+
+    lock_guard<mutex> lock(mutex_);
+    Entry & entry = findOrAdd(address.btAddr);
+    entry.name = name;
+    entry.channel = address.port;
+    entry.lastSeen = std::time(nullptr);
+}
+
+void BtDeviceCache::invalidateChannel(BTH_ADDR address) {
+    lock_guard<mutex> lock(mutex_);
+    for (auto & entry : entries_) {
+        if (entry.address == address) entry.channel = 0;
+    }
+}
+
+void BtDeviceCache::forget(BTH_ADDR address) {
+    lock_guard<mutex> lock(mutex_);
+    entries_.erase(
+        remove_if(entries_.begin(), entries_.end(),
+            [address](Entry const& entry) { return entry.address == address; }),
+        entries_.end());
+}
+
+void BtDeviceCache::prune(std::chrono::seconds maxAge) {
+    std::time_t oldest = std::time(nullptr) - (std::time_t)maxAge.count();
+
+    lock_guard<mutex> lock(mutex_);
+    entries_.erase(
+        remove_if(entries_.begin(), entries_.end(),
+            [oldest](Entry const& entry) { return entry.lastSeen < oldest; }),
+        entries_.end());
+}
+
+std::shared_ptr<BluetoothInquiry> BtDeviceCache::revalidate(
+        boost::asio::io_service & io,
+        BluetoothInquiryOptions const& options,
+        BluetoothInquiry::CompletionHandler onComplete) {
+    return std::make_shared<BluetoothInquiry>(io, options,
+        [this](BluetoothInqItem const& item) {
+            remember(item);
+            return true;
+        },
+        onComplete);
+}
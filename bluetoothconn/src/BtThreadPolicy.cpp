@@ -0,0 +1,102 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/BtThreadPolicy.h"
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+#if defined(_WIN32)
+
+bool BtThreadPolicy::apply() const {
+    bool ok = true;
+
+    if (!cpus.empty()) {
+        DWORD_PTR mask = 0;
+        for (unsigned cpu : cpus) {
+            if (cpu < sizeof(mask) * 8) mask |= (DWORD_PTR)1 << cpu;
+        }
+        if (mask == 0 || SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+            BtLogger::log() << "Setting thread affinity failed - error "
+                << std::dec << GetLastError() << std::endl;
+            ok = false;
+        }
+    }
+
+    if (realtime && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        BtLogger::log() << "Raising thread priority failed - error "
+            << std::dec << GetLastError() << std::endl;
+        ok = false;
+    }
+
+    if (lockMemory) {
+        BtLogger::log() << "Locking memory is not supported on this platform" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+#else
+
+bool BtThreadPolicy::apply() const {
+    bool ok = true;
+
+    if (!cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (unsigned cpu : cpus) {
+            if (cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+        }
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            BtLogger::log() << "Setting thread affinity failed - "
+                << strerror(err) << std::endl;
+            ok = false;
+        }
+    }
+
+    if (realtime) {
+        sched_param param;
+        param.sched_priority = (max)(sched_get_priority_min(SCHED_FIFO),
+            (min)(priority, sched_get_priority_max(SCHED_FIFO)));
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            BtLogger::log() << "Switching thread to SCHED_FIFO failed - "
+                << strerror(err) << std::endl;
+            ok = false;
+        }
+    }
+
+    if (lockMemory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        BtLogger::log() << "Locking memory failed - " << strerror(errno) << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/SpheroCommands.h"
+
+namespace {
+
+struct SpheroCommandSlotInfo {
+    unsigned char did;
+    unsigned char cid;
+    const char * name;
+};
+
+const SpheroCommandSlotInfo SpheroCommandSlots[SPHERO_COMMAND_SLOTS - 1] = {
+    { DID_CORE, CMD_PING, "Ping" },
+    { DID_CORE, CMD_VERSION, "Version" },
+    { DID_CORE, CMD_SET_BT_NAME, "SetBTName" },
+    { DID_CORE, CMD_GET_BT_NAME, "GetBTName" },
+    { DID_CORE, CMD_SET_AUTO_RECONNECT, "SetAutoReconnect" },
+    { DID_CORE, CMD_GET_AUTO_RECONNECT, "GetAutoReconnect" },
+    { DID_CORE, CMD_GET_PWR_STATE, "GetPowerState" },
+    { DID_CORE, CMD_SET_PWR_NOTIFY, "SetPowerNotify" },
+    { DID_CORE, CMD_SLEEP, "Sleep" },
+    { DID_CORE, SET_INACTIVE_TIMER, "SetInactiveTimer" },
+    { DID_CORE, CMD_GOTO_BL, "GotoBL" },
+    { DID_CORE, CMD_RUN_L1_DIAGS, "RunL1Diagnostics" },
+    { DID_CORE, CMD_RUN_L2_DIAGS, "RunL2Diagnostics" },
+
+    { DID_SPHERO, CMD_SET_CAL, "SetCalibration" },
+    { DID_SPHERO, CMD_SET_STABILIZ, "SetStabilize" },
+    { DID_SPHERO, CMD_SET_ROTATION_RATE, "SetRotationRate" },
+    { DID_SPHERO, CMD_REENABLE_DEMO, "SetReenableDemo" },
+    { DID_SPHERO, CMD_SELF_LEVEL, "SetSelfLevel" },
+    { DID_SPHERO, CMD_SET_DATA_STREAMING, "SetDataStreaming" },
+    { DID_SPHERO, CMD_SET_COLLISION_DET, "SetCollisionDetection" },
+    { DID_SPHERO, CMD_LOCATOR, "SetLocator" },
+    { DID_SPHERO, CMD_SET_ACCELERO, "SetAccelerometer" },
+    { DID_SPHERO, CMD_READ_LOCATOR, "ReadLocator" },
+    { DID_SPHERO, CMD_SET_RGB_LED, "SetRGB" },
+    { DID_SPHERO, CMD_SET_BACK_LED, "SetBackLed" },
+    { DID_SPHERO, CMD_GET_RGB_LED, "GetRGB" },
+    { DID_SPHERO, CMD_ROLL, "Roll" },
+    { DID_SPHERO, CMD_BOOST, "Boost" },
+    { DID_SPHERO, CMD_MOVE, "Move" },
+    { DID_SPHERO, CMD_SET_RAW_MOTORS, "SetRawMotors" },
+    { DID_SPHERO, CMD_SET_MOTION_TO, "SetMotionTimeout" },
+    { DID_SPHERO, CMD_SET_OPTIONS_FLAG, "SetOptionsFlag" },
+    { DID_SPHERO, CMD_GET_OPTIONS_FLAG, "GetOptionsFlag" },
+    { DID_SPHERO, CMD_SET_TEMP_OPTIONS_FLAG, "SetTempOptionsFlag" },
+    { DID_SPHERO, CMD_GET_TEMP_OPTIONS_FLAG, "GetTempOptionsFlag" },
+    { DID_SPHERO, CMD_RUN_MACRO, "RunMacro" },
+    { DID_SPHERO, CMD_SAVE_TEMP_MACRO, "SaveTempMacro" },
+    { DID_SPHERO, CMD_SAVE_MACRO, "SaveMacro" },
+    { DID_SPHERO, CMD_INIT_MACRO_EXECUTIVE, "InitMacroExecutive" },
+    { DID_SPHERO, CMD_ABORT_MACRO, "AbortMacro" },
+    { DID_SPHERO, CMD_MACRO_STATUS, "MacroStatus" },
+    { DID_SPHERO, CMD_SET_MACRO_PARAM, "SetMacroParam" },
+    { DID_SPHERO, CMD_APPEND_TEMP_MACRO_CHUNK, "AppendTempMacroChunk" },
+    { DID_SPHERO, CMD_ERASE_ORBBAS, "EraseOrbbas" },
+    { DID_SPHERO, CMD_APPEND_FRAG, "AppendFrag" },
+    { DID_SPHERO, CMD_EXEC_ORBBAS, "ExecOrbbas" },
+    { DID_SPHERO, CMD_ABORT_ORBBAS, "AbortOrbbas" },
+    { DID_SPHERO, CMD_ANSWER_INPUT, "AnswerInput" },
+};
+
+/**
+ * Reverse lookup from (DID, CID) to slot, built once on first use.
+ * Every CID used by the Core and Sphero devices fits in 7 bits.
+ */
+struct SpheroCommandSlotTable {
+    unsigned char core[128];
+    unsigned char sphero[128];
+
+    SpheroCommandSlotTable() {
+        memset(core, SPHERO_COMMAND_SLOTS - 1, sizeof(core));
+        memset(sphero, SPHERO_COMMAND_SLOTS - 1, sizeof(sphero));
+
+        for (unsigned i = 0; i < SPHERO_COMMAND_SLOTS - 1; ++i) {
+            auto const& info = SpheroCommandSlots[i];
+            if (info.did == DID_CORE)
+                core[info.cid & 0x7F] = (unsigned char)i;
+            else
+                sphero[info.cid & 0x7F] = (unsigned char)i;
+        }
+    }
+};
+
+}
+
+unsigned spheroCommandSlot(unsigned char did, unsigned char cid) {
+    static const SpheroCommandSlotTable table;
+
+    if (cid >= 128) return SPHERO_COMMAND_SLOTS - 1;
+    switch (did) {
+        case DID_CORE:
+            return table.core[cid];
+        case DID_SPHERO:
+            return table.sphero[cid];
+        default:
+            return SPHERO_COMMAND_SLOTS - 1;
+    }
+}
+
+const char * spheroCommandName(unsigned slot) {
+    if (slot >= SPHERO_COMMAND_SLOTS - 1) return "Unknown";
+    return SpheroCommandSlots[slot].name;
+}
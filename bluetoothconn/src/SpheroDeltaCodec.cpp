@@ -0,0 +1,270 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn.h"
+#include "btconn/SpheroDeltaCodec.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BTCONN_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// A block is 16 rows of 8 lanes; value i sits in lane i % 8 of row i / 8
+#define LANES 8
+#define ROWS (SpheroDeltaCodec::BLOCK_VALUES / LANES)
+
+namespace {
+
+unsigned bitWidth(uint16_t v) {
+    unsigned width = 0;
+    for (; v; v >>= 1) ++width;
+    return width;
+}
+
+inline uint16_t zigzag(uint16_t delta) {
+    return (uint16_t)((delta << 1) ^ (uint16_t)(-(int)(delta >> 15)));
+}
+
+inline uint16_t unzigzag(uint16_t z) {
+    return (uint16_t)((z >> 1) ^ (uint16_t)(-(int)(z & 1)));
+}
+
+/**
+ * The values of block i, padded by repeating the last value (which
+ * encodes as zero differences) if the input ends inside it.
+ */
+short const* blockValues(short const* values, size_t count, size_t i,
+                         short (&padded)[SpheroDeltaCodec::BLOCK_VALUES]) {
+    size_t start = i * SpheroDeltaCodec::BLOCK_VALUES;
+    if (start + SpheroDeltaCodec::BLOCK_VALUES <= count)
+        return values + start;
+
+    size_t n = count - start;
+    copy(values + start, values + count, padded);
+    fill(padded + n, padded + SpheroDeltaCodec::BLOCK_VALUES, values[count - 1]);
+    return padded;
+}
+
+size_t encodeBlockScalar(short const* values, uint16_t & prev, unsigned char * out) {
+    uint16_t z[SpheroDeltaCodec::BLOCK_VALUES];
+    uint16_t any = 0;
+    for (size_t i = 0; i < SpheroDeltaCodec::BLOCK_VALUES; ++i) {
+        uint16_t v = (uint16_t)values[i];
+        z[i] = zigzag((uint16_t)(v - prev));
+        any |= z[i];
+        prev = v;
+    }
+
+    unsigned width = bitWidth(any);
+    out[0] = (unsigned char)width;
+    unsigned char * words = out + 1;
+    for (unsigned lane = 0; lane < LANES; ++lane) {
+        uint32_t acc = 0;
+        unsigned shift = 0;
+        unsigned k = 0;
+        for (unsigned row = 0; row < ROWS && width; ++row) {
+            acc |= (uint32_t)z[row * LANES + lane] << shift;
+            shift += width;
+            if (shift >= 16) {
+                unsigned char * word = words + 2 * (k++ * LANES + lane);
+                word[0] = (unsigned char)acc;
+                word[1] = (unsigned char)(acc >> 8);
+                acc >>= 16;
+                shift -= 16;
+            }
+        }
+    }
+    return 1 + 16 * (size_t)width;
+}
+
+void decodeBlockScalar(unsigned char const* in, unsigned width, uint16_t & prev,
+                       short * values) {
+    uint16_t z[SpheroDeltaCodec::BLOCK_VALUES];
+    uint32_t mask = (1U << width) - 1;
+    unsigned char const* words = in + 1;
+    for (unsigned lane = 0; lane < LANES; ++lane) {
+        uint32_t acc = 0;
+        unsigned bits = 0;
+        unsigned k = 0;
+        for (unsigned row = 0; row < ROWS; ++row) {
+            if (bits < width) {
+                unsigned char const* word = words + 2 * (k++ * LANES + lane);
+                acc |= (uint32_t)(word[0] | (word[1] << 8)) << bits;
+                bits += 16;
+            }
+            z[row * LANES + lane] = (uint16_t)(acc & mask);
+            acc >>= width;
+            bits -= width;
+        }
+    }
+
+    for (size_t i = 0; i < SpheroDeltaCodec::BLOCK_VALUES; ++i) {
+        prev = (uint16_t)(prev + unzigzag(z[i]));
+        values[i] = (short)prev;
+    }
+}
+
+#ifdef BTCONN_HAVE_SSE2
+
+size_t encodeBlockSse2(short const* values, uint16_t & prev, unsigned char * out) {
+    __m128i z[ROWS];
+    __m128i any = _mm_setzero_si128();
+    __m128i last = _mm_set1_epi16((short)prev);
+    for (unsigned row = 0; row < ROWS; ++row) {
+        __m128i v = _mm_loadu_si128((__m128i const*)(values + row * LANES));
+        // Each lane minus the lane before it, the first minus the last of
+        // the previous row
+        __m128i before = _mm_or_si128(_mm_slli_si128(v, 2), _mm_srli_si128(last, 14));
+        __m128i delta = _mm_sub_epi16(v, before);
+        z[row] = _mm_xor_si128(_mm_slli_epi16(delta, 1), _mm_srai_epi16(delta, 15));
+        any = _mm_or_si128(any, z[row]);
+        last = v;
+    }
+    prev = (uint16_t)_mm_extract_epi16(last, 7);
+
+    any = _mm_or_si128(any, _mm_srli_si128(any, 8));
+    any = _mm_or_si128(any, _mm_srli_si128(any, 4));
+    any = _mm_or_si128(any, _mm_srli_si128(any, 2));
+    unsigned width = bitWidth((uint16_t)_mm_cvtsi128_si32(any));
+    out[0] = (unsigned char)width;
+    if (width == 0) return 1;
+
+    __m128i * words = (__m128i *)(out + 1);
+    __m128i acc = _mm_setzero_si128();
+    unsigned shift = 0;
+    for (unsigned row = 0; row < ROWS; ++row) {
+        acc = _mm_or_si128(acc, _mm_sll_epi16(z[row], _mm_cvtsi32_si128((int)shift)));
+        shift += width;
+        if (shift >= 16) {
+            _mm_storeu_si128(words++, acc);
+            shift -= 16;
+            // The bits of this row that didn't fit
+            acc = shift ? _mm_srl_epi16(z[row], _mm_cvtsi32_si128((int)(width - shift)))
+                        : _mm_setzero_si128();
+        }
+    }
+    return 1 + 16 * (size_t)width;
+}
+
+void decodeBlockSse2(unsigned char const* in, unsigned width, uint16_t & prev,
+                     short * values) {
+    __m128i const* words = (__m128i const*)(in + 1);
+    __m128i mask = _mm_set1_epi16((short)((1U << width) - 1));
+    __m128i one = _mm_set1_epi16(1);
+    __m128i carry = _mm_set1_epi16((short)prev);
+    __m128i acc = _mm_setzero_si128();
+    unsigned bits = 0;
+    for (unsigned row = 0; row < ROWS; ++row) {
+        __m128i z;
+        if (width == 0) {
+            z = _mm_setzero_si128();
+        } else if (bits >= width) {
+            z = _mm_and_si128(acc, mask);
+            acc = _mm_srl_epi16(acc, _mm_cvtsi32_si128((int)width));
+            bits -= width;
+        } else {
+            // The low bits left in acc, the rest from the next word
+            __m128i word = _mm_loadu_si128(words++);
+            z = _mm_and_si128(_mm_or_si128(acc, _mm_sll_epi16(word, _mm_cvtsi32_si128((int)bits))), mask);
+            acc = _mm_srl_epi16(word, _mm_cvtsi32_si128((int)(width - bits)));
+            bits += 16 - width;
+        }
+
+        __m128i delta = _mm_xor_si128(_mm_srli_epi16(z, 1),
+                                      _mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(z, one)));
+        // Running sum across the lanes, on top of the previous row's last
+        delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 2));
+        delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 4));
+        delta = _mm_add_epi16(delta, _mm_slli_si128(delta, 8));
+        __m128i v = _mm_add_epi16(delta, carry);
+        _mm_storeu_si128((__m128i *)(values + row * LANES), v);
+        carry = _mm_shufflehi_epi16(v, 0xFF);
+        carry = _mm_unpackhi_epi64(carry, carry);
+    }
+    prev = (uint16_t)_mm_extract_epi16(carry, 0);
+}
+
+#endif
+
+template <size_t (*ENCODE)(short const*, uint16_t &, unsigned char *)>
+size_t encodeBlocks(short const* values, size_t count, unsigned char * out) {
+    short padded[SpheroDeltaCodec::BLOCK_VALUES];
+    size_t blocks = (count + SpheroDeltaCodec::BLOCK_VALUES - 1) / SpheroDeltaCodec::BLOCK_VALUES;
+    uint16_t prev = 0;
+    size_t written = 0;
+    for (size_t i = 0; i < blocks; ++i)
+        written += ENCODE(blockValues(values, count, i, padded), prev, out + written);
+    return written;
+}
+
+template <void (*DECODE)(unsigned char const*, unsigned, uint16_t &, short *)>
+bool decodeBlocks(unsigned char const* in, size_t len, short * values, size_t count,
+                  size_t & consumed) {
+    short padded[SpheroDeltaCodec::BLOCK_VALUES];
+    uint16_t prev = 0;
+    size_t offset = 0;
+    for (size_t start = 0; start < count; start += SpheroDeltaCodec::BLOCK_VALUES) {
+        if (offset >= len || in[offset] > 16) return false;
+        unsigned width = in[offset];
+        size_t bytes = 1 + 16 * (size_t)width;
+        if (len - offset < bytes) return false;
+
+        if (count - start >= SpheroDeltaCodec::BLOCK_VALUES) {
+            DECODE(in + offset, width, prev, values + start);
+        } else {
+            DECODE(in + offset, width, prev, padded);
+            copy(padded, padded + (count - start), values + start);
+        }
+        offset += bytes;
+    }
+    consumed = offset;
+    return true;
+}
+
+}
+
+std::size_t SpheroDeltaCodec::encode(short const* values, std::size_t count,
+                                     unsigned char * out) {
+#ifdef BTCONN_HAVE_SSE2
+    return encodeBlocks<encodeBlockSse2>(values, count, out);
+#else
+    return encodeBlocks<encodeBlockScalar>(values, count, out);
+#endif
+}
+
+bool SpheroDeltaCodec::decode(unsigned char const* in, std::size_t len,
+                              short * values, std::size_t count, std::size_t & consumed) {
+#ifdef BTCONN_HAVE_SSE2
+    return decodeBlocks<decodeBlockSse2>(in, len, values, count, consumed);
+#else
+    return decodeBlocks<decodeBlockScalar>(in, len, values, count, consumed);
+#endif
+}
+
+std::size_t SpheroDeltaCodec::encodeScalar(short const* values, std::size_t count,
+                                           unsigned char * out) {
+    return encodeBlocks<encodeBlockScalar>(values, count, out);
+}
+
+bool SpheroDeltaCodec::decodeScalar(unsigned char const* in, std::size_t len,
+                                    short * values, std::size_t count, std::size_t & consumed) {
+    return decodeBlocks<decodeBlockScalar>(in, len, values, count, consumed);
+}
@@ -0,0 +1,136 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroEvents.h"
+
+using namespace std;
+
+namespace {
+
+short signedWord(unsigned char const* data) {
+    return (short)(unsigned short)((data[0] << 8) | data[1]);
+}
+
+}
+
+SpheroEvents::SpheroEvents(SpheroHandler & robot) :
+        robot_(robot), nextId_(0), collisions_(0), powerEvents_(0), malformed_(0) {
+    robot_.onAsync(ASYNC_COLLISION, [this](SpheroResponseView const& view) {
+        collisionReceived(view);
+    });
+    robot_.onAsync(ASYNC_POWER_NOTIFY, [this](SpheroResponseView const& view) {
+        powerReceived(view);
+    });
+}
+
+SpheroEvents::~SpheroEvents() {
+    // Once these return, no callback into this object is running
+    robot_.onAsync(ASYNC_COLLISION, nullptr);
+    robot_.onAsync(ASYNC_POWER_NOTIFY, nullptr);
+}
+
+bool SpheroEvents::decodeCollision(SpheroResponseView const& view,
+                                   SpheroCollisionEvent & out) {
+    if (view.dataLength() < COLLISION_DATA_SIZE) return false;
+
+    // X Y Z Axis xMagnitude yMagnitude Speed Timestamp, big-endian
+    unsigned char const* data = view.msgData();
+    out.x = signedWord(data);
+    out.y = signedWord(data + 2);
+    out.z = signedWord(data + 4);
+    out.axis = data[6];
+    out.xMagnitude = signedWord(data + 7);
+    out.yMagnitude = signedWord(data + 9);
+    out.speed = data[11];
+    out.timestamp = ((uint32_t)data[12] << 24) | ((uint32_t)data[13] << 16) |
+                    ((uint32_t)data[14] << 8) | (uint32_t)data[15];
+    out.arrival = view.arrival();
+    return true;
+}
+
+bool SpheroEvents::decodePower(SpheroResponseView const& view, SpheroPowerEvent & out) {
+    if (view.dataLength() < 1) return false;
+
+    out.state = view.msgData()[0];
+    out.arrival = view.arrival();
+    return true;
+}
+
+void SpheroEvents::recordLatency(std::chrono::steady_clock::time_point arrival) {
+    if (arrival == std::chrono::steady_clock::time_point()) return;
+    latency_.record((uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - arrival).count());
+}
+
+void SpheroEvents::collisionReceived(SpheroResponseView const& view) {
+    SpheroCollisionEvent event;
+    if (!decodeCollision(view, event)) {
+        malformed_.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+    collisions_.fetch_add(1, boost::memory_order_relaxed);
+
+    lock_guard<mutex> lock(mutex_);
+    if (collisionHandlers_.empty()) return;
+    recordLatency(event.arrival);
+    for (auto const& handler : collisionHandlers_)
+        handler.second(event);
+}
+
+void SpheroEvents::powerReceived(SpheroResponseView const& view) {
+    SpheroPowerEvent event;
+    if (!decodePower(view, event)) {
+        malformed_.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+    powerEvents_.fetch_add(1, boost::memory_order_relaxed);
+
+    lock_guard<mutex> lock(mutex_);
+    if (powerHandlers_.empty()) return;
+    recordLatency(event.arrival);
+    for (auto const& handler : powerHandlers_)
+        handler.second(event);
+}
+
+int SpheroEvents::onCollision(CollisionHandler handler) {
+    lock_guard<mutex> lock(mutex_);
+    collisionHandlers_.push_back(make_pair(++nextId_, handler));
+    return nextId_;
+}
+
+int SpheroEvents::onPowerChange(PowerHandler handler) {
+    lock_guard<mutex> lock(mutex_);
+    powerHandlers_.push_back(make_pair(++nextId_, handler));
+    return nextId_;
+}
+
+void SpheroEvents::unsubscribe(int id) {
+    lock_guard<mutex> lock(mutex_);
+    collisionHandlers_.erase(
+        remove_if(collisionHandlers_.begin(), collisionHandlers_.end(),
+            [id](pair<int, CollisionHandler> const& h) { return h.first == id; }),
+        collisionHandlers_.end());
+    powerHandlers_.erase(
+        remove_if(powerHandlers_.begin(), powerHandlers_.end(),
+            [id](pair<int, PowerHandler> const& h) { return h.first == id; }),
+        powerHandlers_.end());
+}
@@ -0,0 +1,175 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroFleet.h"
+
+using namespace std;
+
+std::vector<SpheroConnectResult> SpheroFleet::connect(
+        std::vector<SOCKADDR_BTH> const& addresses,
+        SpheroFleetConnectOptions const& options,
+        ConnectHandler onResult) {
+    return connectAll(addresses.size(),
+        [&addresses, &options](size_t i) {
+            SOCKADDR_BTH address = addresses[i];
+            return new SpheroHandler(&address, options.connect);
+        }, options, onResult);
+}
+
+std::vector<SpheroConnectResult> SpheroFleet::connect(
+        std::vector<BluetoothProto::endpoint> const& endpoints,
+        SpheroFleetConnectOptions const& options,
+        ConnectHandler onResult) {
+    return connectAll(endpoints.size(),
+        [&endpoints, &options](size_t i) {
+            return new SpheroHandler(endpoints[i], options.connect);
+        }, options, onResult);
+}
+
+std::vector<SpheroConnectResult> SpheroFleet::connectAll(
+        std::size_t count,
+        std::function<SpheroHandler *(std::size_t)> makeRobot,
+        SpheroFleetConnectOptions const& options,
+        ConnectHandler onResult) {
+    typedef std::chrono::steady_clock Clock;
+
+    vector<SpheroConnectResult> results(count);
+    boost::atomic<size_t> next(0);
+    mutex startMutex;
+    mutex resultMutex;
+    Clock::time_point nextStart = Clock::now();
+
+    auto worker = [&]() {
+        for (;;) {
+            size_t i = next.fetch_add(1);
+            if (i >= count) return;
+
+            {
+                // Space out page requests to the adapter
+                unique_lock<mutex> lock(startMutex);
+                Clock::time_point startAt = (max)(Clock::now(), nextStart);
+                nextStart = startAt + options.startInterval;
+                lock.unlock();
+                this_thread::sleep_until(startAt);
+            }
+
+            SpheroConnectResult & result = results[i];
+            result.index = i;
+
+            auto start = Clock::now();
+            try {
+                result.robot.reset(makeRobot(i));
+            } catch (std::exception & exc) {
+                result.error = exc.what();
+                BtLogger::log() << "Fleet connect of robot #" << std::dec << i
+                    << " failed - " << exc.what() << std::endl;
+            }
+            result.latency = std::chrono::duration_cast<std::chrono::milliseconds>(
+                Clock::now() - start);
+
+            if (onResult) {
+                lock_guard<mutex> lock(resultMutex);
+                onResult(result);
+            }
+        }
+    };
+
+    size_t workers = (min)((max)(options.parallelism, (size_t)1), count);
+    vector<thread> threads;
+    for (size_t i = 0; i < workers; ++i)
+        threads.push_back(thread(worker));
+    for (auto & t : threads)
+        t.join();
+
+    return results;
+}
+
+std::vector<int> SpheroFleet::sendAll(SpheroSharedFramePtr const& frame) {
+    vector<int> seqs(robots_.size(), SpheroBroadcastResult::NOT_SENT);
+    for (size_t i = 0; i < robots_.size(); ++i) {
+        try {
+            seqs[i] = robots_[i]->sendFrame(frame);
+        } catch (std::exception & exc) {
+            BtLogger::log() << "Broadcast to robot #" << std::dec << i
+                << " failed - " << exc.what() << std::endl;
+        }
+    }
+    return seqs;
+}
+
+SpheroBroadcastResult SpheroFleet::gather(std::vector<int> const& seqs,
+                                          SpheroBroadcastOptions const& options) {
+    SpheroBroadcastResult result;
+    result.seqs = seqs;
+    result.responses.resize(seqs.size());
+    for (int seq : seqs) {
+        if (seq != SpheroBroadcastResult::NOT_SENT) ++result.sent;
+    }
+    result.quorum = (options.quorum == 0) ? result.sent : options.quorum;
+
+    // Responses arrive concurrently, so one deadline covers every robot
+    auto deadline = std::chrono::steady_clock::now() + options.timeout;
+    size_t pending = result.sent;
+
+    for (size_t i = 0; i < seqs.size() && i < robots_.size(); ++i) {
+        if (seqs[i] == SpheroBroadcastResult::NOT_SENT) continue;
+        if (result.quorumReached() || result.succeeded + pending < result.quorum)
+            break;
+
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        auto response = robots_[i]->readResponse((unsigned char)seqs[i],
+            (max)(left, std::chrono::milliseconds(0)));
+        --pending;
+
+        if (response) {
+            ++result.responded;
+            if (response->messageResponse() == ORBOTIX_RSP_CODE_OK)
+                ++result.succeeded;
+            result.responses[i] = response;
+        }
+    }
+    return result;
+}
+
+std::vector<int> SpheroFleet::sendRolls(unsigned char const* speeds,
+                                        unsigned short const* headings,
+                                        unsigned char const* states) {
+    size_t count = robots_.size();
+    rollSeqs_.resize(count);
+    for (size_t i = 0; i < count; ++i)
+        rollSeqs_[i] = robots_[i]->nextSeq();
+
+    rollBatch_.encode(speeds, headings, rollSeqs_.data(), count, states);
+
+    vector<int> seqs(count, SpheroBroadcastResult::NOT_SENT);
+    for (size_t i = 0; i < count; ++i) {
+        try {
+            robots_[i]->sendEncoded(rollBatch_.frame(i), RollCommand::slot(), rollSeqs_[i]);
+            seqs[i] = rollSeqs_[i];
+        } catch (std::exception & exc) {
+            BtLogger::log() << "Roll to robot #" << std::dec << i
+                << " failed - " << exc.what() << std::endl;
+        }
+    }
+    return seqs;
+}
@@ -22,49 +22,89 @@
 #include "btconn/SpheroCommands.h"
 #include "btconn/SpheroPacketTypes.h"
 #include "btconn/NotConnectedException.h"
+#include "btconn/SpheroFrameDecoder.h"
+#include "btconn/SpheroLatency.h"
 #include "btconn/SpheroHandler.h"
 
 using namespace std;
 
-#define CONNECTION_RETRY 5
-#define CONNECTION_SLEEP 5
+SpheroHandler::SpheroHandler(SOCKADDR_BTH * bluetoothAddress,
+                             SpheroConnectOptions const& options) :
+        nextObserverId_(0), nextCallId_(0), lastReceived_(0), lastTimeoutReset_(0),
+        streamingSeq_(-1), streamingPending_(0), streamingMasks_(0), seqNum(0) {
+    coalesce_.fill(false);
+    initRetryPolicies();
+    spheroConn_.setReadObserver(
+        [this](unsigned char const* data, std::size_t len) {
+            return onDataReceived(data, len);
+        });
+    spheroConn_.setReplaceObserver(
+        [this](std::shared_ptr<SpheroMessage> const& msg) {
+            onReplaced(msg);
+        });
 
-SpheroHandler::SpheroHandler(SOCKADDR_BTH * bluetoothAddress) :
-        seqNum(0) {
     if (bluetoothAddress == nullptr) return;
 
-    // TODO: Make Bluetooth Connect Retry # configurable
-    for (int i = 0; i <= CONNECTION_RETRY; ++i) {
+    connectWithRetry([this, bluetoothAddress]() {
+        spheroConn_.setEndpoint(*bluetoothAddress);
+    }, options);
+    BtLogger::log() << "Successfully Connected to bluetooth device "
+        << std::hex << bluetoothAddress->btAddr << std::endl;
+}
+
+SpheroHandler::SpheroHandler(BluetoothProto::endpoint const& endpoint,
+                             SpheroConnectOptions const& options) :
+        nextObserverId_(0), nextCallId_(0), lastReceived_(0), lastTimeoutReset_(0),
+        streamingSeq_(-1), streamingPending_(0), streamingMasks_(0), seqNum(0) {
+    coalesce_.fill(false);
+    initRetryPolicies();
+    spheroConn_.setReadObserver(
+        [this](unsigned char const* data, std::size_t len) {
+            return onDataReceived(data, len);
+        });
+    spheroConn_.setReplaceObserver(
+        [this](std::shared_ptr<SpheroMessage> const& msg) {
+            onReplaced(msg);
+        });
+
+    connectWithRetry([this, &endpoint]() {
+        spheroConn_.setEndpoint(endpoint);
+    }, options);
+    BtLogger::log() << "Successfully Connected to device" << std::endl;
+}
+
+void SpheroHandler::connectWithRetry(std::function<void()> setEndpoint,
+                                     SpheroConnectOptions const& options) {
+    spheroConn_.setSendBufferSize(options.sendBufferSize);
+    spheroConn_.setThreadPolicy(options.ioThread);
+    spheroConn_.setReadQueueLimit(options.readQueueLimit);
+    for (int i = 0; i <= options.retries; ++i) {
         try {
-            spheroConn_.setEndpoint(*bluetoothAddress);
+            setEndpoint();
             spheroConn_.connect();
-
-            BtLogger::log() << "Successfully Connected to bluetooth device "
-                << std::hex << bluetoothAddress->btAddr << std::endl;
             return;
         } catch (boost::system::system_error & sysexc) {
             BtLogger::log()
                 << "Caught exception while connecting to device - "
                 << sysexc.what() <<
-                ((i < CONNECTION_RETRY) ?
+                ((i < options.retries) ?
                     " -- retrying " :
                     " -- quitting ") << std::endl;
 
-            if (i == CONNECTION_RETRY)
+            if (i == options.retries)
                 throw NotConnectedException(sysexc.what());
         } catch (std::exception & exc) {
             BtLogger::log()
                 << "Caught exception while connecting to device - "
                 << exc.what() <<
-                ((i < CONNECTION_RETRY) ?
+                ((i < options.retries) ?
                     " -- retrying " :
                     " -- quitting ") << std::endl;
 
-            if (i == CONNECTION_RETRY)
+            if (i == options.retries)
                 throw NotConnectedException(exc.what());
         }
-        // TODO: Make Connect Retry Sleep configurable
-        Sleep(CONNECTION_SLEEP * 1000);
+        std::this_thread::sleep_for(options.retryDelay);
     }
 }
 
@@ -80,3 +120,417 @@ SpheroResponsePtr SpheroHandler::readResponse() {
     if (resPtr) resPtr->parseFromInternalData();
     return (resPtr);
 }
+
+unsigned char SpheroHandler::sendFrame(SpheroSharedFramePtr const& frame) {
+    unsigned char seq = nextSeq();
+    sendEncoded(frame->view(seq), frame->slot(), seq);
+    return seq;
+}
+
+void SpheroHandler::sendEncoded(std::shared_ptr<SpheroMessage> const& frame,
+                                unsigned slot, unsigned char seq) {
+    if (!spheroConn_.isConnected())
+        throw NotConnectedException(
+                "Unable to send Sphero Commands - Not Connected");
+
+    latency_.commandSent(slot, seq);
+    auto buffers = frame->wireBuffers();
+    if (boost::asio::buffer_size(buffers[0]) > 1)
+        frameSent(boost::asio::buffer_cast<unsigned char const*>(buffers[0])[1]);
+    if (slot == SetDataStreamingCommand::slot()) streamingSent(*frame);
+    spheroConn_.send(frame, coalesceKey(slot));
+}
+
+void SpheroHandler::frameSent(unsigned char sop2) {
+    if (sop2 & SOP2_RESET_TIMEOUT) {
+        lastTimeoutReset_.store(std::chrono::steady_clock::now().time_since_epoch().count(),
+                                boost::memory_order_relaxed);
+    }
+}
+
+void SpheroHandler::streamingSent(SpheroMessage const& msg) {
+    // SOP1 SOP2 DID CID SEQ DLEN, then N(2) M(2) MASK(4) PCNT(1) and,
+    // on firmware that has it, MASK2(4)
+    unsigned char bytes[20];
+    size_t len = boost::asio::buffer_copy(boost::asio::buffer(bytes), msg.wireBuffers());
+    if (len < 15) return;
+    auto word = [&bytes](size_t at) {
+        return ((uint32_t)bytes[at] << 24) | ((uint32_t)bytes[at + 1] << 16) |
+               ((uint32_t)bytes[at + 2] << 8) | bytes[at + 3];
+    };
+    uint32_t mask2 = (bytes[5] >= 14 && len >= 19) ? word(15) : 0;
+    uint64_t masks = SpheroStreamLayout(word(10), mask2).masks();
+
+    if (!(bytes[1] & SOP2_ANSWER)) {
+        streamingMasks_.store(masks, boost::memory_order_release);
+        return;
+    }
+    lock_guard<mutex> lock(streamingMutex_);
+    streamingSeq_ = bytes[4];
+    streamingPending_ = masks;
+}
+
+void SpheroHandler::streamingAnswered(unsigned char const* frame) {
+    lock_guard<mutex> lock(streamingMutex_);
+    if (streamingSeq_ != frame[3]) return;
+    if (frame[2] == ORBOTIX_RSP_CODE_OK)
+        streamingMasks_.store(streamingPending_, boost::memory_order_release);
+    streamingSeq_ = -1;
+}
+
+SpheroResponsePtr SpheroHandler::readResponse(unsigned char seq,
+                                              std::chrono::milliseconds timeout) {
+    if (!spheroConn_.isConnected())
+        throw NotConnectedException(
+                "Unable to talk to Sphero - Not Connected");
+
+    auto resPtr = spheroConn_.readIf<SpheroServerResponse>(
+        [seq](unsigned char const* frame, std::size_t len) {
+            return len > SpheroFrameDecoder::HEADER_SIZE && frame[1] == 0xFF && frame[3] == seq;
+        }, timeout);
+    if (resPtr) resPtr->parseFromInternalData();
+    return (resPtr);
+}
+
+int SpheroHandler::addFrameObserver(FrameObserver observer) {
+    lock_guard<mutex> lock(observersMutex_);
+    int id = nextObserverId_++;
+    frameObservers_.push_back(make_pair(id, observer));
+    return id;
+}
+
+int SpheroHandler::addDropObserver(DropObserver observer) {
+    lock_guard<mutex> lock(observersMutex_);
+    int id = nextObserverId_++;
+    dropObservers_.push_back(make_pair(id, observer));
+    return id;
+}
+
+void SpheroHandler::removeFrameObserver(int id) {
+    lock_guard<mutex> lock(observersMutex_);
+    frameObservers_.erase(
+        remove_if(frameObservers_.begin(), frameObservers_.end(),
+            [id](pair<int, FrameObserver> const& o) { return o.first == id; }),
+        frameObservers_.end());
+    dropObservers_.erase(
+        remove_if(dropObservers_.begin(), dropObservers_.end(),
+            [id](pair<int, DropObserver> const& o) { return o.first == id; }),
+        dropObservers_.end());
+}
+
+void SpheroHandler::initRetryPolicies() {
+    superseded_.fill(0);
+    newestCall_.fill(0);
+    newestWins_.fill(false);
+    retransmits_.fill(0);
+    duplicates_ = retriesExhausted_ = 0;
+
+    // Safe to apply twice: queries, and setters of absolute values
+    static const unsigned idempotent[] = {
+        PingCommand::slot(),
+        VersionCommand::slot(),
+        SetBTNameCommand::slot(),
+        GetBTNameCommand::slot(),
+        SetAutoReconnectCommand::slot(),
+        GetAutoReconnectCommand::slot(),
+        GetPowerStateCommand::slot(),
+        SetPowerNotifyCommand::slot(),
+        SetInactiveTimerCommand::slot(),
+        SetStabilizeCommand::slot(),
+        SetRotationRateCommand::slot(),
+        SetDataStreamingCommand::slot(),
+        SetCollisionDetectionCommand::slot(),
+        ReadLocatorCommand::slot(),
+        SetRGBCommand::slot(),
+        SetBackLedCommand::slot(),
+        GetRGBCommand::slot(),
+        RollCommand::slot(),
+        SetRawMotorsCommand::slot(),
+        SetMotionToCommand::slot(),
+        SetOptionsFlagCommand::slot(),
+        GetOptionsFlagCommand::slot(),
+        SetTempOptionsFlagCommand::slot(),
+        GetTempOptionsFlagCommand::slot(),
+        AbortMacroCommand::slot(),
+        MacroStatusCommand::slot(),
+    };
+    for (unsigned slot : idempotent)
+        retryPolicies_[slot] = SpheroRetryPolicy(2, std::chrono::milliseconds(500));
+
+    // A retried setter must not overtake a newer one of its kind
+    static const unsigned setters[] = {
+        SetBTNameCommand::slot(),
+        SetAutoReconnectCommand::slot(),
+        SetPowerNotifyCommand::slot(),
+        SetInactiveTimerCommand::slot(),
+        SetStabilizeCommand::slot(),
+        SetRotationRateCommand::slot(),
+        SetDataStreamingCommand::slot(),
+        SetCollisionDetectionCommand::slot(),
+        SetRGBCommand::slot(),
+        SetBackLedCommand::slot(),
+        RollCommand::slot(),
+        SetRawMotorsCommand::slot(),
+        SetMotionToCommand::slot(),
+        SetOptionsFlagCommand::slot(),
+        SetTempOptionsFlagCommand::slot(),
+    };
+    for (unsigned slot : setters)
+        newestWins_[slot] = true;
+}
+
+void SpheroHandler::sendAsync(SpheroSharedFramePtr const& frame,
+                              ResponseHandler handler,
+                              std::chrono::milliseconds timeout) {
+    SpheroRetryPolicy policy = retryPolicy(frame->slot());
+    if (timeout.count() != 0) policy.timeout = timeout;
+    sendAsync(frame, handler, policy);
+}
+
+void SpheroHandler::sendAsync(SpheroSharedFramePtr const& frame,
+                              ResponseHandler handler,
+                              SpheroRetryPolicy const& policy) {
+    if (!spheroConn_.isConnected())
+        throw NotConnectedException(
+                "Unable to send Sphero Commands - Not Connected");
+
+    uint64_t id;
+    {
+        lock_guard<mutex> lock(callsMutex_);
+        id = ++nextCallId_;
+        newestCall_[frame->slot()] = id;
+    }
+    startCall(frame, handler, policy.timeout, policy.retries, id);
+}
+
+void SpheroHandler::startCall(SpheroSharedFramePtr const& frame,
+                              ResponseHandler handler,
+                              std::chrono::milliseconds timeout,
+                              unsigned retries, uint64_t id) {
+    unsigned sentAt = seqNum.fetch_add(1, boost::memory_order_relaxed);
+    unsigned char seq = (unsigned char)sentAt;
+    auto timer = make_shared<boost::asio::steady_timer>(spheroConn_.ioService());
+    ResponseHandler abandoned;
+    {
+        lock_guard<mutex> lock(callsMutex_);
+        // 256 commands later the old call's response can't be told apart
+        PendingCall & call = calls_[seq];
+        abandoned.swap(call.handler);
+        call.handler = handler;
+        call.timer = timer;
+        call.id = id;
+        call.frame = frame;
+        call.timeout = timeout;
+        call.retriesLeft = retries;
+        call.sentAt = sentAt;
+        superseded_[seq] = 0;
+    }
+    if (abandoned) {
+        spheroConn_.ioService().post([abandoned]() {
+            abandoned(boost::asio::error::operation_aborted, nullptr);
+        });
+    }
+
+    // Timers are only touched on the io thread
+    spheroConn_.ioService().post([this, timer, timeout, seq, id]() {
+        timer->expires_from_now(timeout);
+        timer->async_wait([this, timer, seq, id](boost::system::error_code const& ec) {
+            if (!ec) callTimedOut(seq, id);
+        });
+    });
+
+    try {
+        sendEncoded(frame->view(seq), frame->slot(), seq);
+    } catch (...) {
+        lock_guard<mutex> lock(callsMutex_);
+        if (calls_[seq].id == id) calls_[seq].handler = nullptr;
+        throw;
+    }
+}
+
+void SpheroHandler::callTimedOut(unsigned char seq, uint64_t id) {
+    PendingCall retry;
+    {
+        lock_guard<mutex> lock(callsMutex_);
+        PendingCall & call = calls_[seq];
+        if (!call.handler || call.id != id) return;
+
+        unsigned slot = call.frame->slot();
+        if (call.retriesLeft == 0 || (newestWins_[slot] && newestCall_[slot] != id)) {
+            ++retriesExhausted_;
+        } else {
+            // A late response to this SEQ is now a duplicate
+            retry = call;
+            call.handler = nullptr;
+            superseded_[seq] = call.sentAt + 1;
+            ++retransmits_[slot];
+        }
+    }
+
+    if (!retry.handler) {
+        completeCall(seq, id, boost::asio::error::timed_out, nullptr);
+        return;
+    }
+
+    try {
+        startCall(retry.frame, retry.handler, retry.timeout, retry.retriesLeft - 1, id);
+    } catch (std::exception & exc) {
+        BtLogger::log() << "Retransmit failed - " << exc.what() << std::endl;
+        retry.handler(boost::asio::error::not_connected, nullptr);
+    }
+}
+
+bool SpheroHandler::suppressDuplicate(unsigned char seq) {
+    lock_guard<mutex> lock(callsMutex_);
+    unsigned sentAt = superseded_[seq];
+    if (sentAt == 0) return false;
+
+    superseded_[seq] = 0;
+    // Unless the SEQ has been reused since
+    if (seqNum.load(boost::memory_order_relaxed) - (sentAt - 1) > 256) return false;
+    ++duplicates_;
+    return true;
+}
+
+SpheroResponsePtr SpheroHandler::request(SpheroSharedFramePtr const& frame,
+                                         std::chrono::milliseconds timeout) {
+    mutex m;
+    condition_variable answered;
+    bool done = false;
+    SpheroResponsePtr ret;
+
+    sendAsync(frame,
+        [&](boost::system::error_code const&, SpheroResponsePtr response) {
+            lock_guard<mutex> lock(m);
+            ret = response;
+            done = true;
+            answered.notify_all();
+        }, timeout);
+
+    unique_lock<mutex> lock(m);
+    answered.wait(lock, [&done]() { return done; });
+    return ret;
+}
+
+void SpheroHandler::setRetryPolicy(unsigned slot, SpheroRetryPolicy const& policy) {
+    lock_guard<mutex> lock(callsMutex_);
+    retryPolicies_.at(slot) = policy;
+}
+
+SpheroRetryPolicy SpheroHandler::retryPolicy(unsigned slot) {
+    lock_guard<mutex> lock(callsMutex_);
+    return retryPolicies_.at(slot);
+}
+
+uint64_t SpheroHandler::retransmits(unsigned slot) {
+    lock_guard<mutex> lock(callsMutex_);
+    return retransmits_.at(slot);
+}
+
+uint64_t SpheroHandler::duplicatesSuppressed() {
+    lock_guard<mutex> lock(callsMutex_);
+    return duplicates_;
+}
+
+uint64_t SpheroHandler::retriesExhausted() {
+    lock_guard<mutex> lock(callsMutex_);
+    return retriesExhausted_;
+}
+
+bool SpheroHandler::completeCall(unsigned char seq, uint64_t id,
+                                 boost::system::error_code const& ec,
+                                 SpheroResponsePtr const& response) {
+    ResponseHandler handler;
+    shared_ptr<boost::asio::steady_timer> timer;
+    {
+        lock_guard<mutex> lock(callsMutex_);
+        PendingCall & call = calls_[seq];
+        if (!call.handler || (id != 0 && call.id != id)) return false;
+        handler.swap(call.handler);
+        timer = call.timer.lock();
+    }
+
+    if (timer) {
+        boost::system::error_code ignored;
+        timer->cancel(ignored);
+    }
+    handler(ec, response);
+    return true;
+}
+
+void SpheroHandler::onResponse(unsigned slot, ResponseCallback callback) {
+    lock_guard<mutex> lock(observersMutex_);
+    responseCallbacks_.at(slot) = callback;
+}
+
+void SpheroHandler::onAsync(unsigned char idCode, ResponseCallback callback) {
+    lock_guard<mutex> lock(observersMutex_);
+    asyncCallbacks_[idCode] = callback;
+}
+
+void SpheroHandler::onReplaced(std::shared_ptr<SpheroMessage> const& msg) {
+    // Every message starts SOP1 SOP2 DID CID SEQ in its first buffer
+    auto header = msg->wireBuffers()[0];
+    if (boost::asio::buffer_size(header) < SpheroFrameDecoder::HEADER_SIZE) return;
+    unsigned char const* bytes = boost::asio::buffer_cast<unsigned char const*>(header);
+    unsigned char seq = bytes[4];
+    unsigned slot = spheroCommandSlot(bytes[2], bytes[3]);
+
+    latency_.commandDropped(seq);
+    {
+        lock_guard<mutex> lock(observersMutex_);
+        for (auto const& observer : dropObservers_)
+            observer.second(seq, slot);
+    }
+    // Not a timeout, so not counted as an exhausted retry
+    completeCall(seq, 0, boost::asio::error::operation_aborted, nullptr);
+}
+
+bool SpheroHandler::onDataReceived(unsigned char const* data, std::size_t len) {
+    auto arrival = std::chrono::steady_clock::now();
+    lastReceived_.store(arrival.time_since_epoch().count(), boost::memory_order_relaxed);
+
+    frameDecoder_.feed(data, len,
+        [&](unsigned char const* frame, std::size_t frameLen) {
+            unsigned slot = ASYNC_FRAME;
+            if (!SpheroFrameDecoder::isAsync(frame) &&
+                !latency_.responseReceived(frame[3], &slot))
+                slot = SPHERO_COMMAND_SLOTS - 1;
+
+            // Before the observers, so they parse what follows with it
+            if (slot == SetDataStreamingCommand::slot()) streamingAnswered(frame);
+
+            bool claimed = false;
+            bool awaited = false;
+            if (slot != ASYNC_FRAME) {
+                lock_guard<mutex> lock(callsMutex_);
+                awaited = (bool)calls_[frame[3]].handler;
+            }
+            // The answer to an attempt that was already retried
+            if (slot != ASYNC_FRAME && !awaited && suppressDuplicate(frame[3]))
+                claimed = true;
+
+            {
+                lock_guard<mutex> lock(observersMutex_);
+                for (auto const& observer : frameObservers_)
+                    observer.second(frame, frameLen, slot);
+
+                ResponseCallback const& callback = (slot == ASYNC_FRAME) ?
+                    asyncCallbacks_[frame[2]] : responseCallbacks_[slot];
+                if (callback && !awaited && !claimed) {
+                    callback(SpheroResponseView(frame, frameLen, arrival));
+                    claimed = true;
+                }
+            }
+
+            if (awaited) {
+                auto response = make_shared<SpheroServerResponse>(frame, frameLen);
+                response->parseFromInternalData();
+                claimed = completeCall(frame[3], 0, boost::system::error_code(), response);
+            }
+            // Only what nobody took is left for readResponse(), frame by frame
+            if (!claimed) spheroConn_.queue(frame, frameLen);
+        });
+
+    return true;
+}
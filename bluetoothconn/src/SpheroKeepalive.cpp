@@ -0,0 +1,148 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroKeepalive.h"
+
+using namespace std;
+
+SpheroKeepalive::State::State(SpheroHandler & r, SpheroKeepaliveOptions const& o,
+                              DeadHandler dead) :
+        robot(&r), options(o), timer(r.getConnection().ioService()),
+        ping(SpheroSharedFrame::encode(PingCommand())), onDead(dead),
+        stopped(false), pinging(false), alive(true), missed(0), pings(0),
+        missedTotal(0), lastRtt(0) {
+}
+
+SpheroKeepalive::SpheroKeepalive(SpheroHandler & robot,
+                                 SpheroKeepaliveOptions const& options,
+                                 DeadHandler onDead) :
+        state_(make_shared<State>(robot, options, onDead)) {
+    SpheroKeepaliveOptions & opts = state_->options;
+    opts.missedBeats = (max)(opts.missedBeats, 1U);
+    if (opts.inactiveTimer != 0) {
+        opts.interval = (min)(opts.interval,
+            std::chrono::milliseconds(opts.inactiveTimer * 1000LL / 2));
+        robot.sendAsync(SpheroSharedFrame::encode(makeSetInactiveTimerCommand(opts.inactiveTimer)),
+            [](boost::system::error_code const& ec, SpheroResponsePtr response) {
+                if (ec) {
+                    BtLogger::log() << "SetInactiveTimer for keepalive failed - "
+                        << ec.message() << std::endl;
+                } else if (response->messageResponse() != ORBOTIX_RSP_CODE_OK) {
+                    BtLogger::log() << "SetInactiveTimer for keepalive failed - "
+                        << response->messageResponseToString() << std::endl;
+                }
+            });
+    }
+
+    shared_ptr<State> state = state_;
+    robot.getConnection().ioService().post([state]() {
+        tick(state);
+    });
+}
+
+SpheroKeepalive::~SpheroKeepalive() {
+    shared_ptr<State> state = state_;
+    {
+        lock_guard<mutex> lock(state->mutex);
+        state->stopped = true;
+        state->onDead = nullptr;
+    }
+    // Timers are only touched on the io thread
+    state->robot->getConnection().ioService().post([state]() {
+        boost::system::error_code ignored;
+        state->timer.cancel(ignored);
+    });
+}
+
+void SpheroKeepalive::schedule(std::shared_ptr<State> const& state, Clock::time_point at) {
+    state->timer.expires_at(at);
+    shared_ptr<State> keep = state;
+    state->timer.async_wait([keep](boost::system::error_code const& ec) {
+        if (!ec) tick(keep);
+    });
+}
+
+void SpheroKeepalive::tick(std::shared_ptr<State> const& state) {
+    lock_guard<mutex> lock(state->mutex);
+    // While a Ping is out, its answer (or timeout) picks up from here
+    if (state->stopped || state->pinging || !state->alive.load()) return;
+
+    Clock::time_point quietSince = (min)(state->robot->lastReceived(),
+                                         state->robot->lastTimeoutReset());
+    if (Clock::now() - quietSince >= state->options.interval)
+        sendPing(state);
+    else
+        schedule(state, quietSince + state->options.interval);
+}
+
+void SpheroKeepalive::sendPing(std::shared_ptr<State> const& state) {
+    state->pinging = true;
+    state->sentAt = Clock::now();
+    state->pings.fetch_add(1, boost::memory_order_relaxed);
+
+    shared_ptr<State> keep = state;
+    try {
+        // Every beat is an attempt of its own, so no retries
+        state->robot->sendAsync(state->ping,
+            [keep](boost::system::error_code const&, SpheroResponsePtr response) {
+                answered(keep, response);
+            },
+            SpheroRetryPolicy(0, state->options.timeout));
+    } catch (std::exception & exc) {
+        BtLogger::log() << "Keepalive Ping failed - " << exc.what() << std::endl;
+        state->pinging = false;
+        state->missed.store(state->options.missedBeats);
+        state->alive.store(false);
+        if (state->onDead) state->onDead();
+    }
+}
+
+void SpheroKeepalive::answered(std::shared_ptr<State> const& state,
+                               SpheroResponsePtr const& response) {
+    lock_guard<mutex> lock(state->mutex);
+    state->pinging = false;
+    if (state->stopped || !state->alive.load()) return;
+
+    if (response) {
+        int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - state->sentAt).count();
+        state->rtt.record((uint64_t)micros);
+        state->lastRtt.store(micros, boost::memory_order_relaxed);
+        state->missed.store(0, boost::memory_order_relaxed);
+        schedule(state, Clock::now());
+        return;
+    }
+
+    state->missedTotal.fetch_add(1, boost::memory_order_relaxed);
+    unsigned missed = state->missed.fetch_add(1) + 1;
+    if (missed < state->options.missedBeats) {
+        sendPing(state);
+        return;
+    }
+
+    BtLogger::log() << "Keepalive: " << std::dec << missed
+        << " Pings unanswered, link is dead" << std::endl;
+    state->alive.store(false);
+    if (state->options.closeOnDead)
+        state->robot->getConnection().close();
+    if (state->onDead) state->onDead();
+}
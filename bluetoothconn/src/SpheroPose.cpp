@@ -0,0 +1,217 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroStateCache.h"
+#include "btconn/SpheroPose.h"
+
+using namespace std;
+
+namespace {
+
+const double DEGREES_PER_RADIAN = 180.0 / 3.14159265358979323846;
+
+short signedWord(unsigned char const* data) {
+    return (short)(unsigned short)((data[0] << 8) | data[1]);
+}
+
+uint64_t doubleBits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double bitsDouble(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+double normalizedHeading(double degrees) {
+    double heading = std::fmod(degrees, 360.0);
+    return (heading < 0) ? heading + 360.0 : heading;
+}
+
+}
+
+SpheroPose::SpheroPose(SpheroHandler & robot) :
+        robot_(&robot), observerId_(0), layout_(0), sequence_(0), unparsed_(0) {
+    init();
+    observerId_ = robot_->addFrameObserver(
+        [this](unsigned char const* frame, std::size_t len, unsigned slot) {
+            if (len <= 6) return;
+            if (slot == SpheroHandler::ASYNC_FRAME) {
+                if (frame[2] == ASYNC_SENSOR_DATA)
+                    feed(frame + 5, len - 6, Clock::now());
+            } else if (slot == ReadLocatorCommand::slot() && frame[2] == ORBOTIX_RSP_CODE_OK) {
+                feedLocator(frame + 5, len - 6, Clock::now());
+            }
+        });
+}
+
+SpheroPose::SpheroPose() :
+        robot_(nullptr), observerId_(0), layout_(0), sequence_(0), unparsed_(0) {
+    init();
+}
+
+SpheroPose::~SpheroPose() {
+    if (robot_) robot_->removeFrameObserver(observerId_);
+}
+
+void SpheroPose::init() {
+    for (auto & word : words_)
+        word.store(0, boost::memory_order_relaxed);
+    layoutSeen_ = Layout();
+    current_ = SpheroPoseEstimate();
+    clock_.reset();
+    publish();
+}
+
+void SpheroPose::setStreamingMask(uint32_t mask1, uint32_t mask2) {
+    layout_.store(((uint64_t)mask1 << 32) | mask2, boost::memory_order_relaxed);
+}
+
+void SpheroPose::publish() {
+    // Readers that see any of the new words also see an odd sequence
+    uint64_t seq = sequence_.load(boost::memory_order_relaxed);
+    sequence_.store(seq + 1, boost::memory_order_relaxed);
+    boost::atomic_thread_fence(boost::memory_order_release);
+
+    uint64_t words[WORDS] = {
+        doubleBits(current_.x), doubleBits(current_.y),
+        doubleBits(current_.vx), doubleBits(current_.vy),
+        doubleBits(current_.heading),
+        (uint64_t)current_.at.time_since_epoch().count(),
+        current_.samples
+    };
+    for (unsigned i = 0; i < WORDS; ++i)
+        words_[i].store(words[i], boost::memory_order_relaxed);
+
+    sequence_.store(seq + 2, boost::memory_order_release);
+}
+
+SpheroPoseEstimate SpheroPose::pose() const {
+    uint64_t words[WORDS];
+    for (;;) {
+        uint64_t before = sequence_.load(boost::memory_order_acquire);
+        if (before & 1) continue;
+        for (unsigned i = 0; i < WORDS; ++i)
+            words[i] = words_[i].load(boost::memory_order_relaxed);
+        boost::atomic_thread_fence(boost::memory_order_acquire);
+        if (sequence_.load(boost::memory_order_relaxed) == before) break;
+    }
+
+    SpheroPoseEstimate ret;
+    ret.x = bitsDouble(words[0]);
+    ret.y = bitsDouble(words[1]);
+    ret.vx = bitsDouble(words[2]);
+    ret.vy = bitsDouble(words[3]);
+    ret.heading = bitsDouble(words[4]);
+    ret.at = Clock::time_point(Clock::duration((Clock::rep)words[5]));
+    ret.samples = words[6];
+    return ret;
+}
+
+void SpheroPose::feed(unsigned char const* data, std::size_t len,
+                      Clock::time_point arrival) {
+    SpheroStreamLayout stream = robot_ ? robot_->streamingLayout() :
+        SpheroStreamLayout(layout_.load(boost::memory_order_relaxed));
+    if (stream != layoutSeen_.stream) {
+        layoutSeen_.stream = stream;
+        layoutSeen_.odometerX = stream.offset(0, SpheroStateCache::STREAM_ODOMETER_X);
+        layoutSeen_.odometerY = stream.offset(0, SpheroStateCache::STREAM_ODOMETER_Y);
+        layoutSeen_.velocityX = stream.offset(0, SpheroStateCache::STREAM_VELOCITY_X);
+        layoutSeen_.velocityY = stream.offset(0, SpheroStateCache::STREAM_VELOCITY_Y);
+        layoutSeen_.yaw = stream.offset(STREAM_IMU_YAW, 0);
+    }
+
+    size_t count = stream.samples(len);
+    if (count == 0) {
+        unparsed_.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+
+    clock_.packet(arrival, count);
+    for (size_t s = 0; s < count; ++s)
+        update(clock_.at(s), data + s * stream.sampleSize());
+    publish();
+}
+
+void SpheroPose::update(Clock::time_point at, unsigned char const* sample) {
+    Layout const& layout = layoutSeen_;
+    bool first = (current_.samples == 0);
+    double dt = first ? 0.0 : std::chrono::duration<double>(at - current_.at).count();
+
+    double vx = current_.vx;
+    double vy = current_.vy;
+    bool haveVelocity = layout.velocityX >= 0 && layout.velocityY >= 0;
+    if (haveVelocity) {
+        // Streamed in mm/s
+        vx = signedWord(sample + layout.velocityX) / 10.0;
+        vy = signedWord(sample + layout.velocityY) / 10.0;
+    }
+
+    if (layout.odometerX >= 0 && layout.odometerY >= 0) {
+        double x = signedWord(sample + layout.odometerX);
+        double y = signedWord(sample + layout.odometerY);
+        if (!haveVelocity && dt > 0) {
+            vx = (x - current_.x) / dt;
+            vy = (y - current_.y) / dt;
+        }
+        current_.x = x;
+        current_.y = y;
+    } else if (haveVelocity && !first && dt > 0) {
+        // Trapezoidal step from the previous velocity to this one
+        current_.x += (current_.vx + vx) / 2 * dt;
+        current_.y += (current_.vy + vy) / 2 * dt;
+    } else if (!haveVelocity) {
+        return;
+    }
+    current_.vx = vx;
+    current_.vy = vy;
+
+    if (layout.yaw >= 0) {
+        current_.heading = normalizedHeading(signedWord(sample + layout.yaw));
+    } else if (vx * vx + vy * vy >= 1.0) {
+        // 0 degrees is +Y, increasing clockwise
+        current_.heading = normalizedHeading(std::atan2(vx, vy) * DEGREES_PER_RADIAN);
+    }
+
+    current_.at = at;
+    ++current_.samples;
+}
+
+void SpheroPose::feedLocator(unsigned char const* data, std::size_t len,
+                             Clock::time_point arrival) {
+    if (len < SpheroStateCache::LOCATOR_DATA_SIZE) {
+        unparsed_.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+
+    // X, Y in cm, X and Y velocity in cm/s, speed over ground
+    current_.x = signedWord(data);
+    current_.y = signedWord(data + 2);
+    current_.vx = signedWord(data + 4);
+    current_.vy = signedWord(data + 6);
+    current_.at = arrival;
+    ++current_.samples;
+    publish();
+}
@@ -0,0 +1,123 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn.h"
+#include "btconn/SpheroRollBatch.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BTCONN_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// DID + CID + DLEN, the part of every Roll checksum that never changes
+#define ROLL_CONSTANT_SUM (DID_SPHERO + CMD_ROLL + 5)
+
+namespace {
+
+inline void writeRollFrame(unsigned char * frame,
+                           unsigned char speed,
+                           unsigned short heading,
+                           unsigned char seq,
+                           unsigned char state,
+                           unsigned char chksum) {
+    frame[0] = 0xFF;
+    frame[1] = 0xFF;
+    frame[2] = DID_SPHERO;
+    frame[3] = CMD_ROLL;
+    frame[4] = seq;
+    frame[5] = 5;
+    frame[6] = speed;
+    frame[7] = (unsigned char)(heading >> 8);
+    frame[8] = (unsigned char)(heading & 0xFF);
+    frame[9] = state;
+    frame[10] = chksum;
+}
+
+}
+
+void SpheroRollBatch::encode(unsigned char const* speeds,
+                             unsigned short const* headings,
+                             unsigned char const* seqs,
+                             std::size_t count,
+                             unsigned char const* states) {
+    // Frames of the previous batch may still be waiting in a send queue
+    if (!buffer_ || buffer_.use_count() > 1)
+        buffer_ = make_shared<vector<unsigned char>>();
+
+    buffer_->resize(count * FRAME_SIZE);
+    count_ = count;
+    encodeFrames(buffer_->data(), speeds, headings, seqs, states, count);
+}
+
+void SpheroRollBatch::encodeFramesScalar(unsigned char * out,
+                                         unsigned char const* speeds,
+                                         unsigned short const* headings,
+                                         unsigned char const* seqs,
+                                         unsigned char const* states,
+                                         std::size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        unsigned char state = states ? states[i] : 1;
+        unsigned sum = ROLL_CONSTANT_SUM + seqs[i] + speeds[i] +
+            (headings[i] >> 8) + (headings[i] & 0xFF) + state;
+        writeRollFrame(out + i * FRAME_SIZE, speeds[i], headings[i], seqs[i],
+                       state, (unsigned char)~sum);
+    }
+}
+
+void SpheroRollBatch::encodeFrames(unsigned char * out,
+                                   unsigned char const* speeds,
+                                   unsigned short const* headings,
+                                   unsigned char const* seqs,
+                                   unsigned char const* states,
+                                   std::size_t count) {
+    size_t i = 0;
+
+#ifdef BTCONN_HAVE_SSE2
+    // Byte-wise adds wrap modulo 256, which is exactly the checksum sum
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    const __m128i base = _mm_set1_epi8((char)ROLL_CONSTANT_SUM);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i allOnes = _mm_set1_epi8((char)0xFF);
+
+    alignas(16) unsigned char chksums[16];
+    for (; i + 16 <= count; i += 16) {
+        __m128i h0 = _mm_loadu_si128((__m128i const*)(headings + i));
+        __m128i h1 = _mm_loadu_si128((__m128i const*)(headings + i + 8));
+        __m128i hi = _mm_packus_epi16(_mm_srli_epi16(h0, 8), _mm_srli_epi16(h1, 8));
+        __m128i lo = _mm_packus_epi16(_mm_and_si128(h0, lowByte), _mm_and_si128(h1, lowByte));
+        __m128i st = states ? _mm_loadu_si128((__m128i const*)(states + i)) : one;
+
+        __m128i sum = _mm_add_epi8(base, _mm_loadu_si128((__m128i const*)(seqs + i)));
+        sum = _mm_add_epi8(sum, _mm_loadu_si128((__m128i const*)(speeds + i)));
+        sum = _mm_add_epi8(sum, _mm_add_epi8(hi, lo));
+        sum = _mm_add_epi8(sum, st);
+        _mm_store_si128((__m128i *)chksums, _mm_xor_si128(sum, allOnes));
+
+        for (size_t j = 0; j < 16; ++j) {
+            writeRollFrame(out + (i + j) * FRAME_SIZE, speeds[i + j], headings[i + j],
+                           seqs[i + j], states ? states[i + j] : 1, chksums[j]);
+        }
+    }
+#endif
+
+    encodeFramesScalar(out + i * FRAME_SIZE, speeds + i, headings + i, seqs + i,
+                       states ? states + i : nullptr, count - i);
+}
@@ -0,0 +1,214 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroShadow.h"
+
+using namespace std;
+
+namespace {
+
+bool withinBand(unsigned a, unsigned b, unsigned band) {
+    return (a > b ? a - b : b - a) <= band;
+}
+
+bool headingsWithinBand(unsigned a, unsigned b, unsigned band) {
+    unsigned diff = (a > b ? a - b : b - a) % 360;
+    return (min)(diff, 360 - diff) <= band;
+}
+
+}
+
+SpheroShadow::SpheroShadow(SpheroHandler & robot,
+                           SpheroShadowOptions const& options) :
+        robot_(robot), options_(options), sent_(0), elided_(0) {
+    for (auto & pending : pending_)
+        pending.slot = SPHERO_COMMAND_SLOTS;
+
+    observerId_ = robot_.addFrameObserver(
+        [this](unsigned char const* frame, std::size_t len, unsigned slot) {
+            onFrame(frame, len, slot);
+        });
+    dropObserverId_ = robot_.addDropObserver(
+        [this](unsigned char seq, unsigned slot) {
+            onDropped(seq, slot);
+        });
+}
+
+SpheroShadow::~SpheroShadow() {
+    robot_.removeFrameObserver(observerId_);
+    robot_.removeFrameObserver(dropObserverId_);
+}
+
+bool SpheroShadow::tracked(unsigned slot) {
+    static const unsigned slots[] = {
+        SetRGBCommand::slot(),
+        SetBackLedCommand::slot(),
+        RollCommand::slot(),
+        SetStabilizeCommand::slot(),
+        SetRotationRateCommand::slot(),
+        SetOptionsFlagCommand::slot(),
+        SetTempOptionsFlagCommand::slot(),
+        SetPowerNotifyCommand::slot(),
+        SetAutoReconnectCommand::slot(),
+        SetInactiveTimerCommand::slot(),
+        SetMotionToCommand::slot(),
+    };
+    return find(begin(slots), end(slots), slot) != end(slots);
+}
+
+bool SpheroShadow::redundant(unsigned slot,
+                             std::vector<unsigned char> const& acked,
+                             std::vector<unsigned char> const& data,
+                             SpheroShadowOptions const& options) {
+    if (acked.size() != data.size()) return false;
+
+    if (slot == SetRGBCommand::slot() && data.size() >= 3) {
+        for (size_t i = 0; i < 3; ++i) {
+            if (!withinBand(acked[i], data[i], options.colorDeadband)) return false;
+        }
+        return equal(acked.begin() + 3, acked.end(), data.begin() + 3);
+    }
+    if (slot == SetBackLedCommand::slot() && data.size() == 1) {
+        return withinBand(acked[0], data[0], options.colorDeadband);
+    }
+    if (slot == RollCommand::slot() && data.size() >= 3) {
+        unsigned ackedHeading = (acked[1] << 8) | acked[2];
+        unsigned heading = (data[1] << 8) | data[2];
+        return withinBand(acked[0], data[0], options.speedDeadband) &&
+               headingsWithinBand(ackedHeading, heading, options.headingDeadband) &&
+               equal(acked.begin() + 3, acked.end(), data.begin() + 3);
+    }
+    return acked == data;
+}
+
+int SpheroShadow::send(SpheroSharedFramePtr const& frame) {
+    unsigned slot = frame->slot();
+    if (!tracked(slot)) {
+        int seq = robot_.sendFrame(frame);
+        lock_guard<mutex> lock(mutex_);
+        ++sent_;
+        return seq;
+    }
+
+    unique_lock<mutex> lock(mutex_);
+    Setting & acked = acked_[slot];
+    // With a change still in flight the robot may not end up as acknowledged
+    if (acked.known && acked.inFlight == 0 &&
+        redundant(slot, acked.frame->body(), frame->body(), options_)) {
+        ++elided_;
+        return ELIDED;
+    }
+
+    // Register the SEQ before sending, the response may beat us back.
+    // A SEQ still pending from 256 commands ago lost its response.
+    unsigned char seq = robot_.nextSeq();
+    release(pending_[seq]);
+    pending_[seq].slot = slot;
+    pending_[seq].frame = frame;
+    ++acked.inFlight;
+    ++sent_;
+    lock.unlock();
+
+    try {
+        robot_.sendEncoded(frame->view(seq), slot, seq);
+    } catch (...) {
+        lock.lock();
+        release(pending_[seq]);
+        --sent_;
+        throw;
+    }
+    return seq;
+}
+
+void SpheroShadow::release(Pending & pending) {
+    if (pending.slot < SPHERO_COMMAND_SLOTS) --acked_[pending.slot].inFlight;
+    pending.slot = SPHERO_COMMAND_SLOTS;
+    pending.frame.reset();
+}
+
+void SpheroShadow::onFrame(unsigned char const* frame, std::size_t,
+                           unsigned slot) {
+    if (slot == SpheroHandler::ASYNC_FRAME) {
+        // The robot wakes up with its defaults
+        if (frame[2] == ASYNC_PRE_SLEEP) invalidateAll();
+        return;
+    }
+    if (!tracked(slot)) return;
+
+    lock_guard<mutex> lock(mutex_);
+    Pending & pending = pending_[frame[3]];
+    Setting & setting = acked_[slot];
+
+    if (pending.slot == slot && frame[2] == ORBOTIX_RSP_CODE_OK) {
+        setting.frame.swap(pending.frame);
+        setting.known = true;
+    } else {
+        // Rejected, or sent around the shadow: the setting is unknown
+        setting.known = false;
+    }
+    if (pending.slot == slot) release(pending);
+}
+
+void SpheroShadow::onDropped(unsigned char seq, unsigned slot) {
+    // Never sent, so the robot keeps what it last acknowledged
+    lock_guard<mutex> lock(mutex_);
+    if (pending_[seq].slot == slot) release(pending_[seq]);
+}
+
+void SpheroShadow::setOptions(SpheroShadowOptions const& options) {
+    lock_guard<mutex> lock(mutex_);
+    options_ = options;
+}
+
+std::vector<SpheroSharedFramePtr> SpheroShadow::settings() const {
+    vector<SpheroSharedFramePtr> ret;
+    lock_guard<mutex> lock(mutex_);
+    for (unsigned slot = 0; slot < SPHERO_COMMAND_SLOTS; ++slot) {
+        if (acked_[slot].known && slot != RollCommand::slot())
+            ret.push_back(acked_[slot].frame);
+    }
+    // Motion goes last, once the robot is set up for it
+    Setting const& roll = acked_[RollCommand::slot()];
+    if (roll.known) ret.push_back(roll.frame);
+    return ret;
+}
+
+void SpheroShadow::invalidate(unsigned slot) {
+    lock_guard<mutex> lock(mutex_);
+    acked_.at(slot).known = false;
+}
+
+void SpheroShadow::invalidateAll() {
+    lock_guard<mutex> lock(mutex_);
+    for (auto & setting : acked_)
+        setting.known = false;
+}
+
+uint64_t SpheroShadow::sent() const {
+    lock_guard<mutex> lock(mutex_);
+    return sent_;
+}
+
+uint64_t SpheroShadow::elided() const {
+    lock_guard<mutex> lock(mutex_);
+    return elided_;
+}
@@ -0,0 +1,156 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroStandby.h"
+
+using namespace std;
+
+SpheroStandbyPool::SpheroStandbyPool(SpheroStandbyOptions const& options) :
+        options_(options), lost_(0) {
+}
+
+std::size_t SpheroStandbyPool::apply(SpheroHandler & robot,
+                                     std::vector<SpheroSharedFramePtr> const& frames,
+                                     std::chrono::milliseconds timeout) {
+    // Pipelined, so the whole batch costs about one round trip. The
+    // handlers may outlive a wait cut short, hence the shared tally.
+    struct Tally {
+        mutex m;
+        condition_variable done;
+        size_t completed = 0;
+        size_t applied = 0;
+    };
+    auto tally = make_shared<Tally>();
+
+    size_t sent = 0;
+    for (auto const& frame : frames) {
+        try {
+            robot.sendAsync(frame,
+                [tally](boost::system::error_code const& ec, SpheroResponsePtr response) {
+                    lock_guard<mutex> lock(tally->m);
+                    if (!ec && response && response->messageResponse() == ORBOTIX_RSP_CODE_OK)
+                        ++tally->applied;
+                    ++tally->completed;
+                    tally->done.notify_all();
+                }, SpheroRetryPolicy(0, timeout));
+            ++sent;
+        } catch (std::exception & exc) {
+            BtLogger::log() << "Sending setting to spare failed - " << exc.what() << std::endl;
+        }
+    }
+
+    // Every call completes by its own timeout; the slack covers the io thread
+    unique_lock<mutex> lock(tally->m);
+    tally->done.wait_for(lock, timeout + std::chrono::milliseconds(100),
+        [&]() { return tally->completed == sent; });
+    return tally->applied;
+}
+
+bool SpheroStandbyPool::add(std::unique_ptr<SpheroHandler> robot) {
+    if (!robot) return false;
+
+    size_t applied = apply(*robot, options_.prepare, options_.applyTimeout);
+    if (applied < options_.prepare.size()) {
+        BtLogger::log() << "Spare acknowledged " << std::dec << applied << " of "
+            << options_.prepare.size() << " prepare commands, not keeping it" << std::endl;
+        return false;
+    }
+
+    Spare spare;
+    spare.keepalive.reset(new SpheroKeepalive(*robot, options_.keepalive));
+    spare.robot = std::move(robot);
+
+    lock_guard<mutex> lock(mutex_);
+    spares_.push_back(std::move(spare));
+    return true;
+}
+
+std::size_t SpheroStandbyPool::add(std::vector<SpheroConnectResult> && results) {
+    size_t added = 0;
+    for (auto & result : results) {
+        if (result.robot && add(std::move(result.robot))) ++added;
+    }
+    return added;
+}
+
+std::vector<SpheroStandbyPool::Spare> SpheroStandbyPool::pruneLocked() {
+    vector<Spare> dead;
+    for (auto it = spares_.begin(); it != spares_.end();) {
+        if (it->keepalive->alive()) {
+            ++it;
+            continue;
+        }
+        dead.push_back(std::move(*it));
+        it = spares_.erase(it);
+        ++lost_;
+    }
+    return dead;
+}
+
+std::unique_ptr<SpheroHandler> SpheroStandbyPool::take() {
+    vector<Spare> dead;
+    Spare spare;
+    {
+        lock_guard<mutex> lock(mutex_);
+        dead = pruneLocked();
+        if (spares_.empty()) return nullptr;
+        spare = std::move(spares_.front());
+        spares_.pop_front();
+    }
+    // Closing dead links can take a while, so not under the lock
+    dead.clear();
+    spare.keepalive.reset();
+    return std::move(spare.robot);
+}
+
+SpheroFailoverResult SpheroStandbyPool::promote(std::unique_ptr<SpheroHandler> & active,
+                                                std::vector<SpheroSharedFramePtr> const& settings) {
+    auto start = std::chrono::steady_clock::now();
+    SpheroFailoverResult result;
+
+    unique_ptr<SpheroHandler> spare = take();
+    if (!spare) {
+        BtLogger::log() << "Failover: no spare robot ready" << std::endl;
+        return result;
+    }
+
+    result.promoted = true;
+    result.settings = settings.size();
+    result.applied = apply(*spare, settings, options_.applyTimeout);
+    result.failed = std::move(active);
+    active = std::move(spare);
+    result.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    return result;
+}
+
+std::size_t SpheroStandbyPool::ready() {
+    vector<Spare> dead;
+    lock_guard<mutex> lock(mutex_);
+    dead = pruneLocked();
+    return spares_.size();
+}
+
+uint64_t SpheroStandbyPool::lost() const {
+    lock_guard<mutex> lock(mutex_);
+    return lost_;
+}
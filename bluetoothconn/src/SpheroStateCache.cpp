@@ -0,0 +1,263 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroStateCache.h"
+
+using namespace std;
+
+namespace {
+
+/**
+ * A response frame as the robot would have sent it, for values that
+ * arrive some other way.
+ */
+SpheroResponsePtr makeResponse(unsigned char const* data, std::size_t len) {
+    vector<unsigned char> frame = {
+        0xFF, 0xFF, ORBOTIX_RSP_CODE_OK, 0x00, (unsigned char)(len + 1)
+    };
+    frame.insert(frame.end(), data, data + len);
+    unsigned sum = 0;
+    for (size_t i = 2; i < frame.size(); ++i)
+        sum += frame[i];
+    frame.push_back((unsigned char)~sum);
+
+    auto ret = make_shared<SpheroServerResponse>(frame.data(), frame.size());
+    ret->parseFromInternalData();
+    return ret;
+}
+
+struct Invalidation {
+    unsigned char did;
+    unsigned char setter;
+    unsigned char getter;
+};
+
+// Acknowledged writes that make a cached query stale
+const Invalidation invalidations[] = {
+    { DID_CORE, CMD_SET_BT_NAME, CMD_GET_BT_NAME },
+    { DID_SPHERO, CMD_SET_RGB_LED, CMD_GET_RGB_LED },
+    { DID_SPHERO, CMD_LOCATOR, CMD_READ_LOCATOR },
+};
+
+}
+
+SpheroStateCache::SpheroStateCache(SpheroHandler & robot) :
+        robot_(robot),
+        hits_(0), fetches_(0), joined_(0) {
+    entries_[VersionCommand::slot()].ttl = std::chrono::hours(24);
+    entries_[GetBTNameCommand::slot()].ttl = std::chrono::hours(24);
+    entries_[GetPowerStateCommand::slot()].ttl = std::chrono::seconds(10);
+    entries_[GetRGBCommand::slot()].ttl = std::chrono::seconds(5);
+    entries_[ReadLocatorCommand::slot()].ttl = std::chrono::milliseconds(100);
+
+    observerId_ = robot_.addFrameObserver(
+        [this](unsigned char const* frame, std::size_t len, unsigned slot) {
+            onFrame(frame, len, slot);
+        });
+}
+
+SpheroStateCache::~SpheroStateCache() {
+    robot_.removeFrameObserver(observerId_);
+}
+
+void SpheroStateCache::setTtl(unsigned slot, Clock::duration ttl) {
+    lock_guard<mutex> lock(mutex_);
+    entries_.at(slot).ttl = ttl;
+}
+
+void SpheroStateCache::store(unsigned slot, SpheroResponsePtr const& value) {
+    Entry & entry = entries_[slot];
+    entry.value = value;
+    entry.at = Clock::now();
+    ++entry.generation;
+}
+
+void SpheroStateCache::onFrame(unsigned char const* frame, std::size_t len,
+                               unsigned slot) {
+    if (slot == SpheroHandler::ASYNC_FRAME) {
+        if (frame[2] == ASYNC_SENSOR_DATA) {
+            SpheroStreamLayout stream = robot_.streamingLayout();
+            unsigned char locator[LOCATOR_DATA_SIZE];
+            if (!locatorFromStream(stream.mask1(), stream.mask2(),
+                                   frame + 5, len - 6, locator))
+                return;
+            unique_lock<mutex> lock(mutex_);
+            store(ReadLocatorCommand::slot(), makeResponse(locator, sizeof(locator)));
+            lock.unlock();
+            stored_.notify_all();
+        } else if (frame[2] == ASYNC_POWER_NOTIFY && len > 6) {
+            // Patch the state byte of a cached power state; the rest of
+            // it keeps its age
+            lock_guard<mutex> lock(mutex_);
+            Entry & entry = entries_[GetPowerStateCommand::slot()];
+            if (!entry.value || entry.value->dataLength() < 2) return;
+            vector<unsigned char> data(entry.value->msgData(),
+                                       entry.value->msgData() + entry.value->dataLength());
+            data[1] = frame[5];
+            entry.value = makeResponse(data.data(), data.size());
+        }
+        return;
+    }
+
+    if (slot >= SPHERO_COMMAND_SLOTS - 1 || frame[2] != ORBOTIX_RSP_CODE_OK)
+        return;
+
+    for (auto const& inv : invalidations) {
+        if (slot == spheroCommandSlot(inv.did, inv.setter)) {
+            invalidate(spheroCommandSlot(inv.did, inv.getter));
+            return;
+        }
+    }
+
+    unique_lock<mutex> lock(mutex_);
+    if (entries_[slot].ttl == Clock::duration::zero() && !entries_[slot].fetching)
+        return;
+
+    auto response = make_shared<SpheroServerResponse>(frame, len);
+    response->parseFromInternalData();
+    store(slot, response);
+    lock.unlock();
+    stored_.notify_all();
+}
+
+SpheroResponsePtr SpheroStateCache::get(unsigned slot,
+                                        SpheroSharedFramePtr (*encode)(),
+                                        std::chrono::milliseconds timeout) {
+    auto deadline = Clock::now() + timeout;
+    unique_lock<mutex> lock(mutex_);
+    Entry & entry = entries_[slot];
+
+    if (entry.value && Clock::now() - entry.at < entry.ttl) {
+        ++hits_;
+        return entry.value;
+    }
+
+    uint64_t generation = entry.generation;
+    if (entry.fetching) {
+        // Someone else is already asking; take whatever they get
+        ++joined_;
+        stored_.wait_until(lock, deadline, [&entry, generation]() {
+            return entry.generation != generation || !entry.fetching;
+        });
+        return (entry.generation != generation) ? entry.value : nullptr;
+    }
+
+    entry.fetching = true;
+    ++fetches_;
+    lock.unlock();
+
+    // Retries as the command's policy allows, all within timeout
+    auto attempts = robot_.retryPolicy(slot).retries + 1;
+    auto perAttempt = (max)(timeout / attempts, std::chrono::milliseconds(1));
+
+    SpheroResponsePtr response;
+    try {
+        response = robot_.request(encode(), perAttempt);
+    } catch (...) {
+        lock.lock();
+        entry.fetching = false;
+        lock.unlock();
+        stored_.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    entry.fetching = false;
+    // The io thread normally stored the response already; hand out that
+    // copy, as joined gets do
+    if (response && response->messageResponse() == ORBOTIX_RSP_CODE_OK) {
+        if (entry.generation == generation) store(slot, response);
+        else if (entry.value) response = entry.value;
+    }
+    lock.unlock();
+    stored_.notify_all();
+    return response;
+}
+
+SpheroResponsePtr SpheroStateCache::peek(unsigned slot, Clock::duration * age) const {
+    lock_guard<mutex> lock(mutex_);
+    Entry const& entry = entries_.at(slot);
+    if (age && entry.value) *age = Clock::now() - entry.at;
+    return entry.value;
+}
+
+void SpheroStateCache::invalidate(unsigned slot) {
+    lock_guard<mutex> lock(mutex_);
+    entries_.at(slot).value.reset();
+}
+
+void SpheroStateCache::invalidateAll() {
+    lock_guard<mutex> lock(mutex_);
+    for (auto & entry : entries_)
+        entry.value.reset();
+}
+
+bool SpheroStateCache::locatorFromStream(uint32_t mask1, uint32_t mask2,
+                                         unsigned char const* data, std::size_t len,
+                                         unsigned char (&locator)[LOCATOR_DATA_SIZE]) {
+    const uint32_t needed = STREAM_ODOMETER_X | STREAM_ODOMETER_Y |
+                            STREAM_VELOCITY_X | STREAM_VELOCITY_Y;
+    if ((mask2 & needed) != needed) return false;
+
+    // A packet may hold several samples
+    SpheroStreamLayout stream(mask1, mask2);
+    size_t count = stream.samples(len);
+    if (count == 0) return false;
+    unsigned char const* sample = data + (count - 1) * stream.sampleSize();
+
+    auto field = [&](uint32_t bit) {
+        return sample + stream.offset(0, bit);
+    };
+    memcpy(locator + 0, field(STREAM_ODOMETER_X), 2);
+    memcpy(locator + 2, field(STREAM_ODOMETER_Y), 2);
+
+    // Velocities stream in mm/s; ReadLocator reports cm/s
+    auto velocity = [](unsigned char const* p) {
+        return (int16_t)(SpheroStreamLayout::value(p) / 10);
+    };
+    int16_t vx = velocity(field(STREAM_VELOCITY_X));
+    int16_t vy = velocity(field(STREAM_VELOCITY_Y));
+    unsigned sog = (unsigned)(min)(std::sqrt((double)vx * vx + (double)vy * vy), 65535.0);
+
+    locator[4] = (unsigned char)((uint16_t)vx >> 8);
+    locator[5] = (unsigned char)(vx & 0xFF);
+    locator[6] = (unsigned char)((uint16_t)vy >> 8);
+    locator[7] = (unsigned char)(vy & 0xFF);
+    locator[8] = (unsigned char)(sog >> 8);
+    locator[9] = (unsigned char)(sog & 0xFF);
+    return true;
+}
+
+uint64_t SpheroStateCache::hits() const {
+    lock_guard<mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t SpheroStateCache::fetches() const {
+    lock_guard<mutex> lock(mutex_);
+    return fetches_;
+}
+
+uint64_t SpheroStateCache::joined() const {
+    lock_guard<mutex> lock(mutex_);
+    return joined_;
+}
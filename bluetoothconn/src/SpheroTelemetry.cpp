@@ -0,0 +1,254 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroTelemetry.h"
+
+using namespace std;
+
+namespace {
+
+// Raw samples take one word: microseconds since the epoch, then the value
+uint64_t packSample(uint64_t micros, short value) {
+    return (micros << 16) | (uint16_t)value;
+}
+
+// Buckets take two: start and min, then max and the mean's bits
+void packBucket(uint64_t start, short min, short max, float mean, uint64_t (&entry)[2]) {
+    uint32_t meanBits;
+    memcpy(&meanBits, &mean, sizeof(meanBits));
+    entry[0] = (start << 16) | (uint16_t)min;
+    entry[1] = ((uint64_t)(uint16_t)max << 32) | meanBits;
+}
+
+}
+
+// One spare slot: the slot being written is never one a reader may return
+SpheroTelemetry::Ring::Ring(std::size_t entries, unsigned width) :
+        words(new boost::atomic<uint64_t>[(entries + 1) * width]),
+        capacity(entries + 1), wordsPerEntry(width), head(0) {
+    for (size_t i = 0; i < capacity * width; ++i)
+        words[i].store(0, boost::memory_order_relaxed);
+}
+
+void SpheroTelemetry::Ring::push(uint64_t const* entry) {
+    uint64_t h = head.load(boost::memory_order_relaxed);
+    // Readers that see any of these words must also see the head before it
+    boost::atomic_thread_fence(boost::memory_order_release);
+    boost::atomic<uint64_t> * slot = &words[(h % capacity) * wordsPerEntry];
+    for (unsigned w = 0; w < wordsPerEntry; ++w)
+        slot[w].store(entry[w], boost::memory_order_relaxed);
+    head.store(h + 1, boost::memory_order_release);
+}
+
+uint64_t SpheroTelemetry::Ring::copy(std::vector<uint64_t> & out) const {
+    out.clear();
+
+    uint64_t last = head.load(boost::memory_order_acquire);
+    uint64_t first = (last > capacity - 1) ? last - (capacity - 1) : 0;
+    out.reserve((size_t)(last - first) * wordsPerEntry);
+    for (uint64_t i = first; i < last; ++i) {
+        boost::atomic<uint64_t> const* slot = &words[(i % capacity) * wordsPerEntry];
+        for (unsigned w = 0; w < wordsPerEntry; ++w)
+            out.push_back(slot[w].load(boost::memory_order_relaxed));
+    }
+
+    // The writer may have lapped us while copying: anything at or below
+    // head - capacity has been (or is being) overwritten
+    boost::atomic_thread_fence(boost::memory_order_acquire);
+    uint64_t now = head.load(boost::memory_order_relaxed);
+    uint64_t valid = (now >= capacity) ? now - capacity + 1 : 0;
+    if (valid > first) {
+        uint64_t lost = (min)(valid - first, last - first);
+        out.erase(out.begin(), out.begin() + (size_t)lost * wordsPerEntry);
+        first += lost;
+    }
+    return first;
+}
+
+SpheroTelemetry::Channel::Channel(SpheroTelemetryOptions const& options) :
+        raw(options.rawSamples, 1) {
+    for (unsigned i = 0; i < options.tiers; ++i)
+        tiers.push_back(unique_ptr<Ring>(new Ring(options.bucketsPerTier, 2)));
+    Partial empty = {};
+    partials.assign(options.tiers, empty);
+}
+
+SpheroTelemetry::SpheroTelemetry(SpheroHandler & robot,
+                                 SpheroTelemetryOptions const& options) :
+        options_(options), robot_(&robot), observerId_(0),
+        layout_(0), packets_(0), samples_(0), unparsed_(0) {
+    init();
+    observerId_ = robot_->addFrameObserver(
+        [this](unsigned char const* frame, std::size_t len, unsigned slot) {
+            if (slot == SpheroHandler::ASYNC_FRAME &&
+                frame[2] == ASYNC_SENSOR_DATA && len > 6)
+                feed(frame + 5, len - 6, Clock::now());
+        });
+}
+
+SpheroTelemetry::SpheroTelemetry(SpheroTelemetryOptions const& options) :
+        options_(options), robot_(nullptr), observerId_(0),
+        layout_(0), packets_(0), samples_(0), unparsed_(0) {
+    init();
+}
+
+SpheroTelemetry::~SpheroTelemetry() {
+    if (robot_) robot_->removeFrameObserver(observerId_);
+}
+
+void SpheroTelemetry::init() {
+    options_.decimation = (max)(options_.decimation, 1U);
+    epoch_ = Clock::now();
+    clock_.reset();
+
+    uint64_t wanted = ((uint64_t)options_.mask1 << 32) | options_.mask2;
+    for (unsigned i = 0; i < CHANNELS; ++i) {
+        if (wanted & ((uint64_t)1 << (CHANNELS - 1 - i)))
+            channels_[i].reset(new Channel(options_));
+    }
+}
+
+unsigned SpheroTelemetry::channel(uint32_t mask1Bit, uint32_t mask2Bit) {
+    uint64_t bit = ((uint64_t)mask1Bit << 32) | mask2Bit;
+    unsigned i = 0;
+    while (i < CHANNELS && !(bit & ((uint64_t)1 << (CHANNELS - 1 - i))))
+        ++i;
+    return i;
+}
+
+std::size_t SpheroTelemetry::bytesPerChannel(SpheroTelemetryOptions const& options) {
+    return sizeof(boost::atomic<uint64_t>) *
+        (options.rawSamples + 1 + 2 * (options.bucketsPerTier + 1) * options.tiers);
+}
+
+std::size_t SpheroTelemetry::memoryBytes() const {
+    size_t channels = 0;
+    for (auto const& channel : channels_) {
+        if (channel) ++channels;
+    }
+    return channels * bytesPerChannel(options_);
+}
+
+void SpheroTelemetry::setStreamingMask(uint32_t mask1, uint32_t mask2) {
+    layout_.store(((uint64_t)mask1 << 32) | mask2, boost::memory_order_relaxed);
+}
+
+void SpheroTelemetry::feed(unsigned char const* data, std::size_t len,
+                           Clock::time_point arrival) {
+    SpheroStreamLayout stream = robot_ ? robot_->streamingLayout() :
+        SpheroStreamLayout(layout_.load(boost::memory_order_relaxed));
+    size_t count = stream.samples(len);
+    if (count == 0) {
+        unparsed_.fetch_add(1, boost::memory_order_relaxed);
+        return;
+    }
+
+    // Fields are in channel order
+    clock_.packet(arrival, count);
+    unsigned char const* field = data;
+    for (size_t s = 0; s < count; ++s) {
+        Clock::time_point at = clock_.at(s);
+        uint64_t micros = (at > epoch_) ? (uint64_t)std::chrono::duration_cast<
+            std::chrono::microseconds>(at - epoch_).count() : 0;
+
+        for (unsigned i = 0; i < CHANNELS; ++i) {
+            if (!(stream.masks() & ((uint64_t)1 << (CHANNELS - 1 - i)))) continue;
+            if (channels_[i])
+                record(*channels_[i], micros, SpheroStreamLayout::value(field));
+            field += 2;
+        }
+    }
+
+    packets_.fetch_add(1, boost::memory_order_relaxed);
+    samples_.fetch_add(count, boost::memory_order_relaxed);
+}
+
+void SpheroTelemetry::record(Channel & channel, uint64_t micros, short value) {
+    uint64_t entry = packSample(micros, value);
+    channel.raw.push(&entry);
+    merge(channel, 0, micros, value, value, value, 1);
+}
+
+void SpheroTelemetry::merge(Channel & channel, unsigned tier, uint64_t start,
+                            short min, short max, double sum, uint64_t samples) {
+    if (tier >= channel.partials.size()) return;
+
+    Partial & partial = channel.partials[tier];
+    if (partial.inputs == 0) {
+        partial.start = start;
+        partial.min = min;
+        partial.max = max;
+        partial.sum = 0;
+        partial.samples = 0;
+    } else {
+        partial.min = (std::min)(partial.min, min);
+        partial.max = (std::max)(partial.max, max);
+    }
+    partial.sum += sum;
+    partial.samples += samples;
+    if (++partial.inputs < options_.decimation) return;
+
+    uint64_t entry[2];
+    packBucket(partial.start, partial.min, partial.max,
+               (float)(partial.sum / (double)partial.samples), entry);
+    channel.tiers[tier]->push(entry);
+
+    partial.inputs = 0;
+    merge(channel, tier + 1, partial.start, partial.min, partial.max,
+          partial.sum, partial.samples);
+}
+
+std::vector<SpheroTelemetry::Sample> SpheroTelemetry::raw(unsigned channel) const {
+    vector<Sample> ret;
+    if (!recorded(channel)) return ret;
+
+    vector<uint64_t> words;
+    channels_[channel]->raw.copy(words);
+    ret.reserve(words.size());
+    for (uint64_t word : words) {
+        Sample sample;
+        sample.at = epoch_ + std::chrono::microseconds(word >> 16);
+        sample.value = (short)(uint16_t)(word & 0xFFFF);
+        ret.push_back(sample);
+    }
+    return ret;
+}
+
+std::vector<SpheroTelemetry::Bucket> SpheroTelemetry::tier(unsigned channel,
+                                                           unsigned tier) const {
+    vector<Bucket> ret;
+    if (!recorded(channel) || tier == 0 || tier > options_.tiers) return ret;
+
+    vector<uint64_t> words;
+    channels_[channel]->tiers[tier - 1]->copy(words);
+    ret.reserve(words.size() / 2);
+    for (size_t i = 0; i + 1 < words.size(); i += 2) {
+        Bucket bucket;
+        bucket.start = epoch_ + std::chrono::microseconds(words[i] >> 16);
+        bucket.min = (short)(uint16_t)(words[i] & 0xFFFF);
+        bucket.max = (short)(uint16_t)(words[i + 1] >> 32);
+        uint32_t meanBits = (uint32_t)(words[i + 1] & 0xFFFFFFFF);
+        memcpy(&bucket.mean, &meanBits, sizeof(meanBits));
+        ret.push_back(bucket);
+    }
+    return ret;
+}
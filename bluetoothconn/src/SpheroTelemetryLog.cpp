@@ -0,0 +1,512 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroDeltaCodec.h"
+#include "btconn/SpheroTelemetryLog.h"
+
+using namespace std;
+namespace bip = boost::interprocess;
+
+namespace {
+
+typedef SpheroTelemetryLogFormat Format;
+
+uint64_t headerBytes() {
+    return (sizeof(Format::SegmentHeader) + 7) & ~7ULL;
+}
+
+uint64_t footerBytes() {
+    return 2 * sizeof(Format::Footer);
+}
+
+}
+
+SpheroTelemetryLog::SpheroTelemetryLog(std::string const& path,
+                                       SpheroTelemetryLogOptions const& options) :
+        path_(path), options_(options), base_(nullptr),
+        segment_(0), end_(0), commit_(0), rowsWritten_(0), bytesWritten_(0), closed_(false) {
+    // Segments start on allocation boundaries (64KB on Windows)
+    const uint64_t granularity = 64 * 1024;
+    options_.segmentBytes = (size_t)(((uint64_t)options_.segmentBytes + granularity - 1) /
+                                     granularity * granularity);
+    options_.blockRows = (max)(options_.blockRows, 1U);
+
+    {
+        ofstream create(path_.c_str(), ios::out | ios::binary | ios::trunc);
+        if (!create)
+            throw bip::interprocess_exception((string("Unable to create telemetry log ") + path_).c_str());
+    }
+    bip::file_mapping(path_.c_str(), bip::read_write).swap(file_);
+
+    epoch_ = lastCommit_ = Clock::now();
+    mapSegment(0);
+}
+
+SpheroTelemetryLog::~SpheroTelemetryLog() {
+    close();
+}
+
+void SpheroTelemetryLog::mapSegment(uint64_t index) {
+    bip::mapped_region().swap(region_);
+    base_ = nullptr;
+
+    uint64_t size = (index + 1) * options_.segmentBytes;
+    {
+        // Grow the file by writing its last byte
+        filebuf grow;
+        if (!grow.open(path_.c_str(), ios::in | ios::out | ios::binary) ||
+            grow.pubseekoff((streamoff)(size - 1), ios::beg) == streampos(-1) ||
+            grow.sputc(0) == char_traits<char>::eof())
+            throw bip::interprocess_exception((string("Unable to grow telemetry log ") + path_).c_str());
+    }
+    bip::mapped_region(file_, bip::read_write,
+        (bip::offset_t)(index * options_.segmentBytes), options_.segmentBytes).swap(region_);
+    base_ = (unsigned char *)region_.get_address();
+    segment_ = index;
+
+    Format::SegmentHeader header = {};
+    header.magic = Format::SEGMENT_MAGIC;
+    header.version = Format::VERSION;
+    header.segmentBytes = options_.segmentBytes;
+    header.index = index;
+    header.epoch = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() -
+        (int64_t)micros(Clock::now());
+    memcpy(base_, &header, sizeof(header));
+    end_ = headerBytes();
+}
+
+void SpheroTelemetryLog::nextSegment() {
+    writeFooter(true);
+    for (auto & source : sources_) {
+        if (!source.block) continue;
+        source.block = nullptr;
+        source.rows = 0;
+    }
+    mapSegment(segment_ + 1);
+}
+
+unsigned char * SpheroTelemetryLog::reserve(uint64_t bytes) {
+    uint64_t limit = options_.segmentBytes - footerBytes();
+    if (end_ + bytes > limit) nextSegment();
+    if (end_ + bytes > limit)
+        throw bip::interprocess_exception("Telemetry log segments are too small for a block");
+
+    unsigned char * at = base_ + end_;
+    end_ += bytes;
+    bytesWritten_ += bytes;
+    return at;
+}
+
+void SpheroTelemetryLog::startBlock(Source & source) {
+    if (source.block && source.rows == source.block->capacity)
+        filled_.push_back(source.block);
+    source.block = nullptr;
+    source.rows = 0;
+
+    uint64_t limit = options_.segmentBytes - footerBytes();
+    uint64_t perRow = 8 + 2ULL * source.columns;
+    uint32_t capacity = options_.blockRows;
+    if (end_ + Format::blockBytes(capacity, source.columns) > limit) {
+        // Use up the rest of the segment unless that would leave a runt
+        uint64_t room = (limit > end_ + sizeof(Format::BlockHeader) + 8) ?
+            (limit - end_ - sizeof(Format::BlockHeader) - 8) / perRow : 0;
+        if (room < (uint64_t)(max)(capacity / 4, 1U))
+            nextSegment();
+        else
+            capacity = (uint32_t)room;
+    }
+
+    Format::BlockHeader * block = (Format::BlockHeader *)reserve(
+        Format::blockBytes(capacity, source.columns));
+    memset(block, 0, sizeof(*block));
+    block->magic = Format::BLOCK_MAGIC;
+    block->source = (uint32_t)(&source - &sources_[0]);
+    block->mask1 = source.mask1;
+    block->mask2 = source.mask2;
+    block->capacity = capacity;
+    block->columns = source.columns;
+
+    source.block = block;
+    source.capacity = capacity;
+}
+
+void SpheroTelemetryLog::writeCompressed(Source & source) {
+    uint32_t rows = source.rows;
+    if (rows == 0) return;
+    source.rows = 0;
+
+    packed_.resize((4 + (size_t)source.columns) * SpheroDeltaCodec::maxEncodedSize(rows));
+    words_.resize(rows);
+    size_t bytes = 0;
+    for (unsigned word = 0; word < 4; ++word) {
+        for (uint32_t r = 0; r < rows; ++r)
+            words_[r] = (short)(uint16_t)(source.stagedMicros[r] >> (16 * word));
+        bytes += SpheroDeltaCodec::encode(words_.data(), rows, &packed_[bytes]);
+    }
+    for (unsigned c = 0; c < source.columns; ++c)
+        bytes += SpheroDeltaCodec::encode(&source.staged[(size_t)c * source.capacity],
+                                          rows, &packed_[bytes]);
+
+    Format::BlockHeader * block = (Format::BlockHeader *)reserve(
+        Format::compressedBlockBytes((uint32_t)bytes));
+    memset(block, 0, sizeof(*block));
+    block->magic = Format::BLOCK_MAGIC;
+    block->source = (uint32_t)(&source - &sources_[0]);
+    block->mask1 = source.mask1;
+    block->mask2 = source.mask2;
+    block->capacity = rows;
+    block->columns = source.columns;
+    block->flags = Format::BLOCK_COMPRESSED;
+    block->bytes = (uint32_t)bytes;
+    // Complete as of the next commit
+    block->rows[(commit_ + 1) & 1].commit = commit_ + 1;
+    block->rows[(commit_ + 1) & 1].rows = rows;
+    memcpy(block + 1, packed_.data(), bytes);
+}
+
+unsigned char * SpheroTelemetryLog::nextRow(Source & source, uint64_t micros) {
+    if (options_.compress) {
+        if (source.rows == source.capacity) writeCompressed(source);
+        source.stagedMicros[source.rows] = micros;
+        ++rowsWritten_;
+        return (unsigned char *)source.staged.data() + 2 * source.rows++;
+    }
+
+    if (!source.block || source.rows == source.block->capacity)
+        startBlock(source);
+
+    Format::BlockHeader * block = source.block;
+    uint64_t * times = (uint64_t *)(block + 1);
+    times[source.rows] = micros;
+    ++rowsWritten_;
+    return (unsigned char *)(times + block->capacity) + 2 * source.rows++;
+}
+
+uint64_t SpheroTelemetryLog::micros(Clock::time_point at) const {
+    return (at > epoch_) ? (uint64_t)std::chrono::duration_cast<
+        std::chrono::microseconds>(at - epoch_).count() : 0;
+}
+
+unsigned SpheroTelemetryLog::addSource(uint32_t mask1, uint32_t mask2) {
+    lock_guard<mutex> lock(mutex_);
+    Source source = {};
+    source.mask1 = mask1;
+    source.mask2 = mask2;
+    source.columns = SpheroStreamLayout(mask1, mask2).fields();
+    if (options_.compress) {
+        source.capacity = options_.blockRows;
+        source.stagedMicros.resize(source.capacity);
+        source.staged.resize((size_t)source.capacity * source.columns);
+    }
+    sources_.push_back(std::move(source));
+    return (unsigned)sources_.size() - 1;
+}
+
+unsigned SpheroTelemetryLog::attach(SpheroHandler & robot, uint32_t mask1, uint32_t mask2) {
+    unsigned id = addSource(mask1, mask2);
+    SpheroStreamLayout columns(mask1, mask2);
+    int observerId = robot.addFrameObserver(
+        [this, id, columns, &robot](unsigned char const* frame, std::size_t len, unsigned slot) {
+            if (slot != SpheroHandler::ASYNC_FRAME ||
+                frame[2] != ASYNC_SENSOR_DATA || len <= 6)
+                return;
+            // Samples of another layout would land in the wrong columns
+            SpheroStreamLayout stream = robot.streamingLayout();
+            if (stream.fields() == 0 || stream == columns)
+                feed(id, frame + 5, len - 6, Clock::now());
+        });
+
+    lock_guard<mutex> lock(mutex_);
+    sources_[id].robot = &robot;
+    sources_[id].observerId = observerId;
+    return id;
+}
+
+void SpheroTelemetryLog::detach(unsigned source) {
+    SpheroHandler * robot = nullptr;
+    int observerId = 0;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (source >= sources_.size()) return;
+        swap(robot, sources_[source].robot);
+        observerId = sources_[source].observerId;
+    }
+    // Not under the lock: the observer may be waiting for it
+    if (robot) robot->removeFrameObserver(observerId);
+}
+
+void SpheroTelemetryLog::append(unsigned source, Clock::time_point at, short const* values) {
+    lock_guard<mutex> lock(mutex_);
+    if (closed_ || source >= sources_.size()) return;
+
+    Source & s = sources_[source];
+    unsigned char * cell = nextRow(s, micros(at));
+    size_t stride = 2 * (size_t)s.capacity;
+    for (unsigned c = 0; c < s.columns; ++c, cell += stride)
+        memcpy(cell, &values[c], 2);
+
+    if (Clock::now() - lastCommit_ >= options_.commitInterval)
+        commitLocked(false);
+}
+
+void SpheroTelemetryLog::feed(unsigned source, unsigned char const* data,
+                              std::size_t len, Clock::time_point arrival) {
+    lock_guard<mutex> lock(mutex_);
+    if (closed_ || source >= sources_.size()) return;
+
+    Source & s = sources_[source];
+    SpheroStreamLayout stream(s.mask1, s.mask2);
+    size_t count = stream.samples(len);
+    if (count == 0) return;
+
+    s.clock.packet(arrival, count);
+    for (size_t i = 0; i < count; ++i, data += stream.sampleSize()) {
+        unsigned char * cell = nextRow(s, micros(s.clock.at(i)));
+        size_t stride = 2 * (size_t)s.capacity;
+
+        // Streamed big-endian, stored in native order
+        for (unsigned c = 0; c < s.columns; ++c, cell += stride) {
+            short value = SpheroStreamLayout::value(data + 2 * c);
+            memcpy(cell, &value, 2);
+        }
+    }
+
+    if (Clock::now() - lastCommit_ >= options_.commitInterval)
+        commitLocked(false);
+}
+
+void SpheroTelemetryLog::commitLocked(bool sealed) {
+    if (!base_) return;
+    if (options_.compress) {
+        for (auto & source : sources_)
+            writeCompressed(source);
+    }
+    writeFooter(sealed);
+}
+
+void SpheroTelemetryLog::writeFooter(bool sealed) {
+
+    uint64_t n = ++commit_;
+    for (auto * block : filled_) {
+        block->rows[n & 1].rows = block->capacity;
+        block->rows[n & 1].commit = n;
+    }
+    filled_.clear();
+    for (auto & source : sources_) {
+        if (!source.block) continue;
+        source.block->rows[n & 1].rows = source.rows;
+        source.block->rows[n & 1].commit = n;
+    }
+
+    // Everything the footer covers must be in place before the footer
+    boost::atomic_thread_fence(boost::memory_order_release);
+    if (options_.durable)
+        region_.flush(0, (size_t)end_, false);
+
+    Format::Footer footer = {};
+    footer.magic = Format::FOOTER_MAGIC;
+    footer.sealed = sealed ? 1 : 0;
+    footer.commit = n;
+    footer.end = end_;
+    footer.checksum = Format::checksum(footer);
+    uint64_t offset = Format::footerOffset(options_.segmentBytes, n);
+    memcpy(base_ + offset, &footer, sizeof(footer));
+    if (options_.durable)
+        region_.flush((size_t)offset, sizeof(footer), false);
+
+    lastCommit_ = Clock::now();
+}
+
+void SpheroTelemetryLog::commit() {
+    lock_guard<mutex> lock(mutex_);
+    if (!closed_) commitLocked(false);
+}
+
+void SpheroTelemetryLog::close() {
+    vector<pair<SpheroHandler *, int>> observers;
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (auto & source : sources_) {
+            if (source.robot) observers.push_back(make_pair(source.robot, source.observerId));
+            source.robot = nullptr;
+        }
+    }
+    for (auto const& observer : observers)
+        observer.first->removeFrameObserver(observer.second);
+
+    lock_guard<mutex> lock(mutex_);
+    if (closed_) return;
+    commitLocked(true);
+    region_.flush(0, 0, false);
+    bip::mapped_region().swap(region_);
+    base_ = nullptr;
+    closed_ = true;
+}
+
+uint64_t SpheroTelemetryLog::rowsWritten() {
+    lock_guard<mutex> lock(mutex_);
+    return rowsWritten_;
+}
+
+uint64_t SpheroTelemetryLog::commits() {
+    lock_guard<mutex> lock(mutex_);
+    return commit_;
+}
+
+uint64_t SpheroTelemetryLog::bytesWritten() {
+    lock_guard<mutex> lock(mutex_);
+    return bytesWritten_;
+}
+
+SpheroTelemetryLogReader::SpheroTelemetryLogReader(std::string const& path) :
+        segments_(0) {
+    uint64_t size = 0;
+    {
+        ifstream in(path.c_str(), ios::in | ios::binary | ios::ate);
+        if (!in)
+            throw bip::interprocess_exception((string("Unable to open telemetry log ") + path).c_str());
+        size = (uint64_t)in.tellg();
+    }
+    if (size < headerBytes()) return;
+
+    bip::file_mapping(path.c_str(), bip::read_only).swap(file_);
+    bip::mapped_region(file_, bip::read_only, 0, (size_t)size).swap(region_);
+
+    unsigned char const* base = (unsigned char const*)region_.get_address();
+    uint64_t offset = 0;
+    while (offset + headerBytes() <= size) {
+        Format::SegmentHeader header;
+        memcpy(&header, base + offset, sizeof(header));
+        if (header.magic != Format::SEGMENT_MAGIC || header.version != Format::VERSION ||
+            header.segmentBytes < headerBytes() + footerBytes() ||
+            offset + header.segmentBytes > size)
+            break;
+
+        scanSegment(base + offset, header.segmentBytes);
+        ++segments_;
+        offset += header.segmentBytes;
+    }
+}
+
+void SpheroTelemetryLogReader::scanSegment(unsigned char const* segment,
+                                           uint64_t segmentBytes) {
+    Format::SegmentHeader const* segmentHeader = (Format::SegmentHeader const*)segment;
+
+    // The newest footer that is intact
+    Format::Footer footer = {};
+    for (uint64_t slot = 0; slot < 2; ++slot) {
+        Format::Footer candidate;
+        memcpy(&candidate, segment + Format::footerOffset(segmentBytes, slot),
+               sizeof(candidate));
+        if (candidate.magic == Format::FOOTER_MAGIC &&
+            candidate.checksum == Format::checksum(candidate) &&
+            candidate.commit > footer.commit)
+            footer = candidate;
+    }
+    if (footer.commit == 0 || footer.end > segmentBytes - footerBytes()) return;
+
+    uint64_t offset = headerBytes();
+    while (offset + sizeof(Format::BlockHeader) <= footer.end) {
+        Format::BlockHeader const* header = (Format::BlockHeader const*)(segment + offset);
+        if (header->magic != Format::BLOCK_MAGIC) break;
+        bool compressed = (header->flags & Format::BLOCK_COMPRESSED) != 0;
+        uint64_t bytes = compressed ? Format::compressedBlockBytes(header->bytes) :
+            Format::blockBytes(header->capacity, header->columns);
+        if (offset + bytes > footer.end) break;
+
+        // The newest row count the footer covers
+        uint64_t rows = 0;
+        uint64_t newest = 0;
+        for (auto const& count : header->rows) {
+            if (count.commit <= footer.commit && count.commit > newest) {
+                newest = count.commit;
+                rows = (min)(count.rows, (uint64_t)header->capacity);
+            }
+        }
+
+        Block block;
+        block.source = header->source;
+        block.mask1 = header->mask1;
+        block.mask2 = header->mask2;
+        block.rows = rows;
+        block.epoch = segmentHeader->epoch;
+        block.capacity = header->capacity;
+        block.columns = header->columns;
+        block.compressed = compressed;
+        if (compressed) {
+            block.micros = nullptr;
+            block.data = nullptr;
+            block.packed = (unsigned char const*)(header + 1);
+            block.packedBytes = header->bytes;
+        } else {
+            block.micros = (uint64_t const*)(header + 1);
+            block.data = (short const*)(block.micros + header->capacity);
+            block.packed = nullptr;
+            block.packedBytes = 0;
+        }
+        if (rows > 0) blocks_.push_back(block);
+
+        offset += bytes;
+    }
+}
+
+uint64_t SpheroTelemetryLogReader::rows() const {
+    uint64_t total = 0;
+    for (auto const& block : blocks_)
+        total += block.rows;
+    return total;
+}
+
+bool SpheroTelemetryLogReader::decode(Block const& block, std::vector<uint64_t> & micros,
+                                      std::vector<short> & data) {
+    size_t rows = (size_t)block.rows;
+    micros.assign(rows, 0);
+    data.resize(rows * block.columns);
+
+    if (!block.compressed) {
+        copy(block.micros, block.micros + rows, micros.begin());
+        for (unsigned c = 0; c < block.columns; ++c)
+            copy(block.column(c), block.column(c) + rows, data.begin() + c * rows);
+        return true;
+    }
+
+    unsigned char const* in = block.packed;
+    size_t left = block.packedBytes;
+    size_t consumed = 0;
+    vector<short> words(rows);
+    for (unsigned word = 0; word < 4; ++word) {
+        if (!SpheroDeltaCodec::decode(in, left, words.data(), rows, consumed))
+            return false;
+        for (size_t r = 0; r < rows; ++r)
+            micros[r] |= (uint64_t)(uint16_t)words[r] << (16 * word);
+        in += consumed;
+        left -= consumed;
+    }
+    for (unsigned c = 0; c < block.columns; ++c) {
+        if (!SpheroDeltaCodec::decode(in, left, data.data() + c * rows, rows, consumed))
+            return false;
+        in += consumed;
+        left -= consumed;
+    }
+    return true;
+}
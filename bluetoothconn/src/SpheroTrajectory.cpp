@@ -0,0 +1,141 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroTrajectory.h"
+
+using namespace std;
+
+typedef std::chrono::steady_clock Clock;
+
+struct SpheroTrajectoryExecutor::Run : std::enable_shared_from_this<Run> {
+    SpheroHandler & robot;
+    Options options;
+    shared_ptr<Stats> stats;
+    vector<SpheroTrajectory::Step> steps;
+    size_t next;
+    Clock::time_point start;
+    boost::asio::steady_timer timer;
+    CompletionHandler onComplete;
+    boost::atomic<bool> finished;
+
+    Run(SpheroHandler & r, Options const& o, shared_ptr<Stats> const& s) :
+        robot(r), options(o), stats(s), next(0),
+        timer(r.getConnection().ioService()), finished(false) {
+    }
+
+    Clock::time_point due(size_t i) const {
+        return start + steps[i].at;
+    }
+
+    void finish(bool completed) {
+        if (finished.exchange(true)) return;
+        if (onComplete) onComplete(completed);
+    }
+
+    void scheduleNext() {
+        if (finished.load()) return;
+        if (next >= steps.size()) {
+            finish(true);
+            return;
+        }
+
+        auto self = shared_from_this();
+        timer.expires_at(due(next));
+        timer.async_wait([self](boost::system::error_code const& ec) {
+            if (ec || self->finished.load()) return;
+            self->fire();
+        });
+    }
+
+    void fire() {
+        auto now = Clock::now();
+
+        // Send every step that is due by now, in order
+        while (next < steps.size() && due(next) <= now) {
+            size_t i = next++;
+            auto late = std::chrono::duration_cast<std::chrono::microseconds>(now - due(i));
+
+            bool lastDue = next >= steps.size() || due(next) > now;
+            if (options.dropLaterThan.count() > 0 && late > options.dropLaterThan && !lastDue) {
+                stats->dropped.fetch_add(1, boost::memory_order_relaxed);
+                continue;
+            }
+
+            try {
+                robot.sendFrame(steps[i].frame);
+            } catch (std::exception & exc) {
+                BtLogger::log() << "Trajectory step " << std::dec << i
+                    << " not sent - " << exc.what() << std::endl;
+                finish(false);
+                return;
+            }
+            stats->lateness.record((uint64_t)late.count());
+            stats->sent.fetch_add(1, boost::memory_order_relaxed);
+        }
+
+        scheduleNext();
+    }
+};
+
+SpheroTrajectoryExecutor::SpheroTrajectoryExecutor(SpheroHandler & robot,
+                                                   Options const& options) :
+        robot_(robot), options_(options), stats_(make_shared<Stats>()) {
+}
+
+SpheroTrajectoryExecutor::~SpheroTrajectoryExecutor() {
+    cancel();
+}
+
+void SpheroTrajectoryExecutor::start(SpheroTrajectory const& trajectory,
+                                     CompletionHandler onComplete) {
+    cancel();
+
+    auto run = make_shared<Run>(robot_, options_, stats_);
+    run->steps = trajectory.steps();
+    stable_sort(run->steps.begin(), run->steps.end(),
+        [](SpheroTrajectory::Step const& a, SpheroTrajectory::Step const& b) {
+            return a.at < b.at;
+        });
+    run->onComplete = onComplete;
+    run->start = Clock::now();
+
+    run_ = run;
+    robot_.getConnection().ioService().post([run]() { run->scheduleNext(); });
+}
+
+void SpheroTrajectoryExecutor::cancel() {
+    shared_ptr<Run> run;
+    run.swap(run_);
+    if (!run) return;
+
+    // The timer belongs to the io thread; cancel it there
+    robot_.getConnection().ioService().post([run]() {
+        boost::system::error_code ec;
+        run->timer.cancel(ec);
+        run->finish(false);
+    });
+}
+
+bool SpheroTrajectoryExecutor::isRunning() const {
+    auto run = run_;
+    return run && !run->finished.load();
+}
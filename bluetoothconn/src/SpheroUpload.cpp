@@ -0,0 +1,215 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroUpload.h"
+
+using namespace std;
+
+namespace {
+    /**
+     * The answer to one chunk sent with sendAsync(), handed over from the
+     * io thread to the uploading thread.
+     */
+    struct Outcome {
+        mutex m;
+        condition_variable completed;
+        bool done = false;
+        SpheroResponsePtr response;
+    };
+    typedef shared_ptr<Outcome> OutcomePtr;
+
+    // How long past its timeout a call may take to be completed
+    const std::chrono::milliseconds COMPLETION_SLACK(100);
+
+    OutcomePtr sendOnce(SpheroHandler & robot, SpheroSharedFramePtr const& frame,
+                        std::chrono::milliseconds timeout) {
+        auto outcome = make_shared<Outcome>();
+        // Chunks append, so a lost answer must not lead to a second copy
+        robot.sendAsync(frame,
+            [outcome](boost::system::error_code const& ec, SpheroResponsePtr response) {
+                lock_guard<mutex> lock(outcome->m);
+                if (!ec) outcome->response = response;
+                outcome->done = true;
+                outcome->completed.notify_all();
+            }, SpheroRetryPolicy(0, timeout));
+        return outcome;
+    }
+
+    /**
+     * The response, or null if the call timed out or was aborted.
+     */
+    SpheroResponsePtr waitFor(OutcomePtr const& outcome, std::chrono::milliseconds timeout) {
+        unique_lock<mutex> lock(outcome->m);
+        outcome->completed.wait_for(lock, timeout + COMPLETION_SLACK,
+            [&outcome]() { return outcome->done; });
+        return outcome->response;
+    }
+}
+
+SpheroUploadProtocol SpheroUploadProtocol::macro() {
+    return SpheroUploadProtocol(DID_SPHERO, CMD_APPEND_TEMP_MACRO_CHUNK,
+                                SpheroUploadCache::TARGET_TEMP_MACRO);
+}
+
+SpheroUploadProtocol SpheroUploadProtocol::orbBasic(unsigned char area) {
+    SpheroUploadProtocol ret(DID_SPHERO, CMD_APPEND_FRAG,
+        area ? SpheroUploadCache::TARGET_ORBBASIC_FLASH : SpheroUploadCache::TARGET_ORBBASIC_RAM);
+    ret.prefix.push_back(area);
+    ret.begin = make_shared<SpheroSharedFrame>(DID_SPHERO, CMD_ERASE_ORBBAS, &area, 1);
+    return ret;
+}
+
+bool SpheroUploader::sendBegin(SpheroUploadProtocol const& protocol, std::string & error) {
+    if (!protocol.begin) return true;
+
+    auto response = waitFor(sendOnce(robot_, protocol.begin, options_.timeout), options_.timeout);
+    if (response && response->messageResponse() == ORBOTIX_RSP_CODE_OK)
+        return true;
+
+    error = response ? response->messageResponseToString() : "No response to begin command";
+    return false;
+}
+
+SpheroUploadResult SpheroUploader::upload(SpheroUploadProtocol const& protocol,
+                                          unsigned char const* data, std::size_t len) {
+    typedef std::chrono::steady_clock Clock;
+
+    struct InFlight {
+        size_t chunk;
+        OutcomePtr outcome;
+    };
+
+    size_t maxChunk = protocol.maxChunk();
+    size_t chunks = (len + maxChunk - 1) / maxChunk;
+    size_t window = (max)(options_.window, (size_t)1);
+
+    SpheroUploadResult result;
+    SpheroUploadProgress & progress = result.progress;
+    progress.bytesDone = 0;
+    progress.bytesTotal = len;
+    progress.chunksDone = 0;
+    progress.chunksTotal = chunks;
+    progress.elapsed = std::chrono::microseconds(0);
+
+    bool cached = cache_ && protocol.cacheTarget != SpheroUploadCache::TARGET_NONE;
+    uint64_t device = cached ?
+        SpheroUploadCache::deviceKey(robot_.getConnection().remoteEndpoint()) : 0;
+
+    if (cached && cache_->isCurrent(device, protocol.cacheTarget, data, len)) {
+        cache_->touch(device);
+        result.ok = result.skipped = true;
+        progress.bytesDone = len;
+        progress.chunksDone = chunks;
+        return result;
+    }
+
+    auto start = Clock::now();
+    auto finish = [&](bool ok) -> SpheroUploadResult & {
+        result.ok = ok;
+        progress.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - start);
+        if (cached) {
+            if (ok) cache_->stored(device, protocol.cacheTarget, data, len);
+            else cache_->forget(device, protocol.cacheTarget);
+        }
+        if (!ok) {
+            BtLogger::log() << "Upload failed after " << std::dec << progress.bytesDone
+                << " of " << len << " bytes - " << result.error << std::endl;
+        }
+        return result;
+    };
+
+    if (!sendBegin(protocol, result.error))
+        return finish(false);
+
+    vector<unsigned char> chunkData;
+    deque<InFlight> inFlight;
+    size_t next = 0;
+
+    while (progress.chunksDone < chunks) {
+        while (inFlight.size() < window && next < chunks) {
+            size_t offset = next * maxChunk;
+            size_t n = (min)(maxChunk, len - offset);
+            chunkData.assign(protocol.prefix.begin(), protocol.prefix.end());
+            chunkData.insert(chunkData.end(), data + offset, data + offset + n);
+
+            InFlight sent;
+            sent.chunk = next++;
+            sent.outcome = sendOnce(robot_, make_shared<SpheroSharedFrame>(
+                protocol.did, protocol.cid, chunkData.data(), chunkData.size()), options_.timeout);
+            inFlight.push_back(sent);
+        }
+
+        // The robot answers in order, so the oldest chunk is answered first
+        InFlight oldest = inFlight.front();
+        inFlight.pop_front();
+        auto response = waitFor(oldest.outcome, options_.timeout);
+
+        if (response && response->messageResponse() == ORBOTIX_RSP_CODE_OK) {
+            ++progress.chunksDone;
+            progress.bytesDone += (min)(maxChunk, len - oldest.chunk * maxChunk);
+            progress.elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                Clock::now() - start);
+            if (onProgress_) onProgress_(progress);
+            continue;
+        }
+
+        result.error = response ?
+            response->messageResponseToString() : "Timed out waiting for chunk";
+        BtLogger::log() << "Upload chunk " << std::dec << oldest.chunk
+            << " failed - " << result.error << std::endl;
+
+        // Settle the rest of the window before deciding how to go on
+        bool laterAccepted = false;
+        for (auto const& sent : inFlight) {
+            auto later = waitFor(sent.outcome, options_.timeout);
+            if (!later || later->messageResponse() == ORBOTIX_RSP_CODE_OK)
+                laterAccepted = true;   // a lost response may have been applied
+        }
+        inFlight.clear();
+
+        if (++result.retries > options_.maxRetries)
+            return finish(false);
+
+        // From here on, one chunk at a time, so a further rejection
+        // never has chunks appended behind it
+        window = 1;
+
+        if (response && !laterAccepted) {
+            // Rejected and nothing appended behind it: resend just this chunk
+            next = oldest.chunk;
+        } else if (protocol.begin) {
+            ++result.restarts;
+            progress.chunksDone = 0;
+            progress.bytesDone = 0;
+            next = 0;
+            if (!sendBegin(protocol, result.error))
+                return finish(false);
+        } else {
+            result.error += " (later chunks were already applied)";
+            return finish(false);
+        }
+    }
+
+    result.error.clear();
+    return finish(true);
+}
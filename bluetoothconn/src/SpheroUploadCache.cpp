@@ -0,0 +1,223 @@
+/*
+ * Sphero C++ Bluetooth Library
+ * Copyright(C) 2016 Angel Caban
+ *
+ * This program is free software : you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "btconn/stdafx.h"
+#include "btconn/BtLogger.h"
+#include "btconn.h"
+#include "btconn/SpheroHandler.h"
+#include "btconn/SpheroUploadCache.h"
+
+using namespace std;
+
+// One entry per line: <device hex> <target> <hash hex> <length> <stored> <last contact>
+#define UPLOAD_CACHE_HEADER "# btconn upload cache v1"
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+SpheroUploadCache::SpheroUploadCache(std::string const& path,
+                                     std::chrono::seconds volatileLifetime) :
+        path_(path), volatileLifetime_(volatileLifetime) {
+}
+
+uint64_t SpheroUploadCache::hash(unsigned char const* data, std::size_t len) {
+    uint64_t h = FNV_OFFSET_BASIS;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= data[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+uint64_t SpheroUploadCache::deviceKey(BluetoothProto::endpoint const& endpoint) {
+    if (endpoint.protocol().family() == AF_BTH &&
+        endpoint.size() >= sizeof(SOCKADDR_BTH)) {
+        SOCKADDR_BTH address;
+        memcpy(&address, endpoint.data(), sizeof(SOCKADDR_BTH));
+        return (uint64_t)address.btAddr;
+    }
+    return hash((unsigned char const*)endpoint.data(), endpoint.size());
+}
+
+bool SpheroUploadCache::expired(Entry const& entry, std::time_t now) const {
+    return isVolatile(entry.target) &&
+        now - entry.lastContact > (std::time_t)volatileLifetime_.count();
+}
+
+bool SpheroUploadCache::load() {
+    ifstream in(path_.c_str());
+    if (!in) return false;
+
+    vector<Entry> loaded;
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+
+        istringstream fields(line);
+        unsigned long long device = 0, h = 0, length = 0;
+        long long storedAt = 0, lastContact = 0;
+        int target = TARGET_NONE;
+        if (!(fields >> hex >> device >> dec >> target >> hex >> h
+                     >> dec >> length >> storedAt >> lastContact)) {
+            BtLogger::log() << "Skipping malformed upload cache line: "
+                << line << std::endl;
+            continue;
+        }
+
+        Entry entry;
+        entry.device = device;
+        entry.target = target;
+        entry.hash = h;
+        entry.length = (size_t)length;
+        entry.stored = (std::time_t)storedAt;
+        entry.lastContact = (std::time_t)lastContact;
+        loaded.push_back(entry);
+    }
+
+    lock_guard<mutex> lock(mutex_);
+    entries_.swap(loaded);
+    return true;
+}
+
+bool SpheroUploadCache::save() const {
+    string tmpPath = path_ + ".tmp";
+    {
+        ofstream out(tmpPath.c_str(), ios::out | ios::trunc);
+        if (!out) return false;
+
+        lock_guard<mutex> lock(mutex_);
+        out << UPLOAD_CACHE_HEADER << "\n";
+        for (auto const& entry : entries_) {
+            out << hex << (unsigned long long)entry.device
+                << dec << " " << entry.target
+                << hex << " " << (unsigned long long)entry.hash
+                << dec << " " << (unsigned long long)entry.length
+                << " " << (long long)entry.stored
+                << " " << (long long)entry.lastContact << "\n";
+        }
+        if (!out.flush()) return false;
+    }
+
+#if defined(_WIN32)
+    if (!MoveFileExA(tmpPath.c_str(), path_.c_str(), MOVEFILE_REPLACE_EXISTING))
+        return false;
+#else
+    if (rename(tmpPath.c_str(), path_.c_str()) != 0)
+        return false;
+#endif
+    return true;
+}
+
+bool SpheroUploadCache::isCurrent(uint64_t device, int target,
+                                  unsigned char const* data, std::size_t len) const {
+    std::time_t now = std::time(nullptr);
+
+    lock_guard<mutex> lock(mutex_);
+    for (auto const& entry : entries_) {
+        if (entry.device != device || entry.target != target) continue;
+        if (expired(entry, now) || entry.length != len) return false;
+        return entry.hash == hash(data, len);
+    }
+    return false;
+}
+
+void SpheroUploadCache::stored(uint64_t device, int target,
+                               unsigned char const* data, std::size_t len) {
+    if (target == TARGET_NONE) return;
+
+    Entry updated;
+    updated.device = device;
+    updated.target = target;
+    updated.hash = hash(data, len);
+    updated.length = len;
+    updated.stored = updated.lastContact = std::time(nullptr);
+
+    lock_guard<mutex> lock(mutex_);
+    for (auto & entry : entries_) {
+        if (entry.device == device && entry.target == target) {
+            entry = updated;
+            return;
+        }
+    }
+    entries_.push_back(updated);
+}
+
+void SpheroUploadCache::touch(uint64_t device) {
+    std::time_t now = std::time(nullptr);
+
+    lock_guard<mutex> lock(mutex_);
+    for (auto & entry : entries_) {
+        // An expired entry stays expired; the robot may have slept meanwhile
+        if (entry.device == device && !expired(entry, now))
+            entry.lastContact = now;
+    }
+}
+
+void SpheroUploadCache::deviceReset(uint64_t device) {
+    lock_guard<mutex> lock(mutex_);
+    entries_.erase(
+        remove_if(entries_.begin(), entries_.end(),
+            [device](Entry const& entry) {
+                return entry.device == device && isVolatile(entry.target);
+            }),
+        entries_.end());
+}
+
+void SpheroUploadCache::forget(uint64_t device, int target) {
+    lock_guard<mutex> lock(mutex_);
+    entries_.erase(
+        remove_if(entries_.begin(), entries_.end(),
+            [device, target](Entry const& entry) {
+                return entry.device == device && entry.target == target;
+            }),
+        entries_.end());
+}
+
+void SpheroUploadCache::forget(uint64_t device) {
+    lock_guard<mutex> lock(mutex_);
+    entries_.erase(
+        remove_if(entries_.begin(), entries_.end(),
+            [device](Entry const& entry) { return entry.device == device; }),
+        entries_.end());
+}
+
+std::vector<SpheroUploadCache::Entry> SpheroUploadCache::entries() const {
+    lock_guard<mutex> lock(mutex_);
+    return entries_;
+}
+
+SpheroUploadWatch::SpheroUploadWatch(SpheroUploadCache & cache, SpheroHandler & robot) :
+        cache_(cache), robot_(robot),
+        device_(SpheroUploadCache::deviceKey(robot.getConnection().remoteEndpoint())) {
+    cache_.deviceReset(device_);
+
+    observerId_ = robot_.addFrameObserver(
+        [this](unsigned char const* frame, std::size_t, unsigned slot) {
+            if (slot == SpheroHandler::ASYNC_FRAME && frame[2] == ASYNC_PRE_SLEEP)
+                cache_.deviceReset(device_);
+        });
+}
+
+SpheroUploadWatch::~SpheroUploadWatch() {
+    robot_.removeFrameObserver(observerId_);
+}
+
+void SpheroUploadWatch::linkLost() {
+    BtLogger::log() << "Link lost, forgetting programs in the robot's RAM" << std::endl;
+    cache_.deviceReset(device_);
+}